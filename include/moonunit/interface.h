@@ -99,6 +99,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                          \
         FIELD(run, __mu_f_test_##suite_name##_##test_name)              \
     };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_test_##suite_name##_##test_name);          \
     void __mu_f_test_##suite_name##_##test_name(void)
 
 /**
@@ -131,6 +132,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                          \
         FIELD(run, __mu_f_library_setup)                                \
     };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_library_setup);                            \
     void __mu_f_library_setup(void)
 
 /**
@@ -163,6 +165,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                          \
         FIELD(run, __mu_f_library_teardown)                             \
     };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_library_teardown);                         \
     void __mu_f_library_teardown(void)
 
 /**
@@ -207,6 +210,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                          \
         FIELD(run, __mu_f_fixture_setup_##suite_name)                   \
     };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_fixture_setup_##suite_name);               \
     void __mu_f_fixture_setup_##suite_name(void)                        \
 
 /**
@@ -256,6 +260,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                          \
         FIELD(run, __mu_f_fixture_teardown_##suite_name)                \
     };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_fixture_teardown_##suite_name);            \
     void __mu_f_fixture_teardown_##suite_name(void)                     \
 
 /**
@@ -298,6 +303,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                          \
         FIELD(run, __mu_f_library_construct)                            \
     };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_library_construct);                        \
     void __mu_f_library_construct(void)
 
 /**
@@ -340,6 +346,7 @@ C_BEGIN_DECLS
         FIELD(line, __LINE__),                                         \
         FIELD(run, __mu_f_library_destruct)                            \
     };                                                                 \
+    MU_ENTRY_REGISTER(__mu_e_library_destruct);                        \
     void __mu_f_library_destruct(void)
 
 /**
@@ -375,7 +382,8 @@ C_BEGIN_DECLS
         FIELD(file, __FILE__),                                          \
         FIELD(line, __LINE__),                                          \
         FIELD(run, NULL)                                                \
-    };
+    };                                                                  \
+    MU_ENTRY_REGISTER(__mu_e_library_info_##info_key)
 
 /**
  * @brief Define library name
@@ -683,6 +691,80 @@ C_BEGIN_DECLS
 #define MU_ITERATE(count)                       \
     (mu_interface_iterations((count)))
 
+/**
+ * @brief Warm up the current test before measuring it
+ *
+ * Use of this macro marks the current test as a benchmark.
+ * The test will first be run the specified number of times
+ * without being measured, which gives caches, allocators and
+ * lazily-initialized state a chance to settle.  The measured
+ * iterations (see MU_ITERATE) then follow, and the time spent
+ * in the test stage of each is summarized in the test result.
+ *
+ * If MU_WARMUP_AUTO is given instead of a count, the test will
+ * be warmed up until the coefficient of variation of its timings
+ * over a sliding window levels off, up to a maximum set by the
+ * loader.  The logger reports how many warmup iterations were run
+ * and whether a steady state was reached.
+ *
+ * <b>Example:</b>
+ * @code
+ * // Warm up until timings are stable, then measure 50 runs
+ * MU_WARMUP(MU_WARMUP_AUTO);
+ * MU_ITERATE(50);
+ * @endcode
+ *
+ * @param count the number of warmup iterations, or MU_WARMUP_AUTO
+ * @hideinitializer
+ */
+#define MU_WARMUP(count)                        \
+    (mu_interface_warmup((count)))
+
+/**
+ * @brief Automatic warmup
+ *
+ * Pass this to MU_WARMUP to warm up until a steady state is detected.
+ * @hideinitializer
+ */
+#define MU_WARMUP_AUTO (-1)
+
+/**
+ * @brief Report the number of bytes processed by the current test
+ *
+ * Use of this macro records how many bytes of input one run of
+ * the test stage processes.  The loader divides this by the time
+ * spent in the test stage (or by the mean time when the test is
+ * benchmarked with MU_WARMUP) and the logger reports the resulting
+ * throughput.  If called more than once, the last value is used.
+ *
+ * <b>Example:</b>
+ * @code
+ * MU_TEST(Codec, decode)
+ * {
+ *     decode(buffer, sizeof(buffer));
+ *     MU_SET_BYTES_PROCESSED(sizeof(buffer));
+ * }
+ * @endcode
+ *
+ * @param count the number of bytes processed
+ * @hideinitializer
+ */
+#define MU_SET_BYTES_PROCESSED(count)           \
+    (mu_interface_bytes_processed((count)))
+
+/**
+ * @brief Report the number of items processed by the current test
+ *
+ * Like MU_SET_BYTES_PROCESSED, but for a count of discrete items
+ * such as records, tokens or messages.  The logger reports the
+ * resulting throughput in items per second.
+ *
+ * @param count the number of items processed
+ * @hideinitializer
+ */
+#define MU_SET_ITEMS_PROCESSED(count)           \
+    (mu_interface_items_processed((count)))
+
 /**
  * @brief Log non-fatal message
  *
@@ -848,6 +930,9 @@ C_BEGIN_DECLS
 void mu_interface_expect(MuTestStatus status);
 void mu_interface_timeout(long ms);
 void mu_interface_iterations(unsigned int count);
+void mu_interface_warmup(int count);
+void mu_interface_bytes_processed(unsigned long long count);
+void mu_interface_items_processed(unsigned long long count);
 void mu_interface_event(const char* file, unsigned int line, MuLogLevel level, const char* fmt, ...);
 void mu_interface_assert(const char* file, unsigned int line, const char* expr, int sense, int result);
 void mu_interface_assert_equal(const char* file, unsigned int line, const char* expr1, const char* expr2, int sense, int type, ...);
@@ -881,6 +966,32 @@ typedef struct MuEntryInfo
 
 extern void __mu_stub_hook(MuEntryInfo*** es);
 
+#if defined(__GNUC__) && defined(__ELF__)
+/*
+ * Each entry also places a pointer to itself in the mu_entries section.
+ * The loader finds the section in the library it has loaded, so entries
+ * can be enumerated without a stub or a symbol table scan.  The section
+ * is never referenced, so it is marked to be retained where the
+ * compiler allows; otherwise libraries linked with --gc-sections must
+ * KEEP it in their linker script.
+ */
+#if defined(__has_attribute)
+#  if __has_attribute(retain)
+#    define MU_ENTRY_RETAIN __attribute__((retain))
+#  endif
+#endif
+#ifndef MU_ENTRY_RETAIN
+#  define MU_ENTRY_RETAIN
+#endif
+
+#define MU_ENTRY_SECTION "mu_entries"
+#define MU_ENTRY_REGISTER(sym)                                          \
+    static MuEntryInfo* __mu_r_##sym                                    \
+    __attribute__((section(MU_ENTRY_SECTION), used)) MU_ENTRY_RETAIN = &sym
+#else
+#define MU_ENTRY_REGISTER(sym) C_DECL MuEntryInfo sym
+#endif
+
 #endif
 
 C_END_DECLS
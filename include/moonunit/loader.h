@@ -49,7 +49,8 @@ typedef struct MuLoader
     bool (*can_open) (struct MuLoader*, const char* path);
     // Opens a library and returns a handle
     struct MuLibrary* (*open) (struct MuLoader*, const char* path, MuError** err);
-    // Returns a null-terminated list of unit tests
+    // Returns a null-terminated list of unit tests.  The list may be
+    // shared with the library, so callers must not modify it
     struct MuTest** (*get_tests) (struct MuLoader*, struct MuLibrary* handle);
     // Frees a list of unit tests that had been returned by get_tests
     void (*free_tests) (struct MuLoader*, struct MuLibrary* handle, struct MuTest** list);
@@ -69,10 +70,21 @@ typedef struct MuLoader
     void (*construct) (struct MuLoader*, struct MuLibrary* handle, MuError** err);
     /* Runs the destructor for a library, which does any needed *one-time* teardown */
     void (*destruct) (struct MuLoader*, struct MuLibrary* handle, MuError** err);
+    /* Reads the name and tests of a library without loading it (optional).
+       The handle may only be used to list tests and must then be closed */
+    struct MuLibrary* (*probe) (struct MuLoader*, const char* path, MuError** err);
+    /* Starts a test without waiting for it (optional, with finish).
+       Returns NULL if the test cannot be started now, in which case
+       it is started later or run with dispatch instead */
+    void* (*start)(struct MuLoader*, struct MuTest*, MuLogLevel);
+    /* Waits for a started test and returns its result, passing on the
+       events it logged.  Every started test must be finished */
+    struct MuTestResult* (*finish)(struct MuLoader*, void* run, MuLogCallback, void*);
 } MuLoader;
 
 bool mu_loader_can_open(MuLoader* loader, const char* path);
 struct MuLibrary* mu_loader_open(MuLoader* loader, const char* path, MuError** err);
+struct MuLibrary* mu_loader_probe(MuLoader* loader, const char* path, MuError** err);
 void mu_loader_set_option(MuLoader* loader, const char *name, ...);
 void mu_loader_set_option_string(MuLoader* loader, const char *name, const char *value);
 MuType mu_loader_option_type(MuLoader* loader, const char *name);
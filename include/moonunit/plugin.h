@@ -36,10 +36,14 @@ struct MuLoader;
 
 typedef struct MuPlugin
 {
-    /** Plugin API version */
+    /** Plugin API version.  Version 2 added fields to MuTestResult,
+        MuLogEvent and MuLoader, so plugins built for version 1 would
+        exchange structures shorter than the harness expects and are
+        no longer loaded */
     enum
     {
-        MU_PLUGIN_API_1
+        MU_PLUGIN_API_1,
+        MU_PLUGIN_API_2
     } version;
     /** Plugin type */
     enum
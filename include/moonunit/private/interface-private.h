@@ -38,7 +38,10 @@ typedef enum MuInterfaceMeta
     MU_META_EXPECT,
     MU_META_TIMEOUT,
     MU_META_ITERATIONS,
-    MU_META_LOG_LEVEL
+    MU_META_LOG_LEVEL,
+    MU_META_WARMUP,
+    MU_META_BYTES_PROCESSED,
+    MU_META_ITEMS_PROCESSED
 } MuInterfaceMeta;
 
 typedef struct MuInterfaceToken
@@ -60,6 +60,7 @@ typedef void* array;
 array* array_new(void);
 size_t array_size(array* a);
 array* array_append(array* a, void* e);
+array* array_remove(array* a, void* e);
 void array_free(array* a);
 array* array_dup(array* a);
 array* array_from_generic(void** g);
@@ -31,6 +31,10 @@
 #include <moonunit/internal/boilerplate.h>
 #include <moonunit/type.h>
 
+#ifndef __cplusplus
+#include <stdbool.h>
+#endif
+
 /**
  * @file test.h
  * @brief Test-related types, enums, and structures
@@ -105,6 +109,24 @@ typedef struct MuBacktrace
     void* reserved2;
 } MuBacktrace;
 
+typedef struct MuBenchmark
+{
+    /** Number of warmup iterations run before measurement began */
+    unsigned int warmup;
+    /** Whether the timings leveled off during warmup */
+    bool steady;
+    /** Number of measured iterations */
+    unsigned int iterations;
+    /** Mean time of the test stage in seconds */
+    double mean;
+    /** Shortest time of the test stage in seconds */
+    double min;
+    /** Longest time of the test stage in seconds */
+    double max;
+    /** Standard deviation of the test stage time in seconds */
+    double stddev;
+} MuBenchmark;
+
 typedef struct MuTestResult
 {
     /** Status of the test (pass/fail) */
@@ -121,6 +143,18 @@ typedef struct MuTestResult
     unsigned int line;
     /** Backtrace, if available */
     MuBacktrace* backtrace;
+    /** Time spent in the test stage in seconds, or 0 if unknown */
+    double time;
+    /** Timing statistics, if the test was benchmarked */
+    MuBenchmark* benchmark;
+    /** Bytes processed by one run of the test stage, or 0 if not reported */
+    unsigned long long bytes_processed;
+    /** Items processed by one run of the test stage, or 0 if not reported */
+    unsigned long long items_processed;
+    /** Bytes processed per second of test stage time, or 0 if unknown */
+    double bytes_per_second;
+    /** Items processed per second of test stage time, or 0 if unknown */
+    double items_per_second;
     /* Reserved */
     void* reserved1;
     void* reserved2;
@@ -144,6 +178,19 @@ typedef enum
     MU_LEVEL_TRACE
 } MuLogLevel;
 
+/**
+ * Indicates what a log event carries
+ */
+typedef enum
+{
+    /** Message logged by the test */
+    MU_EVENT_MESSAGE,
+    /** Text the test wrote to standard output */
+    MU_EVENT_STDOUT,
+    /** Text the test wrote to standard error */
+    MU_EVENT_STDERR
+} MuLogEventKind;
+
 #ifndef DOXYGEN
 
 typedef struct MuLogEvent
@@ -156,8 +203,10 @@ typedef struct MuLogEvent
     unsigned int line;
     /** Severity of event */
     MuLogLevel level;
-    /** Logged message */
+    /** Logged message, or one line of captured output */
     const char* message;
+    /** Whether the event is a message or captured output */
+    MuLogEventKind kind;
     /* Reserved */
     void* reserved1;
     void* reserved2;
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UIPC_HANDLE_H__
+#define __UIPC_HANDLE_H__
+
+#include <uipc/ipc.h>
+#include <uipc/wire.h>
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+struct __uipc_handle
+{
+    bool readable, writeable;
+	int socket;
+    /* Optional shared-memory ring, not owned by the handle */
+    uipc_ring* ring;
+    uipc_ring_role role;
+    /* Process which attached; only it may write to the ring */
+    pid_t owner;
+    /* Holds the last packet received */
+    uipc_packet_buffer buffer;
+    /* Partial read state while registered with a poller */
+    uipc_async_context context;
+    /* Packets the ring said were sent on the socket instead */
+    unsigned int redirects;
+    /* Message whose streamed strings are still arriving */
+    uipc_message* pending;
+    unsigned int pending_stream;
+    /* How much of each streamed string to keep, and where the rest goes */
+    unsigned long stream_limit;
+    uipc_overflow overflow;
+};
+
+/* Turn a received packet into a message, or UIPC_INCOMPLETE
+   if the packet was part of a message still being streamed */
+uipc_status uipc_recv_packet(uipc_handle* handle, uipc_packet* packet, uipc_message** message);
+/* Read from the socket, resuming from context */
+uipc_status uipc_recv_async(uipc_handle* handle, uipc_async_context* context, uipc_message** message);
+
+#endif
@@ -40,13 +40,71 @@ typedef struct __uipc_handle uipc_handle;
 struct __uipc_message;
 typedef struct __uipc_message uipc_message;
 
+struct __uipc_ring;
+typedef struct __uipc_ring uipc_ring;
+
+struct __uipc_poller;
+typedef struct __uipc_poller uipc_poller;
+
+typedef enum
+{
+    UIPC_RING_READER,
+    UIPC_RING_WRITER
+} uipc_ring_role;
+
 typedef unsigned int uipc_message_type;
 
+/* What happens to the part of a streamed string past the limit */
+typedef enum
+{
+    UIPC_OVERFLOW_TRUNCATE,
+    UIPC_OVERFLOW_SPILL
+} uipc_overflow;
+
+/* Process-wide transfer counters, used to measure harness overhead */
+typedef struct uipc_statistics
+{
+    unsigned long messages_sent;
+    unsigned long messages_received;
+    unsigned long long bytes_sent;
+    unsigned long long bytes_received;
+} uipc_statistics;
+
 uipc_handle* uipc_attach(int socket);
+uipc_handle* uipc_attach_ring(int socket, uipc_ring* ring, uipc_ring_role role);
+/* A received message's payload is only valid until the next uipc_recv on the handle */
 uipc_status uipc_recv(uipc_handle* handle, uipc_message** message, uipc_time* abs);
 uipc_status uipc_send(uipc_handle* handle, uipc_message* message, uipc_time* abs);
+/* Keep at most limit bytes of each long string a handle receives.  The
+   rest is dropped or spilled to a temporary file, and a note saying
+   which is appended to the string.  Long strings are streamed in
+   chunks, so memory use stays bounded by the limit. */
+void uipc_set_stream_limit(uipc_handle* handle, unsigned long limit, uipc_overflow overflow);
 uipc_status uipc_detach(uipc_handle* handle);
 uipc_status uipc_close(uipc_handle* handle);
+void uipc_get_statistics(uipc_statistics* stats);
+
+/* Shared-memory ring for one-way traffic between a process and the
+   children it forks.  Create it before forking, reset it before each
+   child, and attach each side with uipc_attach_ring.  The socket is
+   still needed to detect when the other side goes away. */
+uipc_ring* uipc_ring_new(size_t size);
+void uipc_ring_reset(uipc_ring* ring);
+void uipc_ring_free(uipc_ring* ring);
+
+/* Receives from many handles at once.  Sockets are made non-blocking
+   while registered, and their handles must only be received from
+   through the poller.  A handle that reports UIPC_EOF should be removed.
+   A plain descriptor is reported readable by UIPC_SUCCESS with a NULL
+   handle and message; the caller reads it. */
+uipc_poller* uipc_poller_new(void);
+uipc_status uipc_poller_add(uipc_poller* poller, uipc_handle* handle, void* data);
+uipc_status uipc_poller_add_fd(uipc_poller* poller, int fd, void* data);
+uipc_status uipc_poller_remove(uipc_poller* poller, uipc_handle* handle);
+uipc_status uipc_poller_remove_fd(uipc_poller* poller, int fd);
+uipc_status uipc_poller_recv(uipc_poller* poller, uipc_handle** handle, void** data,
+                             uipc_message** message, uipc_time* abs);
+void uipc_poller_free(uipc_poller* poller);
 
 uipc_message* uipc_msg_new(uipc_message_type type);
 void uipc_msg_free(uipc_message* message);
@@ -54,5 +112,7 @@ uipc_message_type uipc_msg_get_type(uipc_message* message);
 void* uipc_msg_get_payload(uipc_message* message, uipc_typeinfo* info);
 void uipc_msg_set_payload(uipc_message* message, const void* payload, uipc_typeinfo* info);
 void uipc_msg_free_payload(void* payload, uipc_typeinfo* info);
+void uipc_msg_set_data(uipc_message* message, const void* data, unsigned long length);
+const void* uipc_msg_get_data(uipc_message* message, unsigned long* length);
 
 #endif
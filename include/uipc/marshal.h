@@ -28,6 +28,9 @@
 #ifndef __UIPC_MARSHAL_H__
 #define __UIPC_MARSHAL_H__
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 typedef enum
 {
     UIPC_KIND_NONE,
@@ -35,10 +38,14 @@ typedef enum
     UIPC_KIND_POINTER
 } uipc_kind;
 
+struct __uipc_codec;
+
 typedef struct __uipc_typeinfo
 {
     unsigned long size;
     const char* name;
+    /* Compiled from members on first use */
+    struct __uipc_codec* codec;
     struct
     {
         unsigned long offset;
@@ -63,8 +70,68 @@ typedef struct __uipc_typeinfo
 
 #define UIPC_END { .kind = UIPC_KIND_NONE }
 
+unsigned long uipc_payload_size(const void* payload, uipc_typeinfo* type);
 unsigned long uipc_marshal_payload(void* buffer, unsigned long size, const void* payload, uipc_typeinfo* type);
+
+#define UIPC_VECTOR_INLINE_IOV 8
+#define UIPC_VECTOR_INLINE_SCRATCH 512
+#define UIPC_VECTOR_INLINE_STREAMS 2
+
+/* Strings longer than this are left out of a vector to be streamed */
+#define UIPC_STREAM_THRESHOLD (64 * 1024)
+/* Length prefix of a string that was streamed */
+#define UIPC_STRING_STREAMED (0xFFFFFFFFU)
+
+/* A string streamed separately from the payload it belongs to */
+typedef struct uipc_stream
+{
+    /* The start of the string, up to the receiver's limit */
+    char* data;
+    unsigned long kept;
+    /* Bytes received so far and the string's full length */
+    unsigned long received;
+    unsigned long total;
+    /* Where bytes past the limit went, if anywhere */
+    int spill_fd;
+    char* spill_path;
+} uipc_stream;
+
+/*
+ * A marshaled payload as a list of buffers to be sent with
+ * sendmsg or similar.  Strings are referenced where they are,
+ * so the payload must not change until the vector is sent.
+ */
+typedef struct uipc_marshal_vector
+{
+    struct iovec* iov;
+    int count;
+    /* Leading entries left for the caller */
+    int reserved;
+    /* Total length of the payload */
+    unsigned long length;
+    /* Structure copies and string lengths */
+    char* scratch;
+    unsigned long scratch_used;
+    /* Long strings to be streamed after the payload, in order */
+    struct iovec* streams;
+    int stream_count;
+    /* Storage for small payloads, which need no allocation */
+    struct iovec inline_iov[UIPC_VECTOR_INLINE_IOV];
+    char inline_scratch[UIPC_VECTOR_INLINE_SCRATCH];
+    struct iovec inline_streams[UIPC_VECTOR_INLINE_STREAMS];
+} uipc_marshal_vector;
+
+/* Marshal into a vector, leaving the first reserve entries for the caller.
+   Strings longer than UIPC_STREAM_THRESHOLD are listed in streams instead */
+unsigned long uipc_marshal_payload_vector(uipc_marshal_vector* vector, int reserve, const void* payload, uipc_typeinfo* type);
+void uipc_marshal_vector_destroy(uipc_marshal_vector* vector);
+/* Unmarshaled and copied objects occupy a single block released by free() */
 unsigned long uipc_unmarshal_payload(void** out, const void* payload, uipc_typeinfo* type);
+/* Unmarshal a payload whose long strings were streamed */
+unsigned long uipc_unmarshal_payload_streams(void** out, const void* payload, uipc_typeinfo* type,
+                                             uipc_stream* streams, unsigned int count);
+void* uipc_copy_object(const void* object, uipc_typeinfo* type);
+/* Frees an object whose members were allocated individually */
 void uipc_free_object(void* object, uipc_typeinfo* type);
 
 #endif
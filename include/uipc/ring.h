@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __UIPC_RING_H__
+#define __UIPC_RING_H__
+
+#include <uipc/status.h>
+#include <uipc/ipc.h>
+#include <uipc/wire.h>
+#include <uipc/time.h>
+
+/* Whether a packet of the given total size can be placed in the ring */
+int uipc_ring_fits(uipc_ring* ring, size_t length);
+/* Copy a packet gathered from iov into the ring, waiting for space if needed */
+uipc_status uipc_ring_write(uipc_ring* ring, int socket, struct iovec* iov, int count, uipc_time* abs);
+/* Take the next packet out of the ring into buffer, or UIPC_RETRY if it is empty */
+uipc_status uipc_ring_read(uipc_ring* ring, uipc_packet_buffer* buffer, uipc_packet** packet);
+/* Wait until the ring has data (UIPC_SUCCESS) or the socket
+   becomes readable while the ring is empty (UIPC_EOF) */
+uipc_status uipc_ring_wait(uipc_ring* ring, int socket, uipc_time* abs);
+
+/* For readers that wait on many rings at once */
+int uipc_ring_empty(uipc_ring* ring);
+/* Descriptor that becomes readable when the writer wakes the reader */
+int uipc_ring_wait_fd(uipc_ring* ring);
+/* Announce that the reader is going to sleep; 0 if data arrived meanwhile */
+int uipc_ring_prepare_wait(uipc_ring* ring);
+/* Undo uipc_ring_prepare_wait once the reader is awake */
+void uipc_ring_finish_wait(uipc_ring* ring);
+
+#endif
@@ -41,7 +41,9 @@ typedef enum
     // Out of memory
     UIPC_NOMEM,
     // Timed out
-    UIPC_TIMEOUT
+    UIPC_TIMEOUT,
+    // More packets are needed to complete a message
+    UIPC_INCOMPLETE
 } uipc_status;
 
 #endif
@@ -38,5 +38,7 @@ void uipc_time_current(uipc_time* time);
 void uipc_time_current_offset(uipc_time* time, long s, long us);
 int uipc_time_is_past(uipc_time* time);
 void uipc_time_difference(uipc_time* from, uipc_time* to, uipc_time* res);
+/* Milliseconds until abs, rounded up, for poll(); -1 if abs is NULL */
+int uipc_time_timeout(uipc_time* abs);
 
 #endif
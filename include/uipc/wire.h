@@ -32,12 +32,20 @@
 #include <uipc/ipc.h>
 #include <uipc/time.h>
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 typedef struct uipc_packet_header
 {
 	enum
 	{
-		PACKET_MESSAGE, PACKET_ACK
+		PACKET_MESSAGE, PACKET_ACK,
+		/* In a ring, marks that the next packet was sent on the socket */
+		PACKET_REDIRECT,
+		/* Part of a long string streamed after its message */
+		PACKET_CHUNK
 	} type;
+	/* Length of the packet following the header */
 	unsigned long length;
 } uipc_packet_header;
 
@@ -45,15 +53,28 @@ typedef struct uipc_packet_message
 {
 	uipc_message_type type;
 	unsigned long length;
+	/* Number of strings streamed in chunks after this packet */
+	unsigned long streams;
     char payload[];
 } uipc_packet_message;
 
+typedef struct uipc_packet_chunk
+{
+	/* Length of the whole string the chunk belongs to */
+	unsigned long total;
+	char data[];
+} uipc_packet_chunk;
+
+/* Largest amount of string data carried by one chunk */
+#define UIPC_CHUNK_SIZE (64 * 1024)
+
 typedef struct uipc_packet
 {
 	uipc_packet_header header;
 	union
 	{
 		uipc_packet_message message;
+		uipc_packet_chunk chunk;
 	} u;
 } uipc_packet;
 
@@ -61,11 +82,22 @@ typedef struct __uipc_async_context
 {
     size_t transferred;
     uipc_packet_header header;
-    uipc_packet* packet;
 } uipc_async_context;
 
-uipc_status uipc_packet_send(int socket, uipc_async_context* context, uipc_packet* packet);
-uipc_status uipc_packet_recv(int socket, uipc_async_context* context, uipc_packet** packet);
+/* Reusable storage for received packets */
+typedef struct uipc_packet_buffer
+{
+    uipc_packet* packet;
+    size_t capacity;
+} uipc_packet_buffer;
+
+/* Make room for a packet with the given header and copy the header in */
+uipc_packet* uipc_packet_buffer_prepare(uipc_packet_buffer* buffer, uipc_packet_header* header);
+
+/* Send a packet gathered from iov, which starts with its header */
+uipc_status uipc_packet_sendv(int socket, uipc_async_context* context, struct iovec* iov, int count);
+/* Receive a packet into buffer; it remains valid until the buffer is reused */
+uipc_status uipc_packet_recv(int socket, uipc_async_context* context, uipc_packet_buffer* buffer, uipc_packet** packet);
 uipc_status uipc_packet_available(int socket, uipc_time* abs);
 uipc_status uipc_packet_sendable(int socket, uipc_time* abs);
 
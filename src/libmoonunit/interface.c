@@ -62,6 +62,27 @@ mu_interface_iterations(unsigned int count)
     token->meta(token, MU_META_ITERATIONS, count);
 }
 
+void
+mu_interface_warmup(int count)
+{
+    MuInterfaceToken* token = mu_interface_current_token();
+    token->meta(token, MU_META_WARMUP, count);
+}
+
+void
+mu_interface_bytes_processed(unsigned long long count)
+{
+    MuInterfaceToken* token = mu_interface_current_token();
+    token->meta(token, MU_META_BYTES_PROCESSED, count);
+}
+
+void
+mu_interface_items_processed(unsigned long long count)
+{
+    MuInterfaceToken* token = mu_interface_current_token();
+    token->meta(token, MU_META_ITEMS_PROCESSED, count);
+}
+
 void
 mu_interface_event(const char* file, unsigned int line, MuLogLevel level, const char* fmt, ...)
 {
@@ -71,6 +92,7 @@ mu_interface_event(const char* file, unsigned int line, MuLogLevel level, const
 
     va_start(ap, fmt);
 
+    event.kind = MU_EVENT_MESSAGE;
     event.level = level;
     event.file = file;
     event.line = line;
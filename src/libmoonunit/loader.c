@@ -40,6 +40,16 @@ mu_loader_open(struct MuLoader* loader, const char* path, MuError** err)
     return loader->open(loader, path, err);
 }
 
+/* Loaders that cannot probe fall back to a full open */
+MuLibrary*
+mu_loader_probe(struct MuLoader* loader, const char* path, MuError** err)
+{
+    if (loader->probe)
+        return loader->probe(loader, path, err);
+    else
+        return loader->open(loader, path, err);
+}
+
 void
 mu_loader_set_option(MuLoader* loader, const char *name, ...)
 {
@@ -39,9 +39,13 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <pthread.h>
 
+/* Filled in once and only read afterwards, so lookups
+   are safe from any thread */
 static array* plugin_list;
 static array* handle_list;
+static pthread_once_t plugin_once = PTHREAD_ONCE_INIT;
 
 static MuPlugin*
 load_plugin(const char* path)
@@ -49,6 +53,7 @@ load_plugin(const char* path)
     void* handle = mu_dlopen(path, RTLD_LAZY);
    
     MuPlugin* (*load)(void);
+    MuPlugin* plugin;
 
     if (!handle)
     {
@@ -59,10 +64,29 @@ load_plugin(const char* path)
 
     load = dlsym(handle, "__mu_p_init");
 
-    if (!load)
+    if (!load || !(plugin = load()))
+        return NULL;
+
+    /* Structures shared with older plugins have a different layout */
+    if (plugin->version != MU_PLUGIN_API_2)
         return NULL;
 
-    return load();
+    return plugin;
+}
+
+static void
+register_plugin(MuPlugin* plugin)
+{
+    /* Bind loaders to their plugin now rather than on each lookup */
+    if (plugin->type == MU_PLUGIN_LOADER && plugin->loader)
+    {
+        MuLoader* loader = plugin->loader();
+
+        if (loader)
+            loader->plugin = plugin;
+    }
+
+    plugin_list = array_append(plugin_list, plugin);
 }
 
 static void
@@ -86,7 +110,7 @@ load_plugins_dir(const char* path)
                 free(fullpath);
                 
                 if (plugin)
-                    plugin_list = array_append(plugin_list, plugin);
+                    register_plugin(plugin);
             }
         }
 	closedir(dir);   
@@ -139,13 +163,21 @@ load_plugins(void)
             }
             
             if ((plugin = load_plugin(extra)))
-                plugin_list = array_append(plugin_list, plugin);
+                register_plugin(plugin);
         }
 
         free(extras);
     }
 }
 
+static bool
+plugins_loaded(void)
+{
+    pthread_once(&plugin_once, load_plugins);
+
+    return plugin_list != NULL;
+}
+
 static MuPlugin*
 get_plugin(const char* name)
 {
@@ -153,12 +185,8 @@ get_plugin(const char* name)
     MuPlugin* plugin;
     size_t count;
 
-    if (plugin_list == NULL)
-    {
-        load_plugins();
-        if (plugin_list == NULL)
-            return NULL;
-    }
+    if (!plugins_loaded())
+        return NULL;
 
     count = array_size(plugin_list);
 
@@ -192,11 +220,6 @@ mu_plugin_get_loader_with_name(const char *name)
 
     loader = plugin->loader();
 
-    if (!loader)
-        return NULL;
-
-    loader->plugin = plugin;
-
     return loader;
 }
 
@@ -205,12 +228,8 @@ mu_plugin_get_loader_for_file(const char* file)
 {
     unsigned int index;
 
-    if (plugin_list == NULL)
-    {
-        load_plugins();
-        if (plugin_list == NULL)
-            return NULL;
-    }
+    if (!plugins_loaded())
+        return NULL;
 
     for (index = 0; index < array_size(plugin_list); index++)
     {
@@ -255,12 +274,8 @@ mu_plugin_create_logger(const char* name)
 MuPlugin**
 mu_plugin_list(void)
 {
-    if (plugin_list == NULL)
-    {
-        load_plugins();
-        if (plugin_list == NULL)
-            return NULL;
-    }
+    if (!plugins_loaded())
+        return NULL;
 
     return (MuPlugin**) plugin_list;
 }
@@ -242,6 +242,29 @@ array_append(array* a, void* e)
     return hide(_a);
 }
 
+array*
+array_remove(array* a, void* e)
+{
+    if (a)
+    {
+        _array* _a = reveal(a);
+        unsigned int i;
+
+        for (i = 0; i < _a->size; i++)
+        {
+            if (_a->elements[i] == e)
+            {
+                memmove(&_a->elements[i], &_a->elements[i+1],
+                        sizeof(void*) * (_a->size - i));
+                _a->size--;
+                break;
+            }
+        }
+    }
+
+    return a;
+}
+
 void
 array_free(array* a)
 {
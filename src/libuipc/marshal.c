@@ -31,188 +31,654 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 
-#define REDUCE(lvalue, delta) (reduce(&lvalue, delta))
+/* Lengths of the first strings measured are remembered so
+   they need not be recomputed while encoding */
+#define LENGTH_CACHE_SIZE (32)
 
-static inline void
-reduce(unsigned long* size, unsigned long delta)
+typedef struct
 {
-    if (*size > delta)
-        (*size) -= delta;
-    else
-        *size = 0;
+    unsigned long offset;
+    uipc_typeinfo* type;
+} codec_pointer;
+
+/*
+ * A typeinfo compiled down to the members that need work beyond
+ * copying the structure itself.  Strings are encoded after the
+ * structure as a 32-bit length followed by the characters;
+ * pointees follow the strings, each encoded recursively.
+ */
+typedef struct __uipc_codec
+{
+    unsigned int string_count;
+    unsigned long* strings;
+    unsigned int pointer_count;
+    codec_pointer* pointers;
+} uipc_codec;
+
+typedef struct
+{
+    unsigned long lengths[LENGTH_CACHE_SIZE];
+    unsigned int measured;
+    unsigned int encoded;
+    /* Scratch space, buffers and streams needed for a vector */
+    unsigned long scratch;
+    unsigned int segments;
+    unsigned int streams;
+} marshal_state;
+
+static uipc_codec*
+compile(uipc_typeinfo* type)
+{
+    uipc_codec* codec = type->codec;
+    int i;
+
+    if (codec)
+        return codec;
+
+    codec = xmalloc(sizeof(*codec));
+    codec->string_count = 0;
+    codec->pointer_count = 0;
+
+    for (i = 0; type->members[i].kind != UIPC_KIND_NONE; i++)
+    {
+        switch (type->members[i].kind)
+        {
+        case UIPC_KIND_STRING:
+            codec->string_count++;
+            break;
+        case UIPC_KIND_POINTER:
+            codec->pointer_count++;
+            break;
+        default:
+            ;
+        }
+    }
+
+    codec->strings = xmalloc(sizeof(*codec->strings) * codec->string_count);
+    codec->pointers = xmalloc(sizeof(*codec->pointers) * codec->pointer_count);
+    codec->string_count = 0;
+    codec->pointer_count = 0;
+
+    for (i = 0; type->members[i].kind != UIPC_KIND_NONE; i++)
+    {
+        switch (type->members[i].kind)
+        {
+        case UIPC_KIND_STRING:
+            codec->strings[codec->string_count++] = type->members[i].offset;
+            break;
+        case UIPC_KIND_POINTER:
+            codec->pointers[codec->pointer_count].offset = type->members[i].offset;
+            codec->pointers[codec->pointer_count].type = type->members[i].pointee_type;
+            codec->pointer_count++;
+            break;
+        default:
+            ;
+        }
+    }
+
+    /* Another thread may have compiled the same type meanwhile */
+    if (!__sync_bool_compare_and_swap(&type->codec, NULL, codec))
+    {
+        free(codec->strings);
+        free(codec->pointers);
+        free(codec);
+        codec = type->codec;
+    }
+
+    return codec;
+}
+
+static inline const void*
+member(const void* object, unsigned long offset)
+{
+    return *(const void**) (object + offset);
 }
 
 static unsigned long
-marshal_string(void* buffer, unsigned long size, const void* payload)
+measure(marshal_state* state, const void* payload, uipc_typeinfo* type)
 {
-    if (payload)
+    uipc_codec* codec = compile(type);
+    unsigned long size = type->size;
+    unsigned long length;
+    const void* value;
+    unsigned int i;
+
+    state->scratch += type->size;
+    state->segments++;
+
+    for (i = 0; i < codec->string_count; i++)
     {
-        unsigned long length = strlen((const char*) payload);
-        
-        if (size >= length + 1)
-            memcpy(buffer, payload, length+1);
-        return (length + 1);
+        if ((value = member(payload, codec->strings[i])))
+        {
+            length = strlen((const char*) value);
+            if (state->measured < LENGTH_CACHE_SIZE)
+                state->lengths[state->measured] = length;
+            state->measured++;
+            state->scratch += sizeof(uint32_t);
+            state->segments += 2;
+            if (length > UIPC_STREAM_THRESHOLD)
+                state->streams++;
+            size += sizeof(uint32_t) + length;
+        }
     }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        if ((value = member(payload, codec->pointers[i].offset)))
+            size += measure(state, value, codec->pointers[i].type);
+    }
+
+    return size;
+}
+
+static inline unsigned long
+next_length(marshal_state* state, const void* value)
+{
+    unsigned int index = state->encoded++;
+
+    if (index < LENGTH_CACHE_SIZE)
+        return state->lengths[index];
     else
+        return strlen((const char*) value);
+}
+
+static void*
+encode(marshal_state* state, void* buffer, const void* payload, uipc_typeinfo* type)
+{
+    uipc_codec* codec = type->codec;
+    void* base = buffer;
+    unsigned long length;
+    uint32_t prefix;
+    const void* value;
+    unsigned int i;
+
+    memcpy(buffer, payload, type->size);
+    buffer += type->size;
+
+    /* Pointer slots in the copied structure only record presence */
+    for (i = 0; i < codec->string_count; i++)
+    {
+        if ((value = member(payload, codec->strings[i])))
+        {
+            length = next_length(state, value);
+
+            prefix = (uint32_t) length;
+            memcpy(buffer, &prefix, sizeof(prefix));
+            memcpy(buffer + sizeof(prefix), value, length);
+            memset(base + codec->strings[i], 0xFF, sizeof(char*));
+            buffer += sizeof(prefix) + length;
+        }
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        if ((value = member(payload, codec->pointers[i].offset)))
+        {
+            buffer = encode(state, buffer, value, codec->pointers[i].type);
+            memset(base + codec->pointers[i].offset, 0xFF, sizeof(void*));
+        }
+    }
+
+    return buffer;
+}
+
+unsigned long
+uipc_payload_size(const void* payload, uipc_typeinfo* type)
+{
+    marshal_state state = {.measured = 0};
+
+    if (payload == NULL)
     {
         return 0;
     }
+
+    return measure(&state, payload, type);
 }
 
 unsigned long
 uipc_marshal_payload(void* buffer, unsigned long size, const void* payload, uipc_typeinfo* type)
 {
-	int i;
-    unsigned long delta;
-    unsigned long written = 0;
-    void* base = NULL;
+    marshal_state state = {.measured = 0, .encoded = 0};
+    unsigned long length;
 
     if (payload == NULL)
     {
         return 0;
     }
 
-    if (size >= type->size)
+    length = measure(&state, payload, type);
+
+    if (length <= size)
     {
-        base = buffer;
-        memcpy(buffer, payload, type->size);
+        encode(&state, buffer, payload, type);
     }
 
-    buffer += type->size;
-    written += type->size;
+    return length;
+}
 
-    REDUCE(size, type->size);
+static void
+vector_push(uipc_marshal_vector* vector, const void* data, unsigned long length)
+{
+    struct iovec* last = &vector->iov[vector->count - 1];
 
-    for (i = 0; type->members[i].kind != UIPC_KIND_NONE; i++)
+    if (!length)
+        return;
+
+    /* Scratch pieces are usually adjacent */
+    if (vector->count > vector->reserved &&
+        (const char*) last->iov_base + last->iov_len == data)
     {
-        switch (type->members[i].kind)
+        last->iov_len += length;
+    }
+    else
+    {
+        vector->iov[vector->count].iov_base = (void*) data;
+        vector->iov[vector->count].iov_len = length;
+        vector->count++;
+    }
+
+    vector->length += length;
+}
+
+static void*
+vector_scratch(uipc_marshal_vector* vector, unsigned long length)
+{
+    void* mem = vector->scratch + vector->scratch_used;
+
+    vector->scratch_used += length;
+
+    return mem;
+}
+
+static void
+encode_vector(marshal_state* state, uipc_marshal_vector* vector, const void* payload, uipc_typeinfo* type)
+{
+    uipc_codec* codec = type->codec;
+    void* base = vector_scratch(vector, type->size);
+    unsigned long length;
+    uint32_t* prefix;
+    const void* value;
+    unsigned int i;
+
+    memcpy(base, payload, type->size);
+    vector_push(vector, base, type->size);
+
+    for (i = 0; i < codec->string_count; i++)
+    {
+        if ((value = member(payload, codec->strings[i])))
         {
-        case UIPC_KIND_STRING:
-            delta = marshal_string(buffer, size, *(void **)(payload + type->members[i].offset));
-            if (base)
-                memset(base + type->members[i].offset, delta ? 0xFF : 0x0, sizeof(char*));
-            buffer += delta;
-            written += delta;
-            REDUCE(size, delta);
-            break;
-        case UIPC_KIND_POINTER:
-            delta = uipc_marshal_payload(buffer, size, 
-                                         *(void **)(payload + type->members[i].offset), 
-                                         type->members[i].pointee_type);
-            if (base)
-                memset(base + type->members[i].offset, delta ? 0xFF : 0x0, sizeof(void*));
-            buffer += delta;
-            written += delta;
-            REDUCE(size, delta);
-            break;
-        default:
-            ;
+            length = next_length(state, value);
+            prefix = vector_scratch(vector, sizeof(*prefix));
+            vector_push(vector, prefix, sizeof(*prefix));
+
+            if (length > UIPC_STREAM_THRESHOLD)
+            {
+                *prefix = UIPC_STRING_STREAMED;
+                vector->streams[vector->stream_count].iov_base = (void*) value;
+                vector->streams[vector->stream_count].iov_len = length;
+                vector->stream_count++;
+            }
+            else
+            {
+                *prefix = (uint32_t) length;
+                vector_push(vector, value, length);
+            }
+
+            memset(base + codec->strings[i], 0xFF, sizeof(char*));
+        }
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        if ((value = member(payload, codec->pointers[i].offset)))
+        {
+            encode_vector(state, vector, value, codec->pointers[i].type);
+            memset(base + codec->pointers[i].offset, 0xFF, sizeof(void*));
         }
     }
-    
-    return written;
 }
 
-static
 unsigned long
-unmarshal_string(void** out, const void* payload)
+uipc_marshal_payload_vector(uipc_marshal_vector* vector, int reserve, const void* payload, uipc_typeinfo* type)
 {
+    marshal_state state = {.measured = 0, .encoded = 0, .scratch = 0, .segments = 0, .streams = 0};
+
     if (payload)
     {
-        *out = strdup((const char*) payload);    
-        return strlen((const char*) payload) + 1;
+        measure(&state, payload, type);
     }
+
+    if (reserve + state.segments <= UIPC_VECTOR_INLINE_IOV)
+        vector->iov = vector->inline_iov;
+    else
+        vector->iov = xmalloc(sizeof(*vector->iov) * (reserve + state.segments));
+
+    if (state.scratch <= UIPC_VECTOR_INLINE_SCRATCH)
+        vector->scratch = vector->inline_scratch;
     else
+        vector->scratch = xmalloc(state.scratch);
+
+    if (state.streams <= UIPC_VECTOR_INLINE_STREAMS)
+        vector->streams = vector->inline_streams;
+    else
+        vector->streams = xmalloc(sizeof(*vector->streams) * state.streams);
+
+    vector->scratch_used = 0;
+    vector->length = 0;
+    vector->count = vector->reserved = reserve;
+    vector->stream_count = 0;
+
+    if (payload)
     {
-        *out = NULL;
-        return 0;
+        encode_vector(&state, vector, payload, type);
     }
-    
+
+    return vector->length;
 }
 
-unsigned long
-uipc_unmarshal_payload(void** out, const void* payload, uipc_typeinfo* type)
+void
+uipc_marshal_vector_destroy(uipc_marshal_vector* vector)
 {
-    int i;
-    void* object;
-    unsigned long delta;
-    unsigned long read = 0;
-    void* member;
-    const void* base = payload;
+    if (vector->iov != vector->inline_iov)
+        free(vector->iov);
+    if (vector->scratch != vector->inline_scratch)
+        free(vector->scratch);
+    if (vector->streams != vector->inline_streams)
+        free(vector->streams);
+}
 
-    object = xmalloc(type->size);
-    memcpy(object, payload, type->size);
+/*
+ * Unmarshaled objects are laid out in a single block: each structure
+ * at the next aligned offset, followed by its strings and then its
+ * pointees.  Sizing the block walks the graph in the same order.
+ */
+#define BLOCK_ALIGN (2 * sizeof(void*))
+
+static inline unsigned long
+block_align(unsigned long offset)
+{
+    return (offset + BLOCK_ALIGN - 1) & ~(BLOCK_ALIGN - 1);
+}
+
+static inline void*
+block_take(char** cursor, unsigned long size, int aligned)
+{
+    void* mem;
+
+    if (aligned)
+        *cursor = (char*) block_align((unsigned long) *cursor);
+
+    mem = *cursor;
+    *cursor += size;
+
+    return mem;
+}
+
+/* Streams to be substituted for streamed strings, in order */
+typedef struct
+{
+    uipc_stream* streams;
+    unsigned int count;
+    unsigned int next;
+} stream_cursor;
+
+static uipc_stream*
+stream_next(stream_cursor* cursor)
+{
+    if (cursor->next < cursor->count)
+        return &cursor->streams[cursor->next++];
+    else
+        return NULL;
+}
+
+/* Describe what happened to the part of a stream that was not kept */
+static unsigned long
+stream_note(uipc_stream* stream, char* note, size_t size)
+{
+    unsigned long rest = stream->total - stream->kept;
+    int length;
+
+    if (!rest)
+        length = 0;
+    else if (stream->spill_path)
+        length = snprintf(note, size, "\n[%lu more bytes in %s]", rest, stream->spill_path);
+    else
+        length = snprintf(note, size, "\n[%lu more bytes truncated]", rest);
+
+    if (length < 0)
+        length = 0;
+    else if ((size_t) length >= size)
+        length = size - 1;
 
+    note[length] = '\0';
+
+    return length;
+}
+
+/* Size the block needed for an encoded payload */
+static const void*
+decoded_size(stream_cursor* streams, unsigned long* size, const void* payload, uipc_typeinfo* type)
+{
+    uipc_codec* codec = compile(type);
+    const void* base = payload;
+    uipc_stream* stream;
+    char note[1024];
+    void* value;
+    uint32_t length;
+    unsigned int i;
+
+    *size = block_align(*size) + type->size;
     payload += type->size;
-    read += type->size;
 
-    for (i = 0; type->members[i].kind != UIPC_KIND_NONE; i++)
+    for (i = 0; i < codec->string_count; i++)
     {
-        switch (type->members[i].kind)
+        memcpy(&value, base + codec->strings[i], sizeof(value));
+        if (value)
         {
-        case UIPC_KIND_STRING:
-            /* Structures in payload may be unaligned, so access with memcpy */
-            memcpy(&member, base + type->members[i].offset, sizeof(member));
-            if (member)
+            memcpy(&length, payload, sizeof(length));
+            payload += sizeof(length);
+
+            if (length != UIPC_STRING_STREAMED)
+            {
+                payload += length;
+                *size += length + 1;
+            }
+            else if ((stream = stream_next(streams)))
             {
-                delta = unmarshal_string(object + type->members[i].offset, payload);
-                payload += delta;
-                read += delta;
+                *size += stream->kept + stream_note(stream, note, sizeof(note)) + 1;
             }
             else
             {
-                *(void**) (object + type->members[i].offset) = NULL;
+                *size += 1;
             }
-            break;
-        case UIPC_KIND_POINTER:
-            memcpy(&member, base + type->members[i].offset, sizeof(member));
-            if (member)
+        }
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        memcpy(&value, base + codec->pointers[i].offset, sizeof(value));
+        if (value)
+            payload = decoded_size(streams, size, payload, codec->pointers[i].type);
+    }
+
+    return payload;
+}
+
+static const void*
+decode(stream_cursor* streams, char** cursor, void** out, const void* payload, uipc_typeinfo* type)
+{
+    uipc_codec* codec = type->codec;
+    const void* base = payload;
+    uipc_stream* stream;
+    char note[1024];
+    unsigned long note_length;
+    void* object;
+    void* value;
+    uint32_t length;
+    unsigned int i;
+
+    object = block_take(cursor, type->size, 1);
+    memcpy(object, payload, type->size);
+    payload += type->size;
+
+    /* Structures in payload may be unaligned, so access with memcpy */
+    for (i = 0; i < codec->string_count; i++)
+    {
+        memcpy(&value, base + codec->strings[i], sizeof(value));
+        if (value)
+        {
+            memcpy(&length, payload, sizeof(length));
+            payload += sizeof(length);
+
+            if (length != UIPC_STRING_STREAMED)
             {
-                delta = uipc_unmarshal_payload(object + type->members[i].offset, payload, 
-                                               type->members[i].pointee_type);
-                payload += delta;
-                read += delta;
+                value = block_take(cursor, length + 1, 0);
+                memcpy(value, payload, length);
+                ((char*) value)[length] = '\0';
+                payload += length;
+            }
+            else if ((stream = stream_next(streams)))
+            {
+                note_length = stream_note(stream, note, sizeof(note));
+                value = block_take(cursor, stream->kept + note_length + 1, 0);
+                memcpy(value, stream->data, stream->kept);
+                memcpy(value + stream->kept, note, note_length + 1);
             }
             else
             {
-                *(void**) (object + type->members[i].offset) = NULL;
+                value = block_take(cursor, 1, 0);
+                *(char*) value = '\0';
             }
-            break;
-        default:
-            ;
         }
+        *(void**) (object + codec->strings[i]) = value;
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        memcpy(&value, base + codec->pointers[i].offset, sizeof(value));
+        if (value)
+        {
+            payload = decode(streams, cursor, &value, payload, codec->pointers[i].type);
+        }
+        *(void**) (object + codec->pointers[i].offset) = value;
     }
-    
+
     *out = object;
 
-    return read;
+    return payload;
+}
+
+unsigned long
+uipc_unmarshal_payload_streams(void** out, const void* payload, uipc_typeinfo* type,
+                               uipc_stream* streams, unsigned int count)
+{
+    stream_cursor sizing = {streams, count, 0};
+    stream_cursor decoding = {streams, count, 0};
+    unsigned long size = 0;
+    const void* end = decoded_size(&sizing, &size, payload, type);
+    char* cursor = xmalloc(size);
+
+    decode(&decoding, &cursor, out, payload, type);
+
+    return end - payload;
+}
+
+unsigned long
+uipc_unmarshal_payload(void** out, const void* payload, uipc_typeinfo* type)
+{
+    return uipc_unmarshal_payload_streams(out, payload, type, NULL, 0);
+}
+
+/* Size the block needed for a copy of an object */
+static void
+object_size(unsigned long* size, const void* object, uipc_typeinfo* type)
+{
+    uipc_codec* codec = compile(type);
+    const void* value;
+    unsigned int i;
+
+    *size = block_align(*size) + type->size;
+
+    for (i = 0; i < codec->string_count; i++)
+    {
+        if ((value = member(object, codec->strings[i])))
+            *size += strlen((const char*) value) + 1;
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        if ((value = member(object, codec->pointers[i].offset)))
+            object_size(size, value, codec->pointers[i].type);
+    }
+}
+
+static void*
+copy(char** cursor, const void* object, uipc_typeinfo* type)
+{
+    uipc_codec* codec = type->codec;
+    void* result = block_take(cursor, type->size, 1);
+    const void* value;
+    unsigned long length;
+    unsigned int i;
+
+    memcpy(result, object, type->size);
+
+    for (i = 0; i < codec->string_count; i++)
+    {
+        if ((value = member(object, codec->strings[i])))
+        {
+            length = strlen((const char*) value) + 1;
+            value = memcpy(block_take(cursor, length, 0), value, length);
+        }
+        *(const void**) (result + codec->strings[i]) = value;
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        if ((value = member(object, codec->pointers[i].offset)))
+            value = copy(cursor, value, codec->pointers[i].type);
+        *(const void**) (result + codec->pointers[i].offset) = value;
+    }
+
+    return result;
+}
+
+void*
+uipc_copy_object(const void* object, uipc_typeinfo* type)
+{
+    unsigned long size = 0;
+    char* cursor;
+
+    if (!object)
+        return NULL;
+
+    object_size(&size, object, type);
+    cursor = xmalloc(size);
+
+    return copy(&cursor, object, type);
 }
 
 void
 uipc_free_object(void* object, uipc_typeinfo* type)
 {
-    int i;
-    void* member;
+    uipc_codec* codec;
+    unsigned int i;
 
     if (!object)
         return;
 
-    for (i = 0; type->members[i].kind != UIPC_KIND_NONE; i++)
+    codec = compile(type);
+
+    for (i = 0; i < codec->string_count; i++)
     {
-        switch (type->members[i].kind)
-        {
-        case UIPC_KIND_STRING:
-            member = *(void**) (object + type->members[i].offset);
-            free(member);
-            break;
-        case UIPC_KIND_POINTER:
-            member = *(void**) (object + type->members[i].offset);
-            uipc_free_object(member, type->members[i].pointee_type);
-            break;
-        default:
-            ;
-        }
+        free(*(void**) (object + codec->strings[i]));
+    }
+
+    for (i = 0; i < codec->pointer_count; i++)
+    {
+        uipc_free_object(*(void**) (object + codec->pointers[i].offset), codec->pointers[i].type);
     }
 
     free(object);
@@ -29,6 +29,8 @@
 #include <moonunit/private/util.h>
 #include <uipc/ipc.h>
 #include <uipc/wire.h>
+#include <uipc/ring.h>
+#include <uipc/handle.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -36,58 +38,48 @@
 #include <fcntl.h>
 #include <string.h>
 #include <stdbool.h>
-
-#define PAYLOAD_BUFFER_SIZE (1024)
+#include <errno.h>
 
 struct __uipc_message
 {
     uipc_message_type type;
     void* payload;
     uipc_typeinfo* payload_type;
+    /* Raw payload, used instead of a typed one if set */
+    const void* data;
+    unsigned long data_length;
+    /* Received packet, which belongs to the handle unless copied */
     uipc_packet* packet;
+    bool owns_packet;
+    /* Long strings received in chunks after the packet */
+    uipc_stream* streams;
+    unsigned int stream_count;
 };
 
-struct __uipc_handle
-{
-    bool readable, writeable;
-	int socket;
-};
 
+static uipc_statistics statistics = {0};
+
+/* Gather a message into iov, leaving the first entry for the packet head */
 static
-uipc_packet*
-packet_from_message(uipc_message* message)
+unsigned long
+message_vector(uipc_message* message, uipc_marshal_vector* vector)
 {
-    uipc_packet* packet = xmalloc(sizeof (uipc_packet_header) + 
-                                 sizeof (uipc_packet_message) +
-                                 PAYLOAD_BUFFER_SIZE);
-    unsigned long payload_length;
-
-    if (!packet)
-        return NULL;
-
-    packet->header.type = PACKET_MESSAGE;
-    packet->u.message.type = message->type;
-
-    payload_length = uipc_marshal_payload(packet->u.message.payload, PAYLOAD_BUFFER_SIZE,
-                                          message->payload, message->payload_type);
-    
-    if (payload_length > PAYLOAD_BUFFER_SIZE)
+    if (message->data)
     {
-        packet = xrealloc(packet, 
-                         sizeof(uipc_packet_header) +
-                         sizeof(uipc_packet_message) +
-                         payload_length);
-        payload_length = uipc_marshal_payload(packet->u.message.payload, payload_length,
-                                              message->payload, message->payload_type);
+        vector->iov = vector->inline_iov;
+        vector->scratch = vector->inline_scratch;
+        vector->streams = vector->inline_streams;
+        vector->stream_count = 0;
+        vector->iov[1].iov_base = (void*) message->data;
+        vector->iov[1].iov_len = message->data_length;
+        vector->count = message->data_length ? 2 : 1;
+        vector->length = message->data_length;
+        return vector->length;
+    }
+    else
+    {
+        return uipc_marshal_payload_vector(vector, 1, message->payload, message->payload_type);
     }
-
-    packet->u.message.length = payload_length;
-    packet->header.length = 
-        sizeof(uipc_packet_header) +
-        sizeof(uipc_packet_message) +
-        payload_length;
-
-    return packet;
 }
 
 static uipc_message* 
@@ -100,12 +92,122 @@ message_from_packet(uipc_packet* packet)
 
     message->type = packet->u.message.type;
     message->packet = packet;
+    message->owns_packet = false;
+    message->streams = NULL;
+    message->stream_count = 0;
     message->payload = NULL;
     message->payload_type = NULL;
+    message->data = NULL;
+    message->data_length = 0;
 
     return message;
 }
 
+/* Wait for the strings streamed after a message, keeping the
+   packet since the handle's buffer will be reused meanwhile */
+static void
+message_expect_streams(uipc_message* message, unsigned int count)
+{
+    uipc_packet* packet = message->packet;
+    size_t size = sizeof(uipc_packet_header) + packet->header.length;
+    unsigned int i;
+
+    message->packet = memcpy(xmalloc(size), packet, size);
+    message->owns_packet = true;
+    message->streams = xcalloc(count, sizeof(uipc_stream));
+    message->stream_count = count;
+
+    for (i = 0; i < count; i++)
+        message->streams[i].spill_fd = -1;
+}
+
+static void
+stream_spill(uipc_stream* stream, const char* data, unsigned long length)
+{
+    const char* tmpdir = getenv("TMPDIR");
+    ssize_t written;
+
+    if (stream->spill_fd < 0 && !stream->spill_path)
+    {
+        stream->spill_path = format("%s/uipc-stream-XXXXXX", tmpdir ? tmpdir : "/tmp");
+        stream->spill_fd = mkstemp(stream->spill_path);
+
+        if (stream->spill_fd < 0)
+        {
+            free(stream->spill_path);
+            stream->spill_path = NULL;
+            return;
+        }
+    }
+
+    while (stream->spill_fd >= 0 && length)
+    {
+        written = write(stream->spill_fd, data, length);
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        /* Whatever was spilled so far stays; the note still
+           reports everything past the limit */
+        if (written <= 0)
+        {
+            close(stream->spill_fd);
+            stream->spill_fd = -1;
+            break;
+        }
+
+        data += written;
+        length -= written;
+    }
+}
+
+static void
+stream_feed(uipc_handle* handle, uipc_stream* stream, uipc_packet* packet)
+{
+    const char* data = packet->u.chunk.data;
+    unsigned long length = packet->header.length - sizeof(uipc_packet_chunk);
+    unsigned long keep;
+
+    if (!stream->received)
+    {
+        stream->total = packet->u.chunk.total;
+        stream->data = xmalloc(stream->total < handle->stream_limit ?
+                               stream->total : handle->stream_limit);
+    }
+
+    if (length > stream->total - stream->received)
+        length = stream->total - stream->received;
+
+    keep = stream->received < handle->stream_limit ? handle->stream_limit - stream->received : 0;
+
+    if (keep > length)
+        keep = length;
+
+    memcpy(stream->data + stream->kept, data, keep);
+    stream->kept += keep;
+    stream->received += length;
+
+    if (length > keep && handle->overflow == UIPC_OVERFLOW_SPILL)
+        stream_spill(stream, data + keep, length - keep);
+}
+
+static void
+message_free_streams(uipc_message* message)
+{
+    unsigned int i;
+
+    for (i = 0; i < message->stream_count; i++)
+    {
+        free(message->streams[i].data);
+        /* Spilled data is left for whoever reads the message */
+        if (message->streams[i].spill_fd >= 0)
+            close(message->streams[i].spill_fd);
+        free(message->streams[i].spill_path);
+    }
+
+    free(message->streams);
+}
+
 uipc_handle* 
 uipc_attach(int socket)
 {
@@ -116,11 +218,100 @@ uipc_attach(int socket)
 	
     handle->socket = socket;
     handle->readable = handle->writeable = true;
+    handle->ring = NULL;
+    handle->buffer.packet = NULL;
+    handle->buffer.capacity = 0;
+    handle->context.transferred = 0;
+    handle->redirects = 0;
+    handle->pending = NULL;
+    handle->pending_stream = 0;
+    handle->stream_limit = ~0UL;
+    handle->overflow = UIPC_OVERFLOW_TRUNCATE;
 
     return handle;
 }
 
-static
+uipc_handle*
+uipc_attach_ring(int socket, uipc_ring* ring, uipc_ring_role role)
+{
+    uipc_handle* handle = uipc_attach(socket);
+
+    if (!handle)
+        return NULL;
+
+    handle->ring = ring;
+    handle->role = role;
+    handle->owner = getpid();
+
+    return handle;
+}
+
+void
+uipc_set_stream_limit(uipc_handle* handle, unsigned long limit, uipc_overflow overflow)
+{
+    handle->stream_limit = limit;
+    handle->overflow = overflow;
+}
+
+uipc_status
+uipc_recv_packet(uipc_handle* handle, uipc_packet* packet, uipc_message** message)
+{
+    uipc_message* pending = handle->pending;
+
+    statistics.bytes_received += packet->header.length;
+
+    switch (packet->header.type)
+    {
+    case PACKET_MESSAGE:
+        *message = message_from_packet(packet);
+
+        if (!*message)
+        {
+            handle->readable = false;
+            return UIPC_NOMEM;
+        }
+
+        if (packet->u.message.streams)
+        {
+            /* Only one message at a time may be streaming */
+            if (pending)
+            {
+                uipc_msg_free(*message);
+                return UIPC_ERROR;
+            }
+
+            message_expect_streams(*message, packet->u.message.streams);
+            handle->pending = *message;
+            handle->pending_stream = 0;
+            return UIPC_INCOMPLETE;
+        }
+
+        statistics.messages_received++;
+        return UIPC_SUCCESS;
+    case PACKET_CHUNK:
+        if (!pending)
+            return UIPC_ERROR;
+
+        stream_feed(handle, &pending->streams[handle->pending_stream], packet);
+
+        if (pending->streams[handle->pending_stream].received ==
+            pending->streams[handle->pending_stream].total)
+        {
+            handle->pending_stream++;
+        }
+
+        if (handle->pending_stream < pending->stream_count)
+            return UIPC_INCOMPLETE;
+
+        *message = pending;
+        handle->pending = NULL;
+        statistics.messages_received++;
+        return UIPC_SUCCESS;
+    default:
+        return UIPC_ERROR;
+    }
+}
+
 uipc_status
 uipc_recv_async(uipc_handle* handle, uipc_async_context* context, uipc_message** message)
 {
@@ -130,7 +321,7 @@ uipc_recv_async(uipc_handle* handle, uipc_async_context* context, uipc_message**
     if (!handle->readable)
         return UIPC_EOF;
 
-    result = uipc_packet_recv(handle->socket, context, &packet);
+    result = uipc_packet_recv(handle->socket, context, &handle->buffer, &packet);
         
     if (result == UIPC_EOF)
     {
@@ -143,28 +334,15 @@ uipc_recv_async(uipc_handle* handle, uipc_async_context* context, uipc_message**
     }
     else
     {
-        switch (packet->header.type)
-        {
-        case PACKET_MESSAGE:
-        {
-            *message = message_from_packet(packet);
-            
-            if (!*message)
-            {
-                free(packet);
-                handle->readable = false;
-                return UIPC_NOMEM;
-            }
-            return UIPC_SUCCESS;
-        }
-        default:
-            return UIPC_ERROR;
-        }
+        context->transferred = 0;
+        return uipc_recv_packet(handle, packet, message);
     }    
 }
 
+/* Receive one packet from the socket */
+static
 uipc_status
-uipc_recv(uipc_handle* handle, uipc_message** message, uipc_time* abs)
+uipc_recv_socket_packet(uipc_handle* handle, uipc_message** message, uipc_time* abs)
 {
     uipc_status result = UIPC_SUCCESS;
     uipc_async_context context = {0};
@@ -177,57 +355,109 @@ uipc_recv(uipc_handle* handle, uipc_message** message, uipc_time* abs)
         } while (result == UIPC_RETRY);
 
         if (result != UIPC_SUCCESS)
-        {
-            if (context.packet)
-                free(context.packet);
             return result;
-        }
 
         result = uipc_recv_async(handle, &context, message);
     } while (result == UIPC_RETRY);
 
-    if (context.packet)
-        free(context.packet);
+    return result;
+}
+
+static
+uipc_status
+uipc_recv_socket(uipc_handle* handle, uipc_message** message, uipc_time* abs)
+{
+    uipc_status result;
+
+    do
+    {
+        result = uipc_recv_socket_packet(handle, message, abs);
+    } while (result == UIPC_INCOMPLETE);
 
     return result;
 }
 
 static
 uipc_status
-uipc_send_async(uipc_handle* handle, uipc_async_context* context, uipc_message* message)
+uipc_recv_ring(uipc_handle* handle, uipc_message** message, uipc_time* abs)
 {
-    uipc_status result = UIPC_SUCCESS;
     uipc_packet* packet = NULL;
+    uipc_status result;
 
-    if (!handle->writeable)
+    for (;;)
     {
-        result = UIPC_EOF;
-        goto cleanup;
+        result = uipc_ring_read(handle->ring, &handle->buffer, &packet);
+
+        if (result == UIPC_SUCCESS)
+        {
+            if (packet->header.type == PACKET_REDIRECT)
+                result = uipc_recv_socket_packet(handle, message, abs);
+            else
+                result = uipc_recv_packet(handle, packet, message);
+
+            if (result != UIPC_INCOMPLETE)
+                return result;
+
+            continue;
+        }
+        else if (result != UIPC_RETRY)
+        {
+            return result;
+        }
+
+        result = uipc_ring_wait(handle->ring, handle->socket, abs);
+
+        /* The ring is empty but the socket has something to say,
+           either a packet from another process or end of file */
+        if (result == UIPC_EOF)
+        {
+            result = uipc_recv_socket_packet(handle, message, abs);
+
+            if (result != UIPC_INCOMPLETE)
+                return result;
+        }
+        else if (result != UIPC_SUCCESS && result != UIPC_RETRY)
+        {
+            return result;
+        }
     }
+}
+
+uipc_status
+uipc_recv(uipc_handle* handle, uipc_message** message, uipc_time* abs)
+{
+    uipc_status result;
+
+    if (handle->ring && handle->role == UIPC_RING_READER)
+        result = uipc_recv_ring(handle, message, abs);
+    else
+        result = uipc_recv_socket(handle, message, abs);
+
+    return result;
+}
+
+static
+uipc_status
+uipc_send_async(uipc_handle* handle, uipc_async_context* context, struct iovec* iov, int count)
+{
+    uipc_status result = UIPC_SUCCESS;
 
-    packet = packet_from_message(message);
+    if (!handle->writeable)
+        return UIPC_EOF;
 
-    result = uipc_packet_send(handle->socket, context, packet);
+    result = uipc_packet_sendv(handle->socket, context, iov, count);
         
     if (result == UIPC_EOF)
     {
         handle->writeable = false;
-        goto cleanup;
-    }
-    else if (result != UIPC_SUCCESS)
-    {
-        goto cleanup;
     }
 
-cleanup:
-    if (packet)
-        free(packet);
-
     return result;
 }
 
+static
 uipc_status
-uipc_send(uipc_handle* handle, uipc_message* message, uipc_time* abs)
+uipc_send_socket(uipc_handle* handle, struct iovec* iov, int count, uipc_time* abs)
 {
     uipc_status result = UIPC_SUCCESS;
     uipc_async_context context = {0};
@@ -242,12 +472,132 @@ uipc_send(uipc_handle* handle, uipc_message* message, uipc_time* abs)
         if (result != UIPC_SUCCESS)
             return result;
 
-        result = uipc_send_async(handle, &context, message);
+        result = uipc_send_async(handle, &context, iov, count);
     } while (result == UIPC_RETRY);
 
     return result;
 }
 
+static
+uipc_status
+uipc_send_ring(uipc_handle* handle, struct iovec* iov, int count, size_t length, uipc_time* abs)
+{
+    uipc_packet_header redirect;
+    struct iovec redirect_iov = {&redirect, sizeof(redirect)};
+    uipc_status result;
+
+    if (!handle->writeable)
+        return UIPC_EOF;
+
+    if (uipc_ring_fits(handle->ring, length))
+    {
+        result = uipc_ring_write(handle->ring, handle->socket, iov, count, abs);
+    }
+    else
+    {
+        /* Too large for the ring, so send it on the socket and
+           leave a marker telling the reader when to pick it up */
+        redirect.type = PACKET_REDIRECT;
+        redirect.length = 0;
+
+        result = uipc_ring_write(handle->ring, handle->socket, &redirect_iov, 1, abs);
+
+        if (result == UIPC_SUCCESS)
+            result = uipc_send_socket(handle, iov, count, abs);
+    }
+
+    if (result == UIPC_EOF)
+        handle->writeable = false;
+
+    return result;
+}
+
+/* Send one packet gathered from iov, whose total size is length */
+static
+uipc_status
+uipc_send_packet(uipc_handle* handle, struct iovec* iov, int count, size_t length, uipc_time* abs)
+{
+    uipc_status result;
+
+    /* Processes forked by the writer inherit the handle but must
+       not touch the ring, which only supports a single writer */
+    if (handle->ring && handle->role == UIPC_RING_WRITER && handle->owner == getpid())
+        result = uipc_send_ring(handle, iov, count, length, abs);
+    else
+        result = uipc_send_socket(handle, iov, count, abs);
+
+    if (result == UIPC_SUCCESS)
+        statistics.bytes_sent += length - sizeof(uipc_packet_header);
+
+    return result;
+}
+
+/* Send a long string in chunks so neither side needs it all in one buffer */
+static
+uipc_status
+uipc_send_stream(uipc_handle* handle, struct iovec* stream, uipc_time* abs)
+{
+    uipc_status result = UIPC_SUCCESS;
+    uipc_packet head;
+    struct iovec iov[2];
+    unsigned long offset;
+    unsigned long length;
+
+    head.header.type = PACKET_CHUNK;
+    head.u.chunk.total = stream->iov_len;
+
+    iov[0].iov_base = &head;
+    iov[0].iov_len = sizeof(uipc_packet_header) + sizeof(uipc_packet_chunk);
+
+    for (offset = 0; result == UIPC_SUCCESS && offset < stream->iov_len; offset += length)
+    {
+        length = stream->iov_len - offset;
+        if (length > UIPC_CHUNK_SIZE)
+            length = UIPC_CHUNK_SIZE;
+
+        head.header.length = sizeof(uipc_packet_chunk) + length;
+        iov[1].iov_base = (char*) stream->iov_base + offset;
+        iov[1].iov_len = length;
+
+        result = uipc_send_packet(handle, iov, 2, iov[0].iov_len + length, abs);
+    }
+
+    return result;
+}
+
+uipc_status
+uipc_send(uipc_handle* handle, uipc_message* message, uipc_time* abs)
+{
+    uipc_status result = UIPC_SUCCESS;
+    uipc_marshal_vector vector;
+    uipc_packet head;
+    unsigned long length = message_vector(message, &vector);
+    int i;
+
+    /* The header and message descriptor go out ahead of the payload */
+    head.header.type = PACKET_MESSAGE;
+    head.header.length = sizeof(uipc_packet_message) + length;
+    head.u.message.type = message->type;
+    head.u.message.length = length;
+    head.u.message.streams = vector.stream_count;
+
+    vector.iov[0].iov_base = &head;
+    vector.iov[0].iov_len = sizeof(uipc_packet_header) + sizeof(uipc_packet_message);
+
+    result = uipc_send_packet(handle, vector.iov, vector.count,
+                              sizeof(uipc_packet_header) + head.header.length, abs);
+
+    for (i = 0; result == UIPC_SUCCESS && i < vector.stream_count; i++)
+        result = uipc_send_stream(handle, &vector.streams[i], abs);
+
+    if (result == UIPC_SUCCESS)
+        statistics.messages_sent++;
+
+    uipc_marshal_vector_destroy(&vector);
+
+    return result;
+}
+
 uipc_status
 uipc_detach(uipc_handle* handle)
 {
@@ -256,6 +606,9 @@ uipc_detach(uipc_handle* handle)
     if (!handle)
         return UIPC_ERROR;
     
+    if (handle->pending)
+        uipc_msg_free(handle->pending);
+    free(handle->buffer.packet);
     free(handle);
     
     return result;
@@ -270,11 +623,20 @@ uipc_close(uipc_handle* handle)
         return UIPC_ERROR;
     
     close(handle->socket);
+    if (handle->pending)
+        uipc_msg_free(handle->pending);
+    free(handle->buffer.packet);
     free(handle);
     
     return result;
 }
 
+void
+uipc_get_statistics(uipc_statistics* stats)
+{
+    *stats = statistics;
+}
+
 uipc_message* 
 uipc_msg_new(uipc_message_type type)
 {
@@ -285,7 +647,13 @@ uipc_msg_new(uipc_message_type type)
 
     message->type = type;
     message->payload = NULL;
+    message->payload_type = NULL;
+    message->data = NULL;
+    message->data_length = 0;
     message->packet = NULL;
+    message->owns_packet = false;
+    message->streams = NULL;
+    message->stream_count = 0;
 
 	return message;
 }
@@ -293,8 +661,9 @@ uipc_msg_new(uipc_message_type type)
 void
 uipc_msg_free(uipc_message* message)
 {
-    if (message->packet)
-        free((void*) message->packet);
+    if (message->owns_packet)
+        free(message->packet);
+    message_free_streams(message);
     free(message);
 }
 
@@ -310,7 +679,8 @@ uipc_msg_get_payload(uipc_message* message, uipc_typeinfo* info)
     if (message->packet)
     {
         void* object;
-        uipc_unmarshal_payload(&object, message->packet->u.message.payload, info); 
+        uipc_unmarshal_payload_streams(&object, message->packet->u.message.payload, info,
+                                       message->streams, message->stream_count);
         return object;
     }
     else
@@ -322,7 +692,8 @@ uipc_msg_get_payload(uipc_message* message, uipc_typeinfo* info)
 void
 uipc_msg_free_payload(void* payload, uipc_typeinfo* info)
 {
-    uipc_free_object(payload, info);
+    /* Payloads are unmarshaled into a single block */
+    free(payload);
 }
 
 void
@@ -331,3 +702,25 @@ uipc_msg_set_payload(uipc_message* message, const void* payload, uipc_typeinfo*
     message->payload = (void*) payload;
     message->payload_type = info;
 }
+
+void
+uipc_msg_set_data(uipc_message* message, const void* data, unsigned long length)
+{
+    message->data = data;
+    message->data_length = length;
+}
+
+const void*
+uipc_msg_get_data(uipc_message* message, unsigned long* length)
+{
+    if (message->packet)
+    {
+        *length = message->packet->u.message.length;
+        return message->packet->u.message.payload;
+    }
+    else
+    {
+        *length = 0;
+        return NULL;
+    }
+}
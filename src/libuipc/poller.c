@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Multiplexed receive over many handles.  Each handle's socket, and
+ * the wakeup descriptor of its ring if it reads from one, is watched
+ * with epoll where available and poll() otherwise.  Partial reads are
+ * resumed from the handle's own async context.  Plain descriptors can
+ * be watched alongside, and are only reported as readable.
+ */
+
+#ifdef HAVE_CONFIG_H
+#    include <config.h>
+#endif
+
+#include <moonunit/private/util.h>
+#include <uipc/ipc.h>
+#include <uipc/wire.h>
+#include <uipc/ring.h>
+#include <uipc/handle.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#ifdef HAVE_SYS_EPOLL_H
+#    include <sys/epoll.h>
+#endif
+
+#define MAX_EVENTS 64
+
+struct poller_entry;
+
+/* Identifies which descriptor of an entry an event is for */
+typedef struct poller_source
+{
+    struct poller_entry* entry;
+    bool ring;
+} poller_source;
+
+typedef struct poller_entry
+{
+    /* NULL for a plain descriptor */
+    uipc_handle* handle;
+    int fd;
+    void* data;
+    /* Socket flags before registration */
+    int flags;
+    /* The socket was reported readable and has not run dry */
+    bool socket_ready;
+    /* The ring was prepared for the current wait */
+    bool waiting;
+    poller_source socket_source;
+    poller_source ring_source;
+} poller_entry;
+
+struct __uipc_poller
+{
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;
+#else
+    struct pollfd* pfds;
+    poller_source** sources;
+#endif
+    poller_entry** entries;
+    unsigned int count;
+    /* Entry to try first, so busy handles cannot starve the rest */
+    unsigned int next;
+};
+
+static bool
+entry_has_ring(poller_entry* entry)
+{
+    return entry->handle && entry->handle->ring && entry->handle->role == UIPC_RING_READER;
+}
+
+uipc_poller*
+uipc_poller_new(void)
+{
+    uipc_poller* poller = xcalloc(1, sizeof(uipc_poller));
+
+#ifdef HAVE_SYS_EPOLL_H
+    poller->epoll_fd = epoll_create(MAX_EVENTS);
+
+    if (poller->epoll_fd < 0)
+    {
+        free(poller);
+        return NULL;
+    }
+
+    fcntl(poller->epoll_fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+    return poller;
+}
+
+static void remove_entry(uipc_poller* poller, unsigned int i);
+
+void
+uipc_poller_free(uipc_poller* poller)
+{
+    if (!poller)
+        return;
+
+    while (poller->count)
+        remove_entry(poller, 0);
+
+#ifdef HAVE_SYS_EPOLL_H
+    close(poller->epoll_fd);
+#else
+    free(poller->pfds);
+    free(poller->sources);
+#endif
+    free(poller->entries);
+    free(poller);
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int
+watch(uipc_poller* poller, int op, int fd, poller_source* source)
+{
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = source;
+
+    return epoll_ctl(poller->epoll_fd, op, fd, &event);
+}
+#endif
+
+uipc_status
+uipc_poller_add(uipc_poller* poller, uipc_handle* handle, void* data)
+{
+    poller_entry* entry = xcalloc(1, sizeof(poller_entry));
+
+    entry->handle = handle;
+    entry->fd = handle->socket;
+    entry->data = data;
+    entry->socket_source.entry = entry;
+    entry->socket_source.ring = false;
+    entry->ring_source.entry = entry;
+    entry->ring_source.ring = true;
+    entry->flags = fcntl(handle->socket, F_GETFL);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (watch(poller, EPOLL_CTL_ADD, handle->socket, &entry->socket_source))
+        goto error;
+
+    if (entry_has_ring(entry) &&
+        watch(poller, EPOLL_CTL_ADD, uipc_ring_wait_fd(handle->ring), &entry->ring_source))
+    {
+        epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, handle->socket, NULL);
+        goto error;
+    }
+#else
+    /* Room for a socket and a ring descriptor per entry */
+    poller->pfds = xrealloc(poller->pfds, sizeof(*poller->pfds) * 2 * (poller->count + 1));
+    poller->sources = xrealloc(poller->sources, sizeof(*poller->sources) * 2 * (poller->count + 1));
+#endif
+
+    fcntl(handle->socket, F_SETFL, entry->flags | O_NONBLOCK);
+    handle->context.transferred = 0;
+
+    poller->entries = xrealloc(poller->entries, sizeof(*poller->entries) * (poller->count + 1));
+    poller->entries[poller->count++] = entry;
+
+    return UIPC_SUCCESS;
+
+#ifdef HAVE_SYS_EPOLL_H
+error:
+
+    free(entry);
+
+    return UIPC_ERROR;
+#endif
+}
+
+uipc_status
+uipc_poller_add_fd(uipc_poller* poller, int fd, void* data)
+{
+    poller_entry* entry = xcalloc(1, sizeof(poller_entry));
+
+    entry->handle = NULL;
+    entry->fd = fd;
+    entry->data = data;
+    entry->socket_source.entry = entry;
+    entry->socket_source.ring = false;
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (watch(poller, EPOLL_CTL_ADD, fd, &entry->socket_source))
+    {
+        free(entry);
+        return UIPC_ERROR;
+    }
+#else
+    poller->pfds = xrealloc(poller->pfds, sizeof(*poller->pfds) * 2 * (poller->count + 1));
+    poller->sources = xrealloc(poller->sources, sizeof(*poller->sources) * 2 * (poller->count + 1));
+#endif
+
+    poller->entries = xrealloc(poller->entries, sizeof(*poller->entries) * (poller->count + 1));
+    poller->entries[poller->count++] = entry;
+
+    return UIPC_SUCCESS;
+}
+
+static void
+remove_entry(uipc_poller* poller, unsigned int i)
+{
+    poller_entry* entry = poller->entries[i];
+
+    memmove(&poller->entries[i], &poller->entries[i + 1],
+            sizeof(*poller->entries) * (poller->count - i - 1));
+    poller->count--;
+
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, entry->fd, NULL);
+    if (entry_has_ring(entry))
+        epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, uipc_ring_wait_fd(entry->handle->ring), NULL);
+#endif
+
+    if (entry->handle)
+        fcntl(entry->fd, F_SETFL, entry->flags);
+    free(entry);
+}
+
+uipc_status
+uipc_poller_remove(uipc_poller* poller, uipc_handle* handle)
+{
+    unsigned int i;
+
+    for (i = 0; i < poller->count; i++)
+    {
+        if (poller->entries[i]->handle == handle)
+        {
+            remove_entry(poller, i);
+            return UIPC_SUCCESS;
+        }
+    }
+
+    return UIPC_ERROR;
+}
+
+uipc_status
+uipc_poller_remove_fd(uipc_poller* poller, int fd)
+{
+    unsigned int i;
+
+    for (i = 0; i < poller->count; i++)
+    {
+        if (!poller->entries[i]->handle && poller->entries[i]->fd == fd)
+        {
+            remove_entry(poller, i);
+            return UIPC_SUCCESS;
+        }
+    }
+
+    return UIPC_ERROR;
+}
+
+/* Try to receive from an entry without blocking */
+static uipc_status
+entry_recv(poller_entry* entry, uipc_message** message)
+{
+    uipc_handle* handle = entry->handle;
+    uipc_packet* packet;
+    uipc_status result;
+
+    /* Plain descriptors are left for the caller to read */
+    if (!handle)
+    {
+        if (!entry->socket_ready)
+            return UIPC_RETRY;
+
+        entry->socket_ready = false;
+        *message = NULL;
+        return UIPC_SUCCESS;
+    }
+
+    for (;;)
+    {
+        /* Ring packets after a redirect wait for the redirected one */
+        if (entry_has_ring(entry) && !handle->redirects)
+        {
+            result = uipc_ring_read(handle->ring, &handle->buffer, &packet);
+
+            if (result == UIPC_SUCCESS)
+            {
+                if (packet->header.type != PACKET_REDIRECT)
+                {
+                    result = uipc_recv_packet(handle, packet, message);
+
+                    if (result == UIPC_INCOMPLETE)
+                        continue;
+
+                    return result;
+                }
+
+                handle->redirects++;
+            }
+            else if (result != UIPC_RETRY)
+            {
+                return result;
+            }
+        }
+
+        if (!entry->socket_ready)
+            return UIPC_RETRY;
+
+        result = uipc_recv_async(handle, &handle->context, message);
+
+        switch (result)
+        {
+        case UIPC_SUCCESS:
+        case UIPC_INCOMPLETE:
+            if (handle->redirects)
+                handle->redirects--;
+            break;
+        case UIPC_RETRY:
+            entry->socket_ready = false;
+            break;
+        case UIPC_EOF:
+            /* The writer may have filled the ring just before exiting */
+            if (entry_has_ring(entry) && !uipc_ring_empty(handle->ring))
+                result = UIPC_RETRY;
+            break;
+        default:
+            break;
+        }
+
+        if (result != UIPC_INCOMPLETE)
+            return result;
+    }
+}
+
+/* Wait for any descriptor, marking ready sockets */
+static int
+poller_wait(uipc_poller* poller, int timeout)
+{
+    poller_source* source;
+    int ret;
+    int i;
+#ifdef HAVE_SYS_EPOLL_H
+    struct epoll_event events[MAX_EVENTS];
+
+    ret = epoll_wait(poller->epoll_fd, events, MAX_EVENTS, timeout);
+
+    for (i = 0; i < ret; i++)
+    {
+        source = events[i].data.ptr;
+        if (!source->ring)
+            source->entry->socket_ready = true;
+    }
+#else
+    int count = 0;
+
+    for (i = 0; i < (int) poller->count; i++)
+    {
+        poller_entry* entry = poller->entries[i];
+
+        poller->pfds[count].fd = entry->fd;
+        poller->pfds[count].events = POLLIN;
+        poller->sources[count++] = &entry->socket_source;
+
+        if (entry->waiting)
+        {
+            poller->pfds[count].fd = uipc_ring_wait_fd(entry->handle->ring);
+            poller->pfds[count].events = POLLIN;
+            poller->sources[count++] = &entry->ring_source;
+        }
+    }
+
+    ret = poll(poller->pfds, count, timeout);
+
+    for (i = 0; ret > 0 && i < count; i++)
+    {
+        source = poller->sources[i];
+        if (poller->pfds[i].revents && !source->ring)
+            source->entry->socket_ready = true;
+    }
+#endif
+
+    return ret;
+}
+
+uipc_status
+uipc_poller_recv(uipc_poller* poller, uipc_handle** handle, void** data,
+                 uipc_message** message, uipc_time* abs)
+{
+    poller_entry* entry;
+    uipc_status result;
+    unsigned int i, index;
+    int timeout;
+    int ret;
+    bool pending;
+
+    if (!poller->count)
+        return UIPC_ERROR;
+
+    for (;;)
+    {
+        for (i = 0; i < poller->count; i++)
+        {
+            index = (poller->next + i) % poller->count;
+            entry = poller->entries[index];
+
+            result = entry_recv(entry, message);
+
+            if (result != UIPC_RETRY)
+            {
+                poller->next = index + 1;
+                *handle = entry->handle;
+                if (data)
+                    *data = entry->data;
+                return result;
+            }
+        }
+
+        if ((timeout = uipc_time_timeout(abs)) == 0)
+            return UIPC_TIMEOUT;
+
+        /* Ask ring writers for a wakeup, unless one raced ahead */
+        pending = false;
+
+        for (i = 0; i < poller->count; i++)
+        {
+            entry = poller->entries[i];
+            entry->waiting = entry_has_ring(entry) && !entry->handle->redirects;
+
+            if (entry->waiting && !uipc_ring_prepare_wait(entry->handle->ring))
+            {
+                entry->waiting = false;
+                pending = true;
+            }
+        }
+
+        ret = pending ? 0 : poller_wait(poller, timeout);
+
+        for (i = 0; i < poller->count; i++)
+        {
+            entry = poller->entries[i];
+
+            if (entry->waiting)
+            {
+                uipc_ring_finish_wait(entry->handle->ring);
+                entry->waiting = false;
+            }
+        }
+
+        if (ret < 0 && errno != EINTR && errno != EAGAIN)
+            return UIPC_ERROR;
+    }
+}
@@ -0,0 +1,431 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Single-producer, single-consumer ring buffer in memory shared
+ * between a test process and its parent.  Packets are copied into
+ * the ring in their wire format, so the consumer sees exactly what
+ * it would have read from the socket.  Each side only makes a
+ * system call to wake the other when it is actually asleep.
+ */
+
+#ifdef HAVE_CONFIG_H
+#    include <config.h>
+#endif
+
+#include <moonunit/private/util.h>
+#include <uipc/ring.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <poll.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#    include <sys/eventfd.h>
+#endif
+#include <stdint.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#    define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define barrier() __sync_synchronize()
+
+typedef struct uipc_ring_shared
+{
+    /* Total bytes ever written and read; positions
+       in the buffer are these modulo the ring size */
+    volatile unsigned long head;
+    volatile unsigned long tail;
+    /* Set by a side before it goes to sleep */
+    volatile int reader_waiting;
+    volatile int writer_waiting;
+} uipc_ring_shared;
+
+typedef struct uipc_notify
+{
+    int read_fd;
+    int write_fd;
+} uipc_notify;
+
+struct __uipc_ring
+{
+    uipc_ring_shared* shared;
+    char* data;
+    size_t size;
+    size_t mapped;
+    /* Wakes the reader when data arrives */
+    uipc_notify data_ready;
+    /* Wakes the writer when space frees up */
+    uipc_notify space_ready;
+};
+
+static int
+notify_open(uipc_notify* notify)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    int fd = eventfd(0, 0);
+
+    if (fd >= 0)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        notify->read_fd = notify->write_fd = fd;
+        return 0;
+    }
+#endif
+    int fds[2];
+
+    if (pipe(fds))
+        return -1;
+
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    notify->read_fd = fds[0];
+    notify->write_fd = fds[1];
+
+    return 0;
+}
+
+static void
+notify_close(uipc_notify* notify)
+{
+    if (notify->read_fd >= 0)
+        close(notify->read_fd);
+    if (notify->write_fd >= 0 && notify->write_fd != notify->read_fd)
+        close(notify->write_fd);
+
+    notify->read_fd = notify->write_fd = -1;
+}
+
+static void
+notify_signal(uipc_notify* notify)
+{
+    uint64_t value = 1;
+
+    /* A full pipe or saturated eventfd already has a wakeup pending */
+    (void) write(notify->write_fd, &value,
+                 notify->write_fd == notify->read_fd ? sizeof(value) : 1);
+}
+
+static void
+notify_drain(uipc_notify* notify)
+{
+    uint64_t buffer[8];
+
+    while (read(notify->read_fd, buffer, sizeof(buffer)) > 0);
+}
+
+/* Wait for a notification or for the socket to become readable */
+static uipc_status
+notify_wait(uipc_notify* notify, int socket, uipc_time* abs)
+{
+    struct pollfd pfds[2];
+    int timeout = uipc_time_timeout(abs);
+    int ret;
+
+    if (timeout == 0)
+        return UIPC_TIMEOUT;
+
+    pfds[0].fd = notify->read_fd;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd = socket;
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+
+    ret = poll(pfds, 2, timeout);
+
+    if (ret < 0)
+    {
+        if (errno == EAGAIN || errno == EINTR)
+            return UIPC_RETRY;
+        else
+            return UIPC_ERROR;
+    }
+    else if (pfds[0].revents)
+    {
+        notify_drain(notify);
+        return UIPC_SUCCESS;
+    }
+    else if (pfds[1].revents)
+        return UIPC_EOF;
+    else if (abs && uipc_time_is_past(abs))
+        return UIPC_TIMEOUT;
+
+    return UIPC_RETRY;
+}
+
+static void
+ring_copy_in(uipc_ring* ring, unsigned long pos, const void* src, size_t len)
+{
+    size_t offset = pos % ring->size;
+    size_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, (const char*) src + first, len - first);
+}
+
+static void
+ring_copy_out(uipc_ring* ring, unsigned long pos, void* dst, size_t len)
+{
+    size_t offset = pos % ring->size;
+    size_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(dst, ring->data + offset, first);
+    memcpy((char*) dst + first, ring->data, len - first);
+}
+
+uipc_ring*
+uipc_ring_new(size_t size)
+{
+    uipc_ring* ring = xcalloc(1, sizeof(uipc_ring));
+    size_t header = sizeof(uipc_ring_shared);
+    void* map;
+
+    ring->data_ready.read_fd = ring->data_ready.write_fd = -1;
+    ring->space_ready.read_fd = ring->space_ready.write_fd = -1;
+
+    /* Keep the data area aligned */
+    header = (header + 63) & ~((size_t) 63);
+
+    ring->size = size;
+    ring->mapped = header + size;
+
+    map = mmap(NULL, ring->mapped, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (map == MAP_FAILED)
+        goto error;
+
+    ring->shared = map;
+    ring->data = (char*) map + header;
+
+    if (notify_open(&ring->data_ready) || notify_open(&ring->space_ready))
+        goto error;
+
+    uipc_ring_reset(ring);
+
+    return ring;
+
+error:
+
+    uipc_ring_free(ring);
+
+    return NULL;
+}
+
+void
+uipc_ring_reset(uipc_ring* ring)
+{
+    ring->shared->head = ring->shared->tail = 0;
+    ring->shared->reader_waiting = ring->shared->writer_waiting = 0;
+
+    /* Discard wakeups left over by a previous writer */
+    notify_drain(&ring->data_ready);
+    notify_drain(&ring->space_ready);
+
+    barrier();
+}
+
+void
+uipc_ring_free(uipc_ring* ring)
+{
+    if (!ring)
+        return;
+
+    if (ring->shared)
+        munmap(ring->shared, ring->mapped);
+
+    notify_close(&ring->data_ready);
+    notify_close(&ring->space_ready);
+
+    free(ring);
+}
+
+int
+uipc_ring_fits(uipc_ring* ring, size_t length)
+{
+    return length <= ring->size;
+}
+
+uipc_status
+uipc_ring_write(uipc_ring* ring, int socket, struct iovec* iov, int count, uipc_time* abs)
+{
+    uipc_ring_shared* shared = ring->shared;
+    unsigned long pos;
+    size_t len = 0;
+    uipc_status result;
+    int i;
+
+    for (i = 0; i < count; i++)
+        len += iov[i].iov_len;
+
+    while (ring->size - (shared->head - shared->tail) < len)
+    {
+        /* Announce that we are going to sleep, then check
+           again in case the reader made room in between */
+        shared->writer_waiting = 1;
+        barrier();
+
+        if (ring->size - (shared->head - shared->tail) >= len)
+        {
+            shared->writer_waiting = 0;
+            break;
+        }
+
+        /* The reader never writes to the socket, so it only
+           becomes readable if the reader went away */
+        result = notify_wait(&ring->space_ready, socket, abs);
+        shared->writer_waiting = 0;
+
+        if (result != UIPC_SUCCESS && result != UIPC_RETRY)
+            return result;
+    }
+
+    for (i = 0, pos = shared->head; i < count; pos += iov[i++].iov_len)
+        ring_copy_in(ring, pos, iov[i].iov_base, iov[i].iov_len);
+
+    /* Publish the packet only once its contents are visible */
+    barrier();
+    shared->head += len;
+    barrier();
+
+    if (shared->reader_waiting)
+        notify_signal(&ring->data_ready);
+
+    return UIPC_SUCCESS;
+}
+
+uipc_status
+uipc_ring_read(uipc_ring* ring, uipc_packet_buffer* buffer, uipc_packet** packet)
+{
+    uipc_ring_shared* shared = ring->shared;
+    uipc_packet_header header;
+    size_t len;
+
+    if (shared->head == shared->tail)
+        return UIPC_RETRY;
+
+    barrier();
+
+    ring_copy_out(ring, shared->tail, &header, sizeof(header));
+
+    len = sizeof(header) + header.length;
+
+    if (len > shared->head - shared->tail || len > ring->size)
+        return UIPC_ERROR;
+
+    *packet = uipc_packet_buffer_prepare(buffer, &header);
+
+    ring_copy_out(ring, shared->tail + sizeof(header),
+                  (char*) *packet + sizeof(header), header.length);
+
+    barrier();
+    shared->tail += len;
+    barrier();
+
+    if (shared->writer_waiting)
+        notify_signal(&ring->space_ready);
+
+    return UIPC_SUCCESS;
+}
+
+uipc_status
+uipc_ring_wait(uipc_ring* ring, int socket, uipc_time* abs)
+{
+    uipc_ring_shared* shared = ring->shared;
+    uipc_status result;
+
+    if (shared->head != shared->tail)
+        return UIPC_SUCCESS;
+
+    /* Announce that we are going to sleep, then check
+       again in case the writer published in between */
+    shared->reader_waiting = 1;
+    barrier();
+
+    if (shared->head != shared->tail)
+    {
+        shared->reader_waiting = 0;
+        return UIPC_SUCCESS;
+    }
+
+    result = notify_wait(&ring->data_ready, socket, abs);
+    shared->reader_waiting = 0;
+
+    /* Data always takes precedence over the socket so that
+       packets written before the writer exited are not lost */
+    barrier();
+
+    if (shared->head != shared->tail)
+        return UIPC_SUCCESS;
+
+    return result == UIPC_SUCCESS ? UIPC_RETRY : result;
+}
+
+int
+uipc_ring_empty(uipc_ring* ring)
+{
+    return ring->shared->head == ring->shared->tail;
+}
+
+int
+uipc_ring_wait_fd(uipc_ring* ring)
+{
+    return ring->data_ready.read_fd;
+}
+
+int
+uipc_ring_prepare_wait(uipc_ring* ring)
+{
+    uipc_ring_shared* shared = ring->shared;
+
+    shared->reader_waiting = 1;
+    barrier();
+
+    if (shared->head != shared->tail)
+    {
+        shared->reader_waiting = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+void
+uipc_ring_finish_wait(uipc_ring* ring)
+{
+    ring->shared->reader_waiting = 0;
+    notify_drain(&ring->data_ready);
+    barrier();
+}
@@ -28,6 +28,7 @@
 #include <uipc/time.h>
 #include <sys/time.h>
 #include <time.h>
+#include <limits.h>
 
 static void
 uipc_time_normalize(uipc_time* time)
@@ -107,3 +108,24 @@ uipc_time_difference(uipc_time* from, uipc_time* to, uipc_time* res)
     uipc_time_normalize(res);
 }
 
+int
+uipc_time_timeout(uipc_time* abs)
+{
+    uipc_time now;
+    uipc_time diff;
+
+    if (!abs)
+        return -1;
+
+    uipc_time_current(&now);
+    uipc_time_difference(&now, abs, &diff);
+
+    if (diff.seconds < 0 || diff.microseconds < 0 ||
+        (diff.seconds == 0 && diff.microseconds == 0))
+        return 0;
+
+    if (diff.seconds >= INT_MAX / 1000 - 1)
+        return INT_MAX;
+
+    return diff.seconds * 1000 + (diff.microseconds + 999) / 1000;
+}
@@ -36,12 +36,6 @@
 #include <stdlib.h>
 #include <poll.h>
 #include <unistd.h>
-#ifdef HAVE_SYS_SELECT_H
-#    include <sys/select.h>
-#endif
-#ifdef HAVE_SELECT_H
-#    include <select.h>
-#endif
 #include <sys/time.h>
 #include <time.h>
 #include <sys/types.h>
@@ -50,19 +44,58 @@
 #include <string.h>
 #include <signal.h>
 #include <stdio.h>
+#include <limits.h>
+
+#ifndef IOV_MAX
+#    define IOV_MAX 16
+#endif
+
+uipc_packet*
+uipc_packet_buffer_prepare(uipc_packet_buffer* buffer, uipc_packet_header* header)
+{
+    size_t size = sizeof(uipc_packet) + header->length;
+
+    if (buffer->capacity < size)
+    {
+        buffer->packet = xrealloc(buffer->packet, size);
+        buffer->capacity = size;
+    }
+
+    memcpy(buffer->packet, header, sizeof(*header));
+
+    return buffer->packet;
+}
 
 uipc_status
-uipc_packet_send(int socket, uipc_async_context* context, uipc_packet* packet)
+uipc_packet_sendv(int socket, uipc_async_context* context, struct iovec* iov, int count)
 {
-    char* buffer = (char*) packet;
-    ssize_t total = sizeof(uipc_packet_header) + packet->header.length;
-    ssize_t remaining = total - context->transferred;
+    size_t skip = context->transferred;
+    struct msghdr msg;
+    struct iovec first;
 
-    while (remaining)
+    /* Skip what went out in earlier attempts */
+    while (count && skip >= iov->iov_len)
+    {
+        skip -= iov->iov_len;
+        iov++;
+        count--;
+    }
+
+    while (count)
     {
 	ssize_t sent;
+
+        /* Adjust the first entry in place for a partially sent one */
+        first = *iov;
+        iov->iov_base = (char*) iov->iov_base + skip;
+        iov->iov_len -= skip;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+
 #ifdef MSG_NOSIGNAL
-	sent = send(socket, buffer + (total - remaining), remaining, MSG_NOSIGNAL);
+	sent = sendmsg(socket, &msg, MSG_NOSIGNAL);
 #else
     /* Block SIGPIPE for the send */
     struct sigaction blocked, original;
@@ -71,9 +104,11 @@ uipc_packet_send(int socket, uipc_async_context* context, uipc_packet* packet)
     sigemptyset(&blocked.sa_mask);
 
     sigaction(SIGPIPE, &blocked, &original);
-    sent = send(socket, buffer + (total - remaining), remaining, 0);
+    sent = sendmsg(socket, &msg, 0);
     sigaction(SIGPIPE, &original, &blocked);
 #endif
+
+        *iov = first;
         
         if (sent < 0)
         {
@@ -97,8 +132,15 @@ uipc_packet_send(int socket, uipc_async_context* context, uipc_packet* packet)
         }
         else
         {
-            remaining -= sent;
             context->transferred += sent;
+            skip += sent;
+
+            while (count && skip >= iov->iov_len)
+            {
+                skip -= iov->iov_len;
+                iov++;
+                count--;
+            }
         }
     }
 
@@ -106,11 +148,11 @@ uipc_packet_send(int socket, uipc_async_context* context, uipc_packet* packet)
 }
 
 uipc_status
-uipc_packet_recv(int socket, uipc_async_context* context, uipc_packet** packet)
+uipc_packet_recv(int socket, uipc_async_context* context, uipc_packet_buffer* buffer, uipc_packet** packet)
 {
 	ssize_t amount_read = 0;
     ssize_t remaining = 0;
-    char* buffer = NULL;
+    char* data = NULL;
 
     while (context->transferred < sizeof(context->header))
     {
@@ -137,24 +179,17 @@ uipc_packet_recv(int socket, uipc_async_context* context, uipc_packet** packet)
         }
 
         context->transferred += amount_read;
-    }
-
-    if (!context->packet)
-    {
-        context->packet = xmalloc(sizeof(uipc_packet) + context->header.length);
-
-        if (!context->packet)
-            return UIPC_NOMEM;
 
-        memcpy(context->packet, &context->header, sizeof(context->header));
+        if (context->transferred == sizeof(context->header))
+            uipc_packet_buffer_prepare(buffer, &context->header);
     }
 
     remaining = sizeof(uipc_packet_header) + context->header.length - context->transferred;
-    buffer = (char*) context->packet + context->transferred;
+    data = (char*) buffer->packet + context->transferred;
 
     while (remaining)
     {
-        amount_read = read(socket, buffer, remaining);
+        amount_read = read(socket, data, remaining);
 
         if (amount_read < 0)
         {
@@ -164,54 +199,42 @@ uipc_packet_recv(int socket, uipc_async_context* context, uipc_packet** packet)
             }
             else
             {
-                free(*packet);
                 return UIPC_ERROR;
             }
         }
         else if (amount_read == 0)
         {
-            free(*packet);
             return UIPC_ERROR;
         }
         else
         {
+            data += amount_read;
             remaining -= amount_read;
             context->transferred += amount_read;
         }
     }
 
-    *packet = context->packet;
-    context->packet = NULL;
+    *packet = buffer->packet;
 
     return UIPC_SUCCESS;
 }
 
-uipc_status
-uipc_packet_available(int socket, uipc_time* abs)
+/* Wait for events on a single socket */
+static uipc_status
+wait_socket(int socket, short events, uipc_time* abs)
 {
-	fd_set readset;
-    struct timeval timeout;
+    struct pollfd pfd;
+    int timeout = uipc_time_timeout(abs);
     int ret = -1;
 
-    if (abs)
-    {
-        uipc_time now;
-        uipc_time diff;
-
-        uipc_time_current(&now);
-        uipc_time_difference(&now, abs, &diff);
-
-        if (diff.seconds <= 0 && diff.microseconds <= 0)
-            return UIPC_TIMEOUT;
+    if (timeout == 0)
+        return UIPC_TIMEOUT;
 
-        timeout.tv_sec = (time_t) diff.seconds;
-        timeout.tv_usec = (USEC_T) diff.microseconds;
-    }	
+    pfd.fd = socket;
+    pfd.events = events;
+    pfd.revents = 0;
 
-	FD_ZERO(&readset);
-	FD_SET(socket, &readset);
-	
-	ret = select(socket+1, &readset, NULL, NULL, abs ? &timeout : NULL);
+    ret = poll(&pfd, 1, timeout);
 
     if (ret < 0)
     {
@@ -223,56 +246,24 @@ uipc_packet_available(int socket, uipc_time* abs)
         {
             return UIPC_ERROR;
         }
-    } else if (FD_ISSET(socket, &readset))
-		return UIPC_SUCCESS;
+    }
+    /* Errors and hangups are reported by the following read or write */
+    else if (pfd.revents)
+        return UIPC_SUCCESS;
     else if (abs && uipc_time_is_past(abs))
         return UIPC_TIMEOUT;
 
-	return UIPC_RETRY;
+    return UIPC_RETRY;
 }
 
 uipc_status
-uipc_packet_sendable(int socket, uipc_time* abs)
+uipc_packet_available(int socket, uipc_time* abs)
 {
-	fd_set writeset;
-	struct timeval timeout;
-    int ret = -1;
-
-    if (abs)
-    {
-        uipc_time now;
-        uipc_time diff;
-        
-        uipc_time_current(&now);
-        uipc_time_difference(&now, abs, &diff);
-        
-        if (diff.seconds <= 0 && diff.microseconds <= 0)
-            return UIPC_TIMEOUT;
-        
-        timeout.tv_sec = (time_t) diff.seconds;
-        timeout.tv_usec = (USEC_T) diff.microseconds;
-    }	
-
-	FD_ZERO(&writeset);
-	FD_SET(socket, &writeset);
-	
-	ret = select(socket+1, NULL, &writeset, NULL, abs ? &timeout : NULL);
-
-    if (ret < 0)
-    {
-        if (errno == EAGAIN || errno == EINTR)
-        {
-            return UIPC_RETRY;
-        }
-        else
-        {
-            return UIPC_ERROR;
-        }
-    }
-	else if (FD_ISSET(socket, &writeset))
-		return UIPC_SUCCESS;
-	else if (abs && uipc_time_is_past(abs))
-        return UIPC_TIMEOUT;
+    return wait_socket(socket, POLLIN, abs);
+}
 
-	return UIPC_RETRY;
+uipc_status
+uipc_packet_sendable(int socket, uipc_time* abs)
+{
+    return wait_socket(socket, POLLOUT, abs);
 }
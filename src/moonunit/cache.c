@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2007-2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Discovery cache
+ *
+ * Listing a library normally means loading it and walking its tests.
+ * The result is saved per library file, keyed by the file's device,
+ * inode, size, modification time and ELF build-id, so later listings
+ * of an unchanged library are served without loading it at all.
+ *
+ * Cache files use the ini format read by ini_read().
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "cache.h"
+
+#include <moonunit/private/util.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+
+#ifdef HAVE_ELF_H
+#  include <elf.h>
+#  include <link.h>
+#endif
+
+#define CACHE_VERSION "1"
+/* Upper bound on the note segments read while looking for a build-id */
+#define CACHE_NOTE_MAX 4096
+
+typedef struct CacheParse
+{
+    CacheKey* key;
+    CacheLibrary* library;
+    bool version;
+    bool path;
+    bool identity;
+    bool stale;
+} CacheParse;
+
+#ifdef HAVE_ELF_H
+static char*
+note_build_id(const char* notes, size_t size, size_t align)
+{
+    size_t offset = 0;
+
+    while (offset + sizeof(ElfW(Nhdr)) <= size)
+    {
+        const ElfW(Nhdr)* note = (const ElfW(Nhdr)*) (notes + offset);
+        size_t name = offset + sizeof(*note);
+        size_t desc = name + ((note->n_namesz + align - 1) & ~(align - 1));
+        size_t next = desc + ((note->n_descsz + align - 1) & ~(align - 1));
+
+        if (desc + note->n_descsz > size)
+            break;
+
+        if (note->n_type == NT_GNU_BUILD_ID &&
+            note->n_namesz == sizeof(ELF_NOTE_GNU) &&
+            !memcmp(notes + name, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)))
+        {
+            char* hex = xmalloc(note->n_descsz * 2 + 1);
+            unsigned int i;
+
+            for (i = 0; i < note->n_descsz; i++)
+            {
+                sprintf(hex + i * 2, "%02x", (unsigned char) notes[desc + i]);
+            }
+
+            hex[note->n_descsz * 2] = '\0';
+
+            return hex;
+        }
+
+        offset = next;
+    }
+
+    return NULL;
+}
+
+/* Read the GNU build-id from the note segments of an ELF file */
+static char*
+read_build_id(int fd)
+{
+    ElfW(Ehdr) ehdr;
+    ElfW(Phdr) phdr;
+    char notes[CACHE_NOTE_MAX];
+    char* result = NULL;
+    unsigned int i;
+
+    if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+        memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+        ehdr.e_phentsize != sizeof(phdr))
+    {
+        return NULL;
+    }
+
+    for (i = 0; !result && i < ehdr.e_phnum; i++)
+    {
+        if (pread(fd, &phdr, sizeof(phdr), ehdr.e_phoff + i * sizeof(phdr)) != sizeof(phdr))
+            break;
+
+        if (phdr.p_type != PT_NOTE || phdr.p_filesz > sizeof(notes))
+            continue;
+
+        if (pread(fd, notes, phdr.p_filesz, phdr.p_offset) != (ssize_t) phdr.p_filesz)
+            break;
+
+        result = note_build_id(notes, phdr.p_filesz, phdr.p_align == 8 ? 8 : 4);
+    }
+
+    return result;
+}
+#endif
+
+/* Whether a string survives a round trip through an ini file line */
+static bool
+cache_value_ok(const char* value)
+{
+    size_t length = value ? strlen(value) : 0;
+
+    return length > 0 &&
+        !isspace((int) value[0]) &&
+        !isspace((int) value[length - 1]) &&
+        !strpbrk(value, "\t\r\n");
+}
+
+static bool
+make_dirs(const char* dir)
+{
+    char* path = strdup(dir);
+    char* slash;
+    bool result = false;
+
+    if (!path)
+        return false;
+
+    for (slash = strchr(path + 1, '/'); ; slash = strchr(slash + 1, '/'))
+    {
+        if (slash)
+            *slash = '\0';
+
+        if (mkdir(path, 0755) < 0 && errno != EEXIST)
+            goto done;
+
+        if (!slash)
+            break;
+
+        *slash = '/';
+    }
+
+    result = true;
+
+done:
+
+    free(path);
+
+    return result;
+}
+
+char*
+cache_default_dir(void)
+{
+    const char* base;
+
+    if ((base = getenv("XDG_CACHE_HOME")) && *base)
+    {
+        return format("%s/moonunit", base);
+    }
+    else if ((base = getenv("HOME")) && *base)
+    {
+        return format("%s/.cache/moonunit", base);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+bool
+cache_key_init(CacheKey* key, const char* loader, const char* path)
+{
+    struct stat st;
+    char* build_id = NULL;
+    int fd = -1;
+
+    key->path = NULL;
+    key->identity = NULL;
+    key->file = NULL;
+
+    if (!(key->path = realpath(path, NULL)) || !cache_value_ok(key->path))
+        goto error;
+
+    if ((fd = open(key->path, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        goto error;
+
+#ifdef HAVE_ELF_H
+    build_id = read_build_id(fd);
+#endif
+
+    key->identity = format("%s %llu %llu %llu %lld.%09ld %s",
+                           loader,
+                           (unsigned long long) st.st_dev,
+                           (unsigned long long) st.st_ino,
+                           (unsigned long long) st.st_size,
+                           (long long) st.st_mtim.tv_sec,
+                           (long) st.st_mtim.tv_nsec,
+                           build_id ? build_id : "-");
+    key->file = format("%s-%lx", loader,
+                       (unsigned long) string_hashfunc(key->path, NULL));
+
+    if (build_id)
+        free(build_id);
+
+    close(fd);
+
+    return key->identity && key->file;
+
+error:
+
+    if (fd >= 0)
+        close(fd);
+
+    cache_key_destroy(key);
+
+    return false;
+}
+
+void
+cache_key_destroy(CacheKey* key)
+{
+    if (key->path)
+        free(key->path);
+    if (key->identity)
+        free(key->identity);
+    if (key->file)
+        free(key->file);
+
+    key->path = key->identity = key->file = NULL;
+}
+
+static void
+cache_parse_cb(const char* section, const char* key, const char* value, void* data)
+{
+    CacheParse* parse = (CacheParse*) data;
+    CacheLibrary* library = parse->library;
+
+    if (parse->stale)
+    {
+        return;
+    }
+    else if (!strcmp(section, "library"))
+    {
+        if (!strcmp(key, "version"))
+            parse->version = !strcmp(value, CACHE_VERSION);
+        else if (!strcmp(key, "path"))
+            parse->path = !strcmp(value, parse->key->path);
+        else if (!strcmp(key, "identity"))
+            parse->identity = !strcmp(value, parse->key->identity);
+        else if (!strcmp(key, "name") && !library->name)
+            library->name = strdup(value);
+    }
+    else if (!strcmp(section, "tests") && !strcmp(key, "test"))
+    {
+        const char* tab = strchr(value, '\t');
+        CacheTest* test;
+
+        if (!tab)
+        {
+            parse->stale = true;
+            return;
+        }
+
+        test = xmalloc(sizeof(*test));
+        test->suite = strndup(value, tab - value);
+        test->name = strdup(tab + 1);
+
+        library->tests = (CacheTest**) array_append((array*) library->tests, test);
+    }
+}
+
+CacheLibrary*
+cache_lookup(const char* dir, CacheKey* key)
+{
+    char* path = format("%s/%s", dir, key->file);
+    FILE* file = fopen(path, "r");
+    CacheParse parse = {0};
+
+    free(path);
+
+    if (!file)
+        return NULL;
+
+    parse.key = key;
+    parse.library = xcalloc(1, sizeof(*parse.library));
+
+    ini_read(file, cache_parse_cb, &parse);
+    fclose(file);
+
+    if (parse.stale || !parse.version || !parse.path ||
+        !parse.identity || !parse.library->name)
+    {
+        cache_library_free(parse.library);
+        return NULL;
+    }
+
+    return parse.library;
+}
+
+void
+cache_store(const char* dir, CacheKey* key, MuLibrary* library, MuTest** tests)
+{
+    const char* name = mu_library_name(library);
+    char* path = NULL;
+    char* temp = NULL;
+    FILE* file = NULL;
+    unsigned int i;
+
+    if (!cache_value_ok(name))
+        goto done;
+
+    for (i = 0; tests && tests[i]; i++)
+    {
+        if (!cache_value_ok(mu_test_suite(tests[i])) ||
+            !cache_value_ok(mu_test_name(tests[i])))
+        {
+            goto done;
+        }
+    }
+
+    if (!make_dirs(dir))
+        goto done;
+
+    path = format("%s/%s", dir, key->file);
+    temp = format("%s.%lu", path, (unsigned long) getpid());
+
+    if (!(file = fopen(temp, "w")))
+        goto done;
+
+    fprintf(file, "[library]\n");
+    fprintf(file, "version=%s\n", CACHE_VERSION);
+    fprintf(file, "path=%s\n", key->path);
+    fprintf(file, "identity=%s\n", key->identity);
+    fprintf(file, "name=%s\n", name);
+    fprintf(file, "[tests]\n");
+
+    for (i = 0; tests && tests[i]; i++)
+    {
+        fprintf(file, "test=%s\t%s\n", mu_test_suite(tests[i]), mu_test_name(tests[i]));
+    }
+
+    /* Readers only ever see complete files */
+    if (fclose(file) || rename(temp, path))
+    {
+        unlink(temp);
+    }
+
+done:
+
+    if (path)
+        free(path);
+    if (temp)
+        free(temp);
+}
+
+void
+cache_library_free(CacheLibrary* library)
+{
+    unsigned int i;
+
+    for (i = 0; i < array_size((array*) library->tests); i++)
+    {
+        CacheTest* test = library->tests[i];
+
+        free(test->suite);
+        free(test->name);
+        free(test);
+    }
+
+    array_free((array*) library->tests);
+
+    if (library->name)
+        free(library->name);
+
+    free(library);
+}
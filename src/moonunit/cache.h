@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2007-2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef __MOONUNIT_CACHE_H__
+#define __MOONUNIT_CACHE_H__
+
+#include <stdbool.h>
+
+#include <moonunit/library.h>
+#include <moonunit/test.h>
+#include <moonunit/private/util.h>
+
+/* Identity of a library file; a cached listing is only used
+   while every field still matches */
+typedef struct CacheKey
+{
+    char* path;
+    char* identity;
+    char* file;
+} CacheKey;
+
+typedef struct CacheTest
+{
+    char* suite;
+    char* name;
+} CacheTest;
+
+typedef struct CacheLibrary
+{
+    char* name;
+    CacheTest** tests;
+} CacheLibrary;
+
+char* cache_default_dir(void);
+bool cache_key_init(CacheKey* key, const char* loader, const char* path);
+void cache_key_destroy(CacheKey* key);
+CacheLibrary* cache_lookup(const char* dir, CacheKey* key);
+void cache_store(const char* dir, CacheKey* key, MuLibrary* library, MuTest** tests);
+void cache_library_free(CacheLibrary* library);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2007-2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Library discovery
+ *
+ * Finding a loader, opening a library and enumerating its tests is
+ * independent for each file, so worker threads claim files in order
+ * and open them while the main thread runs the tests of earlier ones.
+ * Results are consumed strictly in order, keeping logger output the
+ * same as a sequential run.  Workers stay at most a window of files
+ * ahead of the consumer so that large runs do not hold every library
+ * open at once.
+ *
+ * Everything a worker touches is either private to its file or, like
+ * the plugin registry, read-only once initialized.  Matching a test
+ * selection updates its per-library cache, so each worker matches
+ * against a clone of its own.  Library setup, test dispatch and
+ * logging all remain on the main thread.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "discover.h"
+
+#include <moonunit/private/util.h>
+#include <moonunit/library.h>
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Upper bound on worker threads when the count is not given */
+#define MAX_DEFAULT_THREADS 8
+
+typedef struct Slot
+{
+    Discovery discovery;
+    bool done;
+} Slot;
+
+struct Discoverer
+{
+    Slot* slots;
+    unsigned int count;
+    Selection* selection;
+    pthread_t* threads;
+    unsigned int thread_count;
+    unsigned int window;
+    /* Next file to be claimed by a worker */
+    unsigned int claimed;
+    /* Next file to be handed to the consumer */
+    unsigned int consumed;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_cond_t wanted;
+};
+
+static void*
+discover_thread(void* data)
+{
+    Discoverer* discoverer = data;
+    Selection* selection = NULL;
+    unsigned int index;
+
+    if (discoverer->selection)
+        selection = selection_clone(discoverer->selection);
+
+    pthread_mutex_lock(&discoverer->lock);
+
+    for (;;)
+    {
+        while (discoverer->claimed < discoverer->count &&
+               discoverer->claimed >= discoverer->consumed + discoverer->window)
+        {
+            pthread_cond_wait(&discoverer->wanted, &discoverer->lock);
+        }
+
+        if (discoverer->claimed >= discoverer->count)
+            break;
+
+        index = discoverer->claimed++;
+
+        pthread_mutex_unlock(&discoverer->lock);
+
+        run_discover(&discoverer->slots[index].discovery, selection);
+
+        pthread_mutex_lock(&discoverer->lock);
+
+        discoverer->slots[index].done = true;
+        pthread_cond_broadcast(&discoverer->ready);
+    }
+
+    pthread_mutex_unlock(&discoverer->lock);
+
+    selection_free(selection);
+
+    return NULL;
+}
+
+unsigned int
+discoverer_default_threads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1)
+        return 1;
+    else if (cpus > MAX_DEFAULT_THREADS)
+        return MAX_DEFAULT_THREADS;
+    else
+        return (unsigned int) cpus;
+}
+
+Discoverer*
+discoverer_new(char** files, unsigned int count, Selection* selection, unsigned int threads)
+{
+    Discoverer* discoverer = xcalloc(1, sizeof(*discoverer));
+    unsigned int i;
+
+    discoverer->slots = xcalloc(count ? count : 1, sizeof(*discoverer->slots));
+    discoverer->count = count;
+    discoverer->selection = selection;
+
+    for (i = 0; i < count; i++)
+    {
+        discoverer->slots[i].discovery.path = files[i];
+    }
+
+    pthread_mutex_init(&discoverer->lock, NULL);
+    pthread_cond_init(&discoverer->ready, NULL);
+    pthread_cond_init(&discoverer->wanted, NULL);
+
+    /* A single file gains nothing from a worker */
+    if (count < 2)
+        threads = 0;
+    else if (threads > count)
+        threads = count;
+
+    discoverer->window = threads * 2;
+
+    discoverer->threads = xcalloc(threads ? threads : 1, sizeof(pthread_t));
+
+    for (i = 0; i < threads; i++)
+    {
+        if (pthread_create(&discoverer->threads[i], NULL, discover_thread, discoverer))
+            break;
+    }
+
+    /* If no thread could be started, files are opened on demand */
+    discoverer->thread_count = i;
+
+    return discoverer;
+}
+
+Discovery*
+discoverer_next(Discoverer* discoverer)
+{
+    Slot* slot;
+
+    if (discoverer->consumed >= discoverer->count)
+        return NULL;
+
+    slot = &discoverer->slots[discoverer->consumed];
+
+    if (!discoverer->thread_count)
+    {
+        discoverer->consumed++;
+        run_discover(&slot->discovery, discoverer->selection);
+        return &slot->discovery;
+    }
+
+    pthread_mutex_lock(&discoverer->lock);
+
+    while (!slot->done)
+    {
+        pthread_cond_wait(&discoverer->ready, &discoverer->lock);
+    }
+
+    discoverer->consumed++;
+    pthread_cond_broadcast(&discoverer->wanted);
+
+    pthread_mutex_unlock(&discoverer->lock);
+
+    return &slot->discovery;
+}
+
+void
+discoverer_free(Discoverer* discoverer)
+{
+    unsigned int i;
+
+    if (!discoverer)
+        return;
+
+    /* Let workers run out of files rather than wait for a consumer */
+    pthread_mutex_lock(&discoverer->lock);
+    discoverer->window = discoverer->count;
+    pthread_cond_broadcast(&discoverer->wanted);
+    pthread_mutex_unlock(&discoverer->lock);
+
+    for (i = 0; i < discoverer->thread_count; i++)
+    {
+        pthread_join(discoverer->threads[i], NULL);
+    }
+
+    /* Close anything opened ahead that was never run */
+    for (i = discoverer->consumed; i < discoverer->count; i++)
+    {
+        Discovery* discovery = &discoverer->slots[i].discovery;
+
+        if (discovery->library)
+            mu_library_close(discovery->library);
+        if (discovery->err)
+            MU_HANDLE(&discovery->err);
+    }
+
+    pthread_cond_destroy(&discoverer->wanted);
+    pthread_cond_destroy(&discoverer->ready);
+    pthread_mutex_destroy(&discoverer->lock);
+
+    free(discoverer->threads);
+    free(discoverer->slots);
+    free(discoverer);
+}
@@ -41,6 +41,9 @@
 #include "option.h"
 #include "run.h"
 #include "multilog.h"
+#include "cache.h"
+#include "selection.h"
+#include "discover.h"
 
 #define ALIGNMENT 60
 
@@ -143,15 +146,51 @@ plugin_info(const char* name)
     return 0;
 }
 
+/* Apply options common to all loaders before any library is opened */
+static
+void
+configure_loaders(void)
+{
+    MuPlugin** plugins = mu_plugin_list();
+    unsigned int i;
+
+    for (i = 0; plugins && plugins[i]; i++)
+    {
+        MuLoader* loader;
+
+        if (plugins[i]->type != MU_PLUGIN_LOADER ||
+            !(loader = mu_plugin_get_loader_with_name(plugins[i]->name)))
+            continue;
+
+        if (option.timeout && mu_loader_option_type(loader, "timeout") == MU_TYPE_INTEGER)
+        {
+            mu_loader_set_option(loader, "timeout", option.timeout);
+        }
+        
+        if (option.iterations && mu_loader_option_type(loader, "iterations") == MU_TYPE_INTEGER)
+        {
+            mu_loader_set_option(loader, "iterations", option.iterations);
+        }
+        
+        if (option.debug && mu_loader_option_type(loader, "debug") == MU_TYPE_BOOLEAN)
+        {
+            mu_loader_set_option(loader, "debug", option.debug);
+        }
+    }
+}
+
 static
 int
 run(char* self)
 {
     MuError* err = NULL;
-    unsigned int file_index;
     RunSettings settings;
     array* loggers;
     unsigned int failed = 0;
+    Selection* selection = NULL;
+    Discoverer* discoverer = NULL;
+    Discovery* discovery = NULL;
+    unsigned int threads;
 
     if (option_process_resources(&option))
     {
@@ -187,52 +226,50 @@ run(char* self)
         settings.logger = create_multilogger(loggers);
     }
 
-    mu_logger_enter(settings.logger);
-
-    for (file_index = 0; file_index < array_size(option.files); file_index++)
+    if (!option.all && array_size(option.tests))
     {
-        char* file = option.files[file_index];
+        selection = selection_new(array_size(option.tests), (char**) option.tests);
+    }
 
-        settings.loader = mu_plugin_get_loader_for_file(file);
+    configure_loaders();
 
-        if (!settings.loader)
-        {
-            die("Error: Could not find loader for file %s", basename_pure(file));
-        }
+    /* Libraries are opened in the background, except when debugging
+       where everything should happen in plain sight */
+    if (option.debug)
+        threads = 0;
+    else if (option.load_threads >= 0)
+        threads = option.load_threads;
+    else
+        threads = discoverer_default_threads();
 
-        if (option.timeout && mu_loader_option_type(settings.loader, "timeout") == MU_TYPE_INTEGER)
-        {
-            mu_loader_set_option(settings.loader, "timeout", option.timeout);
-        }
-        
-        if (option.iterations && mu_loader_option_type(settings.loader, "iterations") == MU_TYPE_INTEGER)
-        {
-            mu_loader_set_option(settings.loader, "iterations", option.iterations);
-        }
-        
-        if (option.debug && mu_loader_option_type(settings.loader, "debug") == MU_TYPE_BOOLEAN)
-        {
-            mu_loader_set_option(settings.loader, "debug", option.debug);
-        }
+    discoverer = discoverer_new((char**) option.files, array_size(option.files), selection, threads);
 
-        if (option.all || array_size(option.tests) == 0)
-        {
-            failed += run_all(&settings, file, &err);
-        }
-        else
+    mu_logger_enter(settings.logger);
+
+    while ((discovery = discoverer_next(discoverer)))
+    {
+        if (!discovery->loader)
         {
-            failed += run_tests(&settings, file, array_size(option.tests), (char**) option.tests, &err);
+            die("Error: Could not find loader for file %s", basename_pure(discovery->path));
         }
 
+        settings.loader = discovery->loader;
+
+        failed += run_discovered(&settings, discovery, selection, &err);
+
         MU_CATCH_ALL(err)
         {
             die("Error: %s", err->message);
         }
     }
 
+    discoverer_free(discoverer);
+
     mu_logger_leave(settings.logger);
     mu_logger_destroy(settings.logger);
 
+    selection_free(selection);
+
     option_release(&option);
 
     if (failed > 255)
@@ -248,9 +285,25 @@ list_tests(void)
     MuError* err = NULL;
     unsigned int file_index;
     MuLoader* loader = NULL;
+    Selection* selection = NULL;
 
     option_configure_loaders(&option);
 
+    if (array_size(option.tests))
+    {
+        selection = selection_new(array_size(option.tests), (char**) option.tests);
+    }
+
+    if (option.no_cache && option.cache_dir)
+    {
+        free(option.cache_dir);
+        option.cache_dir = NULL;
+    }
+    else if (!option.no_cache && !option.cache_dir)
+    {
+        option.cache_dir = cache_default_dir();
+    }
+
     for (file_index = 0; file_index < array_size(option.files); file_index++)
     {
         char* file = option.files[file_index];
@@ -261,13 +314,15 @@ list_tests(void)
             die("Error: Could not find loader for file %s", basename_pure(file));
         }
 
-        print_tests(loader, file, array_size(option.tests), (char**) option.tests, &err);
+        print_tests(loader, file, option.cache_dir, selection, &err);
         MU_CATCH_ALL(err)
         {
             die("Error: %s", err->message);
         }
     }
 
+    selection_free(selection);
+
     return 0;
 }
 
@@ -56,6 +56,9 @@ enum
     OPTION_PLUGIN_INFO,
     OPTION_RESOURCE,
     OPTION_LIST_TESTS,
+    OPTION_CACHE_DIR,
+    OPTION_NO_CACHE,
+    OPTION_LOAD_THREADS,
     OPTION_USAGE,
     OPTION_HELP
 };
@@ -83,7 +86,7 @@ static const struct UpoptOptionInfo options[] =
         .shortname = 't',
         .argument = "library/suite/name",
         .constant = OPTION_TEST,
-        .description = "Run a specific test or subset of tests (glob allowed)",
+        .description = "Run a specific test or subset of tests (glob allowed, ! excludes)",
     },
     {
         .longname = "all",
@@ -134,6 +137,27 @@ static const struct UpoptOptionInfo options[] =
         .description = "List tests instead of running them",
         .argument = NULL
     },
+    {
+        .longname = "cache-dir",
+        .shortname = '\0',
+        .constant = OPTION_CACHE_DIR,
+        .description = "Cache test listings in dir (default: ~/.cache/moonunit)",
+        .argument = "dir"
+    },
+    {
+        .longname = "no-cache",
+        .shortname = '\0',
+        .constant = OPTION_NO_CACHE,
+        .description = "Always load libraries to list their tests",
+        .argument = NULL
+    },
+    {
+        .longname = "load-threads",
+        .shortname = '\0',
+        .constant = OPTION_LOAD_THREADS,
+        .description = "Open libraries on count threads while tests run (default: one per CPU, up to 8)",
+        .argument = "count"
+    },
     {
         .longname = "list-plugins",
         .shortname = '\0',
@@ -187,6 +211,7 @@ option_parse(int argc, char** argv, OptionTable* option)
 
     option->iterations = 0;
     option->timeout = 0;
+    option->load_threads = -1;
     option->mode = MODE_RUN;
 
     while ((rc = upopt_next(context, &constant, &value, &option->errormsg)) != UPOPT_STATUS_DONE)
@@ -225,6 +250,15 @@ option_parse(int argc, char** argv, OptionTable* option)
         case OPTION_LIST_TESTS:
             option->mode = MODE_LIST_TESTS;
             break;
+        case OPTION_CACHE_DIR:
+            option->cache_dir = strdup(value);
+            break;
+        case OPTION_NO_CACHE:
+            option->no_cache = true;
+            break;
+        case OPTION_LOAD_THREADS:
+            option->load_threads = atoi(value);
+            break;
         case OPTION_LIST_PLUGINS:
             option->mode = MODE_LIST_PLUGINS;
             break;
@@ -456,4 +490,7 @@ option_release(OptionTable* option)
         free(option->loader_options[i]);
 
     array_free(option->loader_options);
+
+    if (option->cache_dir)
+        free(option->cache_dir);
 }
@@ -48,6 +48,9 @@ typedef struct
     unsigned int iterations;
     long timeout;
     char* logger;
+    char* cache_dir;
+    bool no_cache;
+    int load_threads;
     array* tests, *files, *loggers, *resources;
     array* loader_options;
     const char* plugin_info;
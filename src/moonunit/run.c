@@ -30,68 +30,105 @@
 #endif
 
 #include "run.h"
+#include "cache.h"
 
 #include <moonunit/private/util.h>
 #include <moonunit/library.h>
+#include <moonunit/plugin.h>
 #include <moonunit/error.h>
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
 
-static int
-test_compare(const void* _a, const void* _b)
+typedef struct TestKey
 {
-	MuTest* a = *(MuTest**) _a;
-	MuTest* b = *(MuTest**) _b;
-	int result;
-	
-	if ((result = strcmp(mu_test_suite(a), mu_test_suite(b))))
-		return result;
-	else
-	    return strcmp(mu_test_name(a), mu_test_name(b));
-}
+    const char* suite;
+    const char* name;
+    MuTest* test;
+} TestKey;
 
-static unsigned int
-test_count(MuTest** tests)
+static int
+key_compare(const void* _a, const void* _b)
 {
-	unsigned int result;
-	
-	for (result = 0; tests[result]; result++);
-	
-	return result;
+    const TestKey* a = _a;
+    const TestKey* b = _b;
+    int result;
+
+    if ((result = strcmp(a->suite, b->suite)))
+        return result;
+    else
+        return strcmp(a->name, b->name);
 }
 
-static bool
-in_set(MuTest* test, int setc, char** set)
+/*
+ * Return tests ordered by suite and name.  Loaders that keep their
+ * tests sorted get the list back untouched after a linear check;
+ * otherwise a sorted copy is made which the caller must free.  Each
+ * suite and name is fetched from the loader once rather than on
+ * every comparison.
+ */
+static MuTest**
+sorted_tests(MuTest** tests)
 {
+    const char* last_suite = NULL;
+    const char* last_name = NULL;
+    unsigned int count;
     unsigned int i;
-    const char* test_name = mu_test_name(test);
-    const char* suite_name = mu_test_suite(test);
-    const char* library_name = mu_library_name(test->library);
-    char* test_path = format("%s/%s/%s", library_name, suite_name, test_name);
-    bool result;
+    bool sorted = true;
+    TestKey* keys = NULL;
+    MuTest** result = NULL;
 
-    for (i = 0; i < setc; i++)
+    for (count = 0; tests[count]; count++)
     {
-        if (match_path(test_path, set[i]))
+        const char* suite = mu_test_suite(tests[count]);
+        const char* name = mu_test_name(tests[count]);
+
+        if (sorted && last_suite)
         {
-            result = true;
-            goto done;
+            int cmp = strcmp(last_suite, suite);
+
+            if (cmp > 0 || (cmp == 0 && strcmp(last_name, name) > 0))
+                sorted = false;
         }
+
+        last_suite = suite;
+        last_name = name;
     }
 
-    result = false;
+    if (sorted)
+        return tests;
 
-done:
+    keys = xmalloc(count * sizeof(*keys));
 
-    if (test_path)
+    for (i = 0; i < count; i++)
     {
-        free(test_path);
+        keys[i].suite = mu_test_suite(tests[i]);
+        keys[i].name = mu_test_name(tests[i]);
+        keys[i].test = tests[i];
     }
 
+    qsort(keys, count, sizeof(*keys), key_compare);
+
+    result = xmalloc((count + 1) * sizeof(*result));
+
+    for (i = 0; i < count; i++)
+        result[i] = keys[i].test;
+
+    result[count] = NULL;
+
+    free(keys);
+
     return result;
 }
 
+static bool
+in_set(MuTest* test, Selection* selection)
+{
+    return selection_match(selection, mu_library_name(test->library),
+                           mu_test_suite(test), mu_test_name(test));
+}
+
 static void
 event_proxy_cb(MuLogEvent const* event, void* data)
 {
@@ -100,21 +137,159 @@ event_proxy_cb(MuLogEvent const* event, void* data)
     mu_logger_test_log(logger, event);
 }
 
-unsigned int
-run_tests(RunSettings* settings, const char* path, int setc, char** set, MuError** _err)
+/*
+ * Check whether any selected test is in a library without loading it.
+ * When nothing is selected the probed library is kept in *probed so
+ * it can still be logged; otherwise it is closed.  Probe failures
+ * count as a match so the full load can report them.
+ */
+static bool
+probe_selects(MuLoader* loader, const char* path, Selection* selection, MuLibrary** probed)
 {
     MuError* err = NULL;
+    MuLibrary* library = mu_loader_probe(loader, path, &err);
+    MuTest** tests = NULL;
+    bool result = false;
+    unsigned int index;
+
+    if (!library)
+    {
+        MU_HANDLE(&err);
+        return true;
+    }
+
+    tests = mu_library_get_tests(library);
+
+    for (index = 0; tests && tests[index] && !result; index++)
+    {
+        result = in_set(tests[index], selection);
+    }
+
+    if (tests)
+        mu_library_free_tests(library, tests);
+
+    if (result)
+        mu_library_close(library);
+    else
+        *probed = library;
+
+    return result;
+}
+
+/*
+ * Run the selected tests in order.  Loaders that can start tests
+ * without waiting for them get as many started ahead as they will
+ * take, but each test is still logged from enter to leave before
+ * the next one.
+ */
+static unsigned int
+run_ordered(MuLogger* logger, MuLoader* loader, MuTest** order, Selection* selection)
+{
+    unsigned int failed = 0;
+    unsigned int count;
+    unsigned int index;
+    unsigned int next = 0;
+    const char* current_suite = NULL;
+    MuLogLevel max_level = mu_logger_max_log_level(logger);
+    void** started = NULL;
+
+    for (count = 0; order[count]; count++);
+
+    if (loader->start && loader->finish)
+        started = xcalloc(count, sizeof(*started));
+
+    for (index = 0; index < count; index++)
+    {
+        MuTestResult* summary = NULL;
+        MuTest* test = order[index];
+
+        if (selection && !in_set(test, selection))
+            continue;
+
+        if (started)
+        {
+            if (next < index)
+                next = index;
+
+            for (; next < count; next++)
+            {
+                if (selection && !in_set(order[next], selection))
+                    continue;
+
+                if (!(started[next] = loader->start(loader, order[next], max_level)))
+                    break;
+            }
+        }
+
+        if (current_suite == NULL || strcmp(current_suite, mu_test_suite(test)))
+        {
+            if (current_suite)
+                mu_logger_suite_leave(logger);
+            current_suite = mu_test_suite(test);
+            mu_logger_suite_enter(logger, mu_test_suite(test));
+        }
+
+        mu_logger_test_enter(logger, test);
+        if (started && started[index])
+            summary = loader->finish(loader, started[index], event_proxy_cb, logger);
+        else
+            summary = loader->dispatch(loader, test, event_proxy_cb, logger, max_level);
+        mu_logger_test_leave(logger, test, summary);
+
+        if (summary->status != MU_STATUS_SKIPPED &&
+                summary->status != summary->expected)
+            failed++;
+
+        loader->free_result(loader, summary);
+    }
+
+    if (current_suite)
+        mu_logger_suite_leave(logger);
+
+    if (started)
+        free(started);
+
+    return failed;
+}
+
+void
+run_discover(Discovery* discovery, Selection* selection)
+{
+    const char* path = discovery->path;
+    MuLoader* loader = discovery->loader;
+
+    if (!loader && !(loader = discovery->loader = mu_plugin_get_loader_for_file(path)))
+        return;
+
+    /* With a narrow selection, avoid loading libraries with nothing to run */
+    if (selection && loader->probe && !probe_selects(loader, path, selection, &discovery->library))
+    {
+        discovery->skip = true;
+        return;
+    }
+
+    discovery->library = mu_loader_open(loader, path, &discovery->err);
+}
+
+unsigned int
+run_discovered(RunSettings* settings, Discovery* discovery, Selection* selection, MuError** _err)
+{
+    MuError* err = discovery->err;
     unsigned int failed = 0;
     MuLogger* logger = settings->logger;
-    MuLoader* loader = settings->loader;
-    MuLibrary* library = NULL;
+    MuLoader* loader = discovery->loader;
+    MuLibrary* library = discovery->library;
     MuTest** tests = NULL;
-
-    library = mu_loader_open(loader, path, &err);
+    MuTest** order = NULL;
 
     /* Even if library loading failed, log that
        we attempted to visit it */
-    mu_logger_library_enter(logger, path, library); 
+    mu_logger_library_enter(logger, discovery->path, library); 
+
+    if (discovery->skip)
+    {
+        goto leave;
+    }
 
     MU_CATCH(err, MU_ERROR_LOAD_LIBRARY)
     {
@@ -143,41 +318,8 @@ run_tests(RunSettings* settings, const char* path, int setc, char** set, MuError
     
     if (tests)
     {
-        qsort(tests, test_count(tests), sizeof(*tests), test_compare);
-        
-        unsigned int index;
-        const char* current_suite = NULL;
-        
-        for (index = 0; tests[index]; index++)
-        {
-            MuTestResult* summary = NULL;
-            MuTest* test = tests[index];
-
-            if (set != NULL && !in_set(test, setc, set))
-                continue;
-            
-            if (current_suite == NULL || strcmp(current_suite, mu_test_suite(test)))
-            {
-                if (current_suite)
-                    mu_logger_suite_leave(logger);
-                current_suite = mu_test_suite(test);
-                mu_logger_suite_enter(logger, mu_test_suite(test));
-            }
-            
-            mu_logger_test_enter(logger, test);
-            summary = loader->dispatch(loader, test, event_proxy_cb, logger,
-                                       mu_logger_max_log_level(logger));
-            mu_logger_test_leave(logger, test, summary);
-
-            if (summary->status != MU_STATUS_SKIPPED &&
-                    summary->status != summary->expected)
-                failed++;
-
-            loader->free_result(loader, summary);
-        }
-        
-        if (current_suite)
-            mu_logger_suite_leave(logger);
+        order = sorted_tests(tests);
+        failed += run_ordered(logger, loader, order, selection);
     }
 
     mu_library_destruct(library, &err);
@@ -199,6 +341,9 @@ leave:
     mu_logger_library_leave(logger);
     
 error:
+    if (order && order != tests)
+        free(order);
+
     if (tests)
         mu_library_free_tests(library, tests);
    
@@ -208,43 +353,108 @@ error:
     return failed;
 }
 
+unsigned int
+run_tests(RunSettings* settings, const char* path, Selection* selection, MuError** _err)
+{
+    Discovery discovery = {0};
+
+    discovery.path = path;
+    discovery.loader = settings->loader;
+
+    run_discover(&discovery, selection);
+
+    return run_discovered(settings, &discovery, selection, _err);
+}
+
 unsigned int
 run_all(RunSettings* settings, const char* path, MuError** _err)
 {
-    return run_tests(settings, path, 0, NULL, _err);
+    return run_tests(settings, path, NULL, _err);
+}
+
+static bool
+print_cached_tests(const char* cache_dir, CacheKey* key, Selection* selection)
+{
+    CacheLibrary* cached = cache_lookup(cache_dir, key);
+    unsigned int index;
+
+    if (!cached)
+        return false;
+
+    /* Entries were stored in sorted order */
+    for (index = 0; index < array_size((array*) cached->tests); index++)
+    {
+        CacheTest* test = cached->tests[index];
+
+        if (selection && !selection_match(selection, cached->name, test->suite, test->name))
+            continue;
+
+        printf("%s/%s/%s\n", cached->name, test->suite, test->name);
+    }
+
+    cache_library_free(cached);
+
+    return true;
 }
 
 void
-print_tests(MuLoader* loader, const char* path, int setc, char** set, MuError** _err)
+print_tests(MuLoader* loader, const char* path, const char* cache_dir,
+            Selection* selection, MuError** _err)
 {
     MuError* err = NULL;
     MuLibrary* library = NULL;
     MuTest** tests = NULL;
+    MuTest** order = NULL;
+    CacheKey key;
+    bool cacheable = false;
+
+    /* The key is taken before loading so a library replaced
+       in the meantime is never cached under its old identity */
+    if (cache_dir && (cacheable = cache_key_init(&key, loader->plugin->name, path)) &&
+        print_cached_tests(cache_dir, &key, selection))
+    {
+        goto leave;
+    }
 
-    library = mu_loader_open(loader, path, &err);
+    library = mu_loader_probe(loader, path, &err);
     MU_PROPAGATE(leave, _err, err);
 
     tests = mu_library_get_tests(library);
 
     if (tests)
     {
-        qsort(tests, test_count(tests), sizeof(*tests), test_compare);
+        order = sorted_tests(tests);
 
         unsigned int index;
 
-        for (index = 0; tests[index]; index++)
+        for (index = 0; order[index]; index++)
         {
-            MuTest* test = tests[index];
+            MuTest* test = order[index];
 
-            if (set != NULL && !in_set(test, setc, set))
+            if (selection && !in_set(test, selection))
                 continue;
 
             printf("%s/%s/%s\n", mu_library_name(library), mu_test_suite(test), mu_test_name(test));
         }
     }
 
+    if (cacheable)
+    {
+        cache_store(cache_dir, &key, library, order);
+    }
+
 leave:
 
+    if (cacheable)
+    {
+        cache_key_destroy(&key);
+    }
+
+    if (order && order != tests)
+    {
+        free(order);
+    }
+
     if (tests)
     {
         mu_library_free_tests(library, tests);
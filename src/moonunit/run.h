@@ -30,6 +30,10 @@
 
 #include <moonunit/logger.h>
 #include <moonunit/loader.h>
+#include <moonunit/library.h>
+#include <moonunit/error.h>
+
+#include "selection.h"
 
 typedef struct
 {
@@ -38,8 +42,23 @@ typedef struct
     MuLogger* logger;
 } RunSettings;
 
-unsigned int run_tests(RunSettings* settings, const char* path, int setc, char** set, MuError** _err);
+/* A library found and opened ahead of running its tests */
+typedef struct
+{
+    const char* path;
+    MuLoader* loader;
+    MuLibrary* library;
+    MuError* err;
+    /* Nothing is selected, so the library was only probed */
+    bool skip;
+} Discovery;
+
+void run_discover(Discovery* discovery, Selection* selection);
+unsigned int run_discovered(RunSettings* settings, Discovery* discovery, Selection* selection, MuError** _err);
+
+unsigned int run_tests(RunSettings* settings, const char* path, Selection* selection, MuError** _err);
 unsigned int run_all(RunSettings* settings, const char* path, MuError** _err);
-void print_tests(MuLoader* loader, const char* path, int setc, char** set, MuError** _err);
+void print_tests(MuLoader* loader, const char* path, const char* cache_dir,
+                 Selection* selection, MuError** _err);
 
 #endif
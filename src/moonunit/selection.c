@@ -0,0 +1,644 @@
+/*
+ * Copyright (c) 2007-2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Test selection
+ *
+ * Each --test pattern is split into its library, suite and name
+ * components, which are matched separately; with FNM_PATHNAME
+ * semantics no wildcard can cross a slash anyway.  Tests arrive
+ * grouped by library and suite, so the patterns whose first two
+ * components match are worked out once per group.  Within a group,
+ * literal test names are found by hashing and only wildcard names
+ * are matched one by one, against globs compiled to token arrays.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "selection.h"
+
+#include <moonunit/private/util.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define COMPONENTS 3
+
+typedef enum GlobTokenType
+{
+    GLOB_CHAR,
+    GLOB_ANY,
+    GLOB_STAR,
+    GLOB_CLASS
+} GlobTokenType;
+
+typedef struct GlobToken
+{
+    GlobTokenType type;
+    unsigned char c;
+    /* Bitmap of accepted bytes for GLOB_CLASS */
+    unsigned char set[32];
+} GlobToken;
+
+typedef struct SelectGlob
+{
+    /* Component without wildcards, with escapes removed */
+    char* literal;
+    /* Whether the component is a lone '*' */
+    bool any;
+    /* Malformed components, like fnmatch errors, match nothing */
+    bool invalid;
+    GlobToken* tokens;
+    unsigned int count;
+} SelectGlob;
+
+typedef struct SelectPattern
+{
+    bool negative;
+    /* Whether the library and suite of the current group match */
+    bool active;
+    SelectGlob parts[COMPONENTS];
+} SelectPattern;
+
+/* Patterns sharing a literal test name */
+typedef struct SelectName
+{
+    SelectPattern** patterns;
+} SelectName;
+
+struct Selection
+{
+    char** raw;
+    SelectPattern** patterns;
+    bool positive;
+    /* Literal test name -> SelectName */
+    hashtable* names;
+    char* library;
+    char* suite;
+    /* Patterns matching the current library */
+    SelectPattern** library_patterns;
+    /* Active patterns with a wildcard test name */
+    SelectPattern** name_globs;
+};
+
+static const struct
+{
+    const char* name;
+    int (*test)(int c);
+} glob_classes[] =
+{
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+    {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+    {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+    {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    {NULL, NULL}
+};
+
+static void
+set_add(unsigned char* set, unsigned char c)
+{
+    set[c / 8] |= 1 << (c % 8);
+}
+
+static bool
+set_has(const unsigned char* set, unsigned char c)
+{
+    return set[c / 8] & (1 << (c % 8));
+}
+
+/*
+ * Parse a bracket expression starting after the '[' at text[*index].
+ * Returns false if it is not terminated, in which case the '[' is
+ * an ordinary character as far as fnmatch is concerned.
+ */
+static bool
+compile_class(const char* text, size_t length, size_t* index, GlobToken* token)
+{
+    size_t i = *index + 1;
+    bool negate = false;
+    bool first = true;
+    unsigned int c;
+
+    memset(token->set, 0, sizeof(token->set));
+
+    if (i < length && (text[i] == '!' || text[i] == '^'))
+    {
+        negate = true;
+        i++;
+    }
+
+    for (; i < length; first = false)
+    {
+        unsigned char low, high;
+
+        if (text[i] == ']' && !first)
+        {
+            break;
+        }
+        else if (text[i] == '[' && i + 1 < length && text[i + 1] == ':')
+        {
+            const char* end = memchr(text + i + 2, ':', length - i - 2);
+            unsigned int k;
+
+            if (end && end + 1 < text + length && end[1] == ']')
+            {
+                for (k = 0; glob_classes[k].name; k++)
+                {
+                    if (strlen(glob_classes[k].name) == (size_t) (end - text - i - 2) &&
+                        !strncmp(glob_classes[k].name, text + i + 2, end - text - i - 2))
+                    {
+                        for (c = 0; c < 256; c++)
+                        {
+                            if (glob_classes[k].test(c))
+                                set_add(token->set, c);
+                        }
+                        break;
+                    }
+                }
+
+                i = end - text + 2;
+                continue;
+            }
+        }
+
+        if (text[i] == '\\' && i + 1 < length)
+            i++;
+
+        low = high = text[i++];
+
+        if (i + 1 < length && text[i] == '-' && text[i + 1] != ']')
+        {
+            i++;
+            if (text[i] == '\\' && i + 1 < length)
+                i++;
+            high = text[i++];
+        }
+
+        for (c = low; c <= high; c++)
+        {
+            set_add(token->set, c);
+        }
+    }
+
+    if (i >= length)
+        return false;
+
+    if (negate)
+    {
+        for (c = 0; c < sizeof(token->set); c++)
+        {
+            token->set[c] = ~token->set[c];
+        }
+    }
+
+    token->type = GLOB_CLASS;
+    *index = i + 1;
+
+    return true;
+}
+
+static void
+compile_glob(const char* text, size_t length, SelectGlob* glob)
+{
+    size_t i = 0;
+    bool literal = true;
+
+    glob->tokens = xmalloc((length + 1) * sizeof(GlobToken));
+    glob->count = 0;
+    glob->invalid = false;
+
+    while (i < length)
+    {
+        GlobToken* token = &glob->tokens[glob->count];
+
+        switch (text[i])
+        {
+        case '*':
+            literal = false;
+            i++;
+            /* Consecutive stars match the same as one */
+            if (glob->count && glob->tokens[glob->count - 1].type == GLOB_STAR)
+                continue;
+            token->type = GLOB_STAR;
+            break;
+        case '?':
+            literal = false;
+            token->type = GLOB_ANY;
+            i++;
+            break;
+        case '[':
+            if (compile_class(text, length, &i, token))
+            {
+                literal = false;
+                break;
+            }
+            token->type = GLOB_CHAR;
+            token->c = text[i++];
+            break;
+        case '\\':
+            if (i + 1 == length)
+                glob->invalid = true;
+            else
+                i++;
+            /* Fall through */
+        default:
+            token->type = GLOB_CHAR;
+            token->c = text[i++];
+            break;
+        }
+
+        glob->count++;
+    }
+
+    glob->any = glob->count == 1 && glob->tokens[0].type == GLOB_STAR;
+    glob->literal = NULL;
+
+    if (literal && !glob->invalid)
+    {
+        unsigned int k;
+
+        glob->literal = xmalloc(glob->count + 1);
+
+        for (k = 0; k < glob->count; k++)
+        {
+            glob->literal[k] = glob->tokens[k].c;
+        }
+
+        glob->literal[glob->count] = '\0';
+    }
+}
+
+static bool
+token_match(const GlobToken* token, unsigned char c)
+{
+    switch (token->type)
+    {
+    case GLOB_CHAR:
+        return token->c == c;
+    case GLOB_ANY:
+        return true;
+    case GLOB_CLASS:
+        return set_has(token->set, c);
+    default:
+        return false;
+    }
+}
+
+static bool
+glob_match(const SelectGlob* glob, const char* text)
+{
+    const GlobToken* tokens = glob->tokens;
+    unsigned int count = glob->count;
+    unsigned int t = 0;
+    unsigned int star = count;
+    const char* mark = NULL;
+
+    if (glob->invalid)
+        return false;
+    else if (glob->literal)
+        return !strcmp(glob->literal, text);
+    else if (glob->any)
+        return true;
+
+    /* Only the most recent star needs to be retried, since any
+       earlier one can absorb whatever a later one could */
+    while (*text)
+    {
+        if (t < count && tokens[t].type == GLOB_STAR)
+        {
+            star = t++;
+            mark = text;
+        }
+        else if (t < count && token_match(&tokens[t], *text))
+        {
+            t++;
+            text++;
+        }
+        else if (star < count)
+        {
+            t = star + 1;
+            text = ++mark;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (t < count && tokens[t].type == GLOB_STAR)
+        t++;
+
+    return t == count;
+}
+
+static SelectPattern*
+compile_pattern(const char* text)
+{
+    SelectPattern* pattern = xcalloc(1, sizeof(*pattern));
+    const char* start;
+    const char* end;
+    unsigned int part = 0;
+
+    if (*text == '!')
+    {
+        pattern->negative = true;
+        text++;
+    }
+
+    for (start = end = text; ; end++)
+    {
+        /* An escaped slash still separates components */
+        bool escaped = *end == '\\' && end[1] == '/';
+
+        if (*end == '\\' && end[1] && !escaped)
+        {
+            end++;
+        }
+        else if (*end == '/' || *end == '\0' || escaped)
+        {
+            /* A pattern with a different number of components can
+               never match a library/suite/name path */
+            if (part == COMPONENTS)
+                goto error;
+
+            compile_glob(start, end - start, &pattern->parts[part++]);
+
+            if (*end == '\0')
+                break;
+
+            if (escaped)
+                end++;
+
+            start = end + 1;
+        }
+    }
+
+    if (part != COMPONENTS)
+        goto error;
+
+    return pattern;
+
+error:
+
+    while (part--)
+    {
+        if (pattern->parts[part].literal)
+            free(pattern->parts[part].literal);
+        free(pattern->parts[part].tokens);
+    }
+
+    free(pattern);
+
+    return NULL;
+}
+
+static void
+names_free(void* key, void* value, void* unused)
+{
+    SelectName* entry = (SelectName*) value;
+
+    array_free((array*) entry->patterns);
+    free(entry);
+}
+
+Selection*
+selection_new(int patternc, char** patterns)
+{
+    Selection* selection = xcalloc(1, sizeof(*selection));
+    int i;
+
+    selection->names = hashtable_new(patternc * 2 + 1, string_hashfunc, string_hashequal, names_free, NULL);
+
+    for (i = 0; i < patternc; i++)
+    {
+        SelectPattern* pattern;
+        char* name;
+
+        selection->raw = (char**) array_append((array*) selection->raw, patterns[i]);
+
+        if (patterns[i][0] != '!')
+            selection->positive = true;
+
+        if (!(pattern = compile_pattern(patterns[i])))
+            continue;
+
+        selection->patterns = (SelectPattern**) array_append((array*) selection->patterns, pattern);
+
+        if ((name = pattern->parts[COMPONENTS - 1].literal))
+        {
+            SelectName* entry = hashtable_get(selection->names, name);
+
+            if (!entry)
+            {
+                entry = xcalloc(1, sizeof(*entry));
+                hashtable_set(selection->names, (void*) name, entry);
+            }
+
+            entry->patterns = (SelectPattern**) array_append((array*) entry->patterns, pattern);
+        }
+    }
+
+    return selection;
+}
+
+Selection*
+selection_clone(Selection* selection)
+{
+    return selection_new(array_size((array*) selection->raw), selection->raw);
+}
+
+/* Names containing slashes cannot be split, so match them whole */
+static bool
+selection_match_path(Selection* selection, const char* library, const char* suite, const char* name)
+{
+    char* path = format("%s/%s/%s", library, suite, name);
+    bool selected = !selection->positive;
+    bool excluded = false;
+    unsigned int i;
+
+    for (i = 0; i < array_size((array*) selection->raw); i++)
+    {
+        const char* pattern = selection->raw[i];
+
+        if (pattern[0] == '!')
+            excluded = excluded || match_path(path, pattern + 1);
+        else
+            selected = selected || match_path(path, pattern);
+    }
+
+    free(path);
+
+    return selected && !excluded;
+}
+
+/* Work out which patterns apply to a library and suite */
+static void
+selection_enter(Selection* selection, const char* library, const char* suite)
+{
+    unsigned int i;
+
+    if (!selection->library || strcmp(selection->library, library))
+    {
+        for (i = 0; i < array_size((array*) selection->library_patterns); i++)
+        {
+            selection->library_patterns[i]->active = false;
+        }
+
+        array_free((array*) selection->library_patterns);
+        selection->library_patterns = NULL;
+
+        for (i = 0; i < array_size((array*) selection->patterns); i++)
+        {
+            SelectPattern* pattern = selection->patterns[i];
+
+            if (glob_match(&pattern->parts[0], library))
+            {
+                selection->library_patterns = (SelectPattern**)
+                    array_append((array*) selection->library_patterns, pattern);
+            }
+        }
+
+        if (selection->library)
+            free(selection->library);
+        if (selection->suite)
+            free(selection->suite);
+
+        selection->library = strdup(library);
+        selection->suite = NULL;
+    }
+
+    if (!selection->suite || strcmp(selection->suite, suite))
+    {
+        array_free((array*) selection->name_globs);
+        selection->name_globs = NULL;
+
+        for (i = 0; i < array_size((array*) selection->library_patterns); i++)
+        {
+            SelectPattern* pattern = selection->library_patterns[i];
+
+            pattern->active = glob_match(&pattern->parts[1], suite);
+
+            if (pattern->active && !pattern->parts[2].literal)
+            {
+                selection->name_globs = (SelectPattern**)
+                    array_append((array*) selection->name_globs, pattern);
+            }
+        }
+
+        if (selection->suite)
+            free(selection->suite);
+
+        selection->suite = strdup(suite);
+    }
+}
+
+bool
+selection_match(Selection* selection, const char* library, const char* suite, const char* name)
+{
+    SelectName* entry;
+    SelectPattern** literals;
+    bool selected = !selection->positive;
+    bool excluded = false;
+    unsigned int i;
+
+    if (strchr(library, '/') || strchr(suite, '/') || strchr(name, '/'))
+        return selection_match_path(selection, library, suite, name);
+
+    selection_enter(selection, library, suite);
+
+    entry = hashtable_get(selection->names, name);
+    literals = entry ? entry->patterns : NULL;
+
+    for (i = 0; i < array_size((array*) literals) && !excluded; i++)
+    {
+        if (!literals[i]->active)
+            continue;
+        else if (literals[i]->negative)
+            excluded = true;
+        else
+            selected = true;
+    }
+
+    for (i = 0; i < array_size((array*) selection->name_globs) && !excluded; i++)
+    {
+        SelectPattern* pattern = selection->name_globs[i];
+
+        /* Skip patterns that cannot change the outcome */
+        if (!pattern->negative && selected)
+            continue;
+
+        if (glob_match(&pattern->parts[2], name))
+        {
+            if (pattern->negative)
+                excluded = true;
+            else
+                selected = true;
+        }
+    }
+
+    return selected && !excluded;
+}
+
+void
+selection_free(Selection* selection)
+{
+    unsigned int i, part;
+
+    if (!selection)
+        return;
+
+    for (i = 0; i < array_size((array*) selection->patterns); i++)
+    {
+        SelectPattern* pattern = selection->patterns[i];
+
+        for (part = 0; part < COMPONENTS; part++)
+        {
+            if (pattern->parts[part].literal)
+                free(pattern->parts[part].literal);
+            free(pattern->parts[part].tokens);
+        }
+
+        free(pattern);
+    }
+
+    hashtable_free(selection->names);
+    array_free((array*) selection->patterns);
+    array_free((array*) selection->raw);
+    array_free((array*) selection->library_patterns);
+    array_free((array*) selection->name_globs);
+
+    if (selection->library)
+        free(selection->library);
+    if (selection->suite)
+        free(selection->suite);
+
+    free(selection);
+}
@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2007-2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Test loading stub generator
+ *
+ * Each source is run through the preprocessor and its output is
+ * tokenized in a single pass, collecting identifiers that name test
+ * entries.  Sources are preprocessed concurrently, one per worker
+ * thread.  The stub is compared with any existing output and only
+ * rewritten when it differs, so an unchanged set of entries does not
+ * make everything built from it out of date.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <moonunit/private/util.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define ENTRY_PREFIX "__mu_e_"
+#define READ_SIZE (64 * 1024)
+
+#define die(fmt, ...)                               \
+    do {                                            \
+        fprintf(stderr, fmt "\n", ## __VA_ARGS__);  \
+        exit(1);                                    \
+    } while (0);                                    \
+
+typedef struct Source
+{
+    const char* path;
+    /* Entry names found in the source, possibly repeated */
+    char** entries;
+    bool failed;
+} Source;
+
+typedef struct Scan
+{
+    Source* sources;
+    unsigned int count;
+    unsigned int next;
+    pthread_mutex_t lock;
+} Scan;
+
+typedef struct Buffer
+{
+    char* data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static void
+buffer_append(Buffer* buffer, const char* data, size_t size)
+{
+    if (buffer->size + size > buffer->capacity)
+    {
+        buffer->capacity = (buffer->size + size) * 2;
+        buffer->data = xrealloc(buffer->data, buffer->capacity);
+    }
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void
+buffer_printf(Buffer* buffer, const char* fmt, ...)
+{
+    va_list ap;
+    char* str;
+
+    va_start(ap, fmt);
+    str = formatv(fmt, ap);
+    va_end(ap);
+
+    buffer_append(buffer, str, strlen(str));
+    free(str);
+}
+
+static bool
+is_cplusplus(const char* path)
+{
+    return (ends_with(path, ".cpp") ||
+            ends_with(path, ".C") ||
+            ends_with(path, ".cc") ||
+            ends_with(path, ".c++"));
+}
+
+static bool
+is_preprocessed(const char* path)
+{
+    return ends_with(path, ".i") || ends_with(path, ".ii");
+}
+
+/* Like ${name:-fallback}, an empty value counts as unset */
+static const char*
+env_default(const char* name, const char* fallback)
+{
+    const char* value = getenv(name);
+
+    return value && *value ? value : fallback;
+}
+
+/* Quote a path for the shell that runs the preprocessor */
+static char*
+shell_quote(const char* str)
+{
+    Buffer buffer = {0};
+    const char* p;
+
+    buffer_append(&buffer, "'", 1);
+
+    for (p = str; *p; p++)
+    {
+        if (*p == '\'')
+            buffer_append(&buffer, "'\\''", 4);
+        else
+            buffer_append(&buffer, p, 1);
+    }
+
+    /* Closing quote and terminator */
+    buffer_append(&buffer, "'", 2);
+
+    return buffer.data;
+}
+
+static FILE*
+preprocess(const char* path)
+{
+    const char* cpp;
+    const char* flags;
+    char* quoted;
+    char* command;
+    FILE* stream;
+
+    if (is_preprocessed(path))
+        return fopen(path, "r");
+
+    if (is_cplusplus(path))
+    {
+        cpp = env_default("CXXCPP", "cpp");
+        flags = env_default("CXXCPPFLAGS", env_default("CPPFLAGS", ""));
+    }
+    else
+    {
+        cpp = env_default("CPP", "cpp");
+        flags = env_default("CPPFLAGS", "");
+    }
+
+    quoted = shell_quote(path);
+    command = format("%s %s %s", cpp, flags, quoted);
+
+    stream = popen(command, "r");
+
+    free(command);
+    free(quoted);
+
+    return stream;
+}
+
+static bool
+is_ident(int c)
+{
+    return isalnum(c) || c == '_';
+}
+
+static void
+end_token(Buffer* token, Source* source)
+{
+    if (token->size > sizeof(ENTRY_PREFIX) - 1 &&
+        !memcmp(token->data, ENTRY_PREFIX, sizeof(ENTRY_PREFIX) - 1))
+    {
+        char* entry = xmalloc(token->size + 1);
+
+        memcpy(entry, token->data, token->size);
+        entry[token->size] = '\0';
+        source->entries = (char**) array_append((array*) source->entries, entry);
+    }
+
+    token->size = 0;
+}
+
+/* Collect every identifier starting with the entry prefix */
+static void
+tokenize(FILE* stream, Source* source)
+{
+    char* chunk = xmalloc(READ_SIZE);
+    Buffer token = {0};
+    size_t len;
+    size_t i;
+
+    while ((len = fread(chunk, 1, READ_SIZE, stream)) > 0)
+    {
+        for (i = 0; i < len; i++)
+        {
+            if (is_ident((unsigned char) chunk[i]))
+                buffer_append(&token, &chunk[i], 1);
+            else if (token.size)
+                end_token(&token, source);
+        }
+    }
+
+    end_token(&token, source);
+
+    free(token.data);
+    free(chunk);
+}
+
+static void
+scan_source(Source* source)
+{
+    FILE* stream = preprocess(source->path);
+    int status;
+
+    if (!stream)
+    {
+        source->failed = true;
+        return;
+    }
+
+    tokenize(stream, source);
+
+    if (is_preprocessed(source->path))
+        status = fclose(stream);
+    else
+        status = pclose(stream);
+
+    if (status != 0)
+        source->failed = true;
+}
+
+static void*
+scan_thread(void* data)
+{
+    Scan* scan = data;
+    unsigned int index;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&scan->lock);
+        index = scan->next++;
+        pthread_mutex_unlock(&scan->lock);
+
+        if (index >= scan->count)
+            break;
+
+        scan_source(&scan->sources[index]);
+    }
+
+    return NULL;
+}
+
+static void
+scan_sources(Scan* scan, unsigned int jobs)
+{
+    pthread_t* threads;
+    unsigned int started;
+
+    if (jobs > scan->count)
+        jobs = scan->count;
+
+    threads = xcalloc(jobs ? jobs : 1, sizeof(*threads));
+
+    for (started = 0; started < jobs; started++)
+    {
+        if (pthread_create(&threads[started], NULL, scan_thread, scan))
+            break;
+    }
+
+    /* Without any thread, do the work here */
+    if (!started)
+        scan_thread(scan);
+
+    while (started--)
+    {
+        pthread_join(threads[started], NULL);
+    }
+
+    free(threads);
+}
+
+static int
+entry_compare(const void* _a, const void* _b)
+{
+    return strcmp(*(const char**) _a, *(const char**) _b);
+}
+
+/* Merge the entries of all sources into one sorted, duplicate-free list */
+static char**
+merge_entries(Scan* scan, unsigned int* count)
+{
+    hashtable* seen = hashtable_new(4093, string_hashfunc, string_hashequal, NULL, NULL);
+    char** entries = NULL;
+    unsigned int i, j;
+
+    for (i = 0; i < scan->count; i++)
+    {
+        Source* source = &scan->sources[i];
+
+        for (j = 0; j < array_size((array*) source->entries); j++)
+        {
+            char* entry = source->entries[j];
+
+            if (!hashtable_present(seen, entry))
+            {
+                hashtable_set(seen, entry, entry);
+                entries = (char**) array_append((array*) entries, entry);
+            }
+        }
+    }
+
+    hashtable_free(seen);
+
+    *count = array_size((array*) entries);
+
+    if (*count)
+        qsort(entries, *count, sizeof(*entries), entry_compare);
+
+    return entries;
+}
+
+static void
+emit_stub(Buffer* buffer, char** entries, unsigned int count)
+{
+    unsigned int i;
+
+    buffer_printf(buffer,
+                  "/* Automatically generated by moonunit-stub */\n"
+                  "\n"
+                  "#include <moonunit/interface.h>\n"
+                  "#include <stdlib.h>\n"
+                  "\n");
+
+    for (i = 0; i < count; i++)
+    {
+        buffer_printf(buffer, "extern MuEntryInfo %s;\n", entries[i]);
+    }
+
+    buffer_printf(buffer,
+                  "\n"
+                  "void __mu_stub_hook(MuEntryInfo*** es)\n"
+                  "{\n"
+                  "    static MuEntryInfo* entries[] =\n"
+                  "    {\n");
+
+    for (i = 0; i < count; i++)
+    {
+        buffer_printf(buffer, "        &%s,\n", entries[i]);
+    }
+
+    buffer_printf(buffer,
+                  "        NULL\n"
+                  "    };\n"
+                  "\n"
+                  "    *es = entries;\n"
+                  "}\n");
+}
+
+static bool
+file_matches(const char* path, Buffer* buffer)
+{
+    FILE* file = fopen(path, "r");
+    char* contents;
+    bool result = false;
+
+    if (!file)
+        return false;
+
+    contents = xmalloc(buffer->size + 1);
+
+    /* Reading one byte more than expected catches a longer file */
+    if (fread(contents, 1, buffer->size + 1, file) == buffer->size &&
+        !memcmp(contents, buffer->data, buffer->size))
+    {
+        result = true;
+    }
+
+    free(contents);
+    fclose(file);
+
+    return result;
+}
+
+/* Replace the output atomically, so readers never see a partial stub */
+static void
+write_output(const char* path, Buffer* buffer)
+{
+    char* temp = format("%s.XXXXXX", path);
+    mode_t mask;
+    int fd;
+
+    if ((fd = mkstemp(temp)) < 0)
+    {
+        die("Error: could not create %s: %s", temp, strerror(errno));
+    }
+
+    mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+
+    if (write(fd, buffer->data, buffer->size) != (ssize_t) buffer->size ||
+        close(fd) != 0 ||
+        rename(temp, path) != 0)
+    {
+        unlink(temp);
+        die("Error: could not write %s: %s", path, strerror(errno));
+    }
+
+    free(temp);
+}
+
+static void
+usage(const char* self)
+{
+    const char* name = basename_pure(self);
+
+    printf("%s -- Mu test loading stub generator\n"
+           "\n"
+           "  This program scans C source code files for Mu unit tests\n"
+           "  and generates a test loading stub.  This stub allows MoonUnit\n"
+           "  to load unit tests without scanning symbols in your library\n"
+           "  at runtime (an operation which is highly platform-dependent\n"
+           "  and less portable).\n"
+           "\n"
+           "Usage: %s [-o <outfile>] [-j <jobs>] [<name>=<value> ...] source1.c source2.c ...\n"
+           "  -o <file>           Write output to <file> (defaults to stdout)\n"
+           "  -j <jobs>           Preprocess up to <jobs> sources at once\n"
+           "                      (defaults to the number of processors)\n"
+           "  -?,-h,--help        Display this usage information\n"
+           "  <name>=<value>      Set an environment variable for the duration of\n"
+           "                      this program (e.g. CPPFLAGS)\n"
+           "\n"
+           "Environment variables:\n"
+           "  CPP                 The C preprocessor program to invoke (default: cpp)\n"
+           "  CPPFLAGS            Additional flags to pass to the C preprocessor\n"
+           "  CXXCPP              The C++ preprocessor program to invoke (default: cpp)\n"
+           "  CXXCPPFLAGS         Additional flags to pass to the C++ preprocessor\n"
+           "                      (default: CPPFLAGS)\n",
+           name, name);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* outfile = NULL;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    Scan scan = {0};
+    Buffer buffer = {0};
+    char** entries;
+    unsigned int count;
+    unsigned int i;
+    int arg;
+
+    scan.sources = xcalloc(argc, sizeof(*scan.sources));
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        char* value = argv[arg];
+
+        if (!strcmp(value, "--help") || !strcmp(value, "-h") || !strcmp(value, "-?"))
+        {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (!strcmp(value, "-o") || !strcmp(value, "-j"))
+        {
+            if (arg + 1 >= argc)
+            {
+                die("Error: %s requires an argument", value);
+            }
+
+            if (value[1] == 'o')
+                outfile = argv[++arg];
+            else
+                jobs = atol(argv[++arg]);
+        }
+        else if (strchr(value, '='))
+        {
+            putenv(value);
+        }
+        else
+        {
+            scan.sources[scan.count++].path = value;
+        }
+    }
+
+    if (!scan.count)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    pthread_mutex_init(&scan.lock, NULL);
+
+    scan_sources(&scan, jobs > 0 ? (unsigned int) jobs : 1);
+
+    pthread_mutex_destroy(&scan.lock);
+
+    for (i = 0; i < scan.count; i++)
+    {
+        if (scan.sources[i].failed)
+        {
+            die("Error preprocessing %s", scan.sources[i].path);
+        }
+    }
+
+    entries = merge_entries(&scan, &count);
+
+    emit_stub(&buffer, entries, count);
+
+    if (!outfile || !strcmp(outfile, "-") || !strcmp(outfile, "/dev/stdout"))
+    {
+        fwrite(buffer.data, 1, buffer.size, stdout);
+    }
+    else if (!file_matches(outfile, &buffer))
+    {
+        write_output(outfile, &buffer);
+    }
+
+    array_free((array*) entries);
+
+    for (i = 0; i < scan.count; i++)
+    {
+        unsigned int j;
+
+        for (j = 0; j < array_size((array*) scan.sources[i].entries); j++)
+        {
+            free(scan.sources[i].entries[j]);
+        }
+
+        array_free((array*) scan.sources[i].entries);
+    }
+
+    free(scan.sources);
+    free(buffer.data);
+
+    return 0;
+}
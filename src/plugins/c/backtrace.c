@@ -25,6 +25,8 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
+#define _GNU_SOURCE
 #ifdef HAVE_CONFIG_H
 #    include <config.h>
 #endif
@@ -32,82 +34,404 @@
 #ifdef HAVE_EXECINFO_H
 #    include <execinfo.h>
 #endif
+#include <dlfcn.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <ucontext.h>
 
 #include <moonunit/private/util.h>
 #include <moonunit/test.h>
 
+#ifdef HAVE_ELF_SCAN
+#include "elfscan.h"
+#endif
+
 #include "backtrace.h"
 
-#if defined(HAVE_BACKTRACE) && defined(HAVE_BACKTRACE_SYMBOLS)
+/* A function symbol from the library symbol table */
+typedef struct BacktraceSymbol
+{
+    unsigned long addr;
+    unsigned long size;
+    const char* name;
+} BacktraceSymbol;
 
-static void
-fill_backtrace(MuBacktrace* trace, char* info)
+/* A resolved return address */
+typedef struct BacktraceFrame
 {
-    char* open_paren;
-    char* open_brace;
+    unsigned long func_addr;
+    const char* file_name;
+    const char* func_name;
+} BacktraceFrame;
 
-    open_brace = strchr(info, '[');
-    if (open_brace)
-    {
-        trace->return_addr = strtoul(open_brace + 3, NULL, 16);
-    }
+struct BacktraceCache
+{
+    pthread_mutex_t lock;
+    void* dlhandle;
+    /* Whether the symbol table has been read */
+    bool scanned;
+    const char* path;
+    /* Function symbols sorted by address */
+    BacktraceSymbol* symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+    /* Return address -> BacktraceFrame for frames outside the symbol table */
+    hashtable* frames;
+};
+
+/* Bounds of the stack the unwinder trusts frame pointers within */
+static unsigned long stack_anchor;
+static pthread_t stack_thread;
+
+void
+backtrace_prepare(void* anchor)
+{
+#ifdef HAVE_BACKTRACE
+    void* buffer[1];
+
+    /* The first call may load the unwinder, which must not
+       happen for the first time inside a signal handler */
+    backtrace(buffer, 1);
+#endif
+
+    stack_anchor = (unsigned long) anchor;
+    stack_thread = pthread_self();
+}
+
+/* Program counter, frame pointer and stack pointer of an interrupted context */
+static bool
+context_registers(void* _context, unsigned long* pc, unsigned long* fp, unsigned long* sp)
+{
+    ucontext_t* context = _context;
+
+    if (!context)
+        return false;
 
-    if (open_brace > info)
+#if defined(__linux__) && defined(__x86_64__)
+    *pc = context->uc_mcontext.gregs[REG_RIP];
+    *fp = context->uc_mcontext.gregs[REG_RBP];
+    *sp = context->uc_mcontext.gregs[REG_RSP];
+    return true;
+#elif defined(__linux__) && defined(__i386__)
+    *pc = context->uc_mcontext.gregs[REG_EIP];
+    *fp = context->uc_mcontext.gregs[REG_EBP];
+    *sp = context->uc_mcontext.gregs[REG_ESP];
+    return true;
+#elif defined(__linux__) && defined(__aarch64__)
+    *pc = context->uc_mcontext.pc;
+    *fp = context->uc_mcontext.regs[29];
+    *sp = context->uc_mcontext.sp;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Follow the saved frame pointer chain up to the frame that called
+ * backtrace_prepare.  Every frame must lie between the interrupted
+ * stack pointer and the anchor, so nothing outside the live stack is
+ * read.  Returns -1 if the chain breaks before reaching the anchor,
+ * which happens when code was built without frame pointers.
+ */
+static int
+unwind_frame_pointers(unsigned long pc, unsigned long fp, unsigned long sp,
+                      unsigned long* frames, int max)
+{
+    int count = 0;
+
+    frames[count++] = pc;
+
+    while (count < max)
     {
-        open_brace[-1] = '\0';
-        if ((open_paren = strchr(info, '(')) || (open_paren = strchr(info, '\'')))
-        {
-            char* plus = strchr(open_paren+1, '+');
-            *open_paren = '\0';
-            
-            if (plus)
-            {
-                *plus = '\0';
-                trace->func_name = strdup(open_paren+1);
-                trace->func_addr = strtoul(plus + 3, NULL, 16) + trace->return_addr;
-            }
-            else
-            {
-                trace->func_addr = strtoul(open_paren+1, NULL, 16) + trace->return_addr;
-            }
-        }
-        trace->file_name = strdup(info);
+        unsigned long* frame = (unsigned long*) fp;
+
+        if (fp < sp || fp + 2 * sizeof(unsigned long) > stack_anchor || fp % sizeof(unsigned long))
+            return -1;
+
+        if (!frame[1])
+            return -1;
+
+        frames[count++] = frame[1];
+
+        if (frame[0] >= stack_anchor)
+            break;
+        if (frame[0] <= fp)
+            return -1;
+
+        fp = frame[0];
     }
+
+    return count;
 }
 
-MuBacktrace*
-get_backtrace(int skip)
+#ifdef HAVE_BACKTRACE
+/* Unwind with the eh_frame tables, starting at the interrupted frame */
+static int
+unwind_tables(unsigned long pc, unsigned long* frames, int max)
 {
-    MuBacktrace* trace, **out;
-    void* buffer[100];
+    void* buffer[BACKTRACE_MAX_FRAMES + 8];
     int num_frames;
+    int start = 0;
+    int count = 0;
     int i;
-    char** symbols;
 
     num_frames = backtrace(buffer, sizeof(buffer) / sizeof(*buffer));
-    symbols = backtrace_symbols(buffer, num_frames);
 
-    out = &trace;
+    /* Skip the signal handler and trampoline */
+    for (i = 0; pc && i < num_frames; i++)
+    {
+        if ((unsigned long) buffer[i] == pc)
+        {
+            start = i;
+            break;
+        }
+    }
 
-    for (i = skip; i < num_frames; i++)
+    for (i = start; i < num_frames && count < max; i++)
     {
-        *out = xcalloc(1, sizeof(MuBacktrace));
-        fill_backtrace(*out, symbols[i]);
-        out = &(*out)->up;
+        frames[count++] = (unsigned long) buffer[i];
     }
-             
-    *out = NULL;
 
-    return trace;
+    return count;
 }
+#endif
+
+int
+backtrace_capture(void* context, unsigned long* frames, int max)
+{
+    unsigned long pc = 0, fp, sp;
+    int count;
 
+    if (context_registers(context, &pc, &fp, &sp))
+    {
+        if (pthread_equal(pthread_self(), stack_thread) && sp < stack_anchor &&
+            (count = unwind_frame_pointers(pc, fp, sp, frames, max)) > 0)
+        {
+            return count;
+        }
+    }
+
+#ifdef HAVE_BACKTRACE
+    return unwind_tables(pc, frames, max);
 #else
-MuBacktrace*
-get_backtrace(int skip)
+    if (pc && max)
+    {
+        frames[0] = pc;
+        return 1;
+    }
+    return 0;
+#endif
+}
+
+static size_t
+frame_hash(const void* key, void* unused)
+{
+    unsigned long addr = (unsigned long) key;
+
+    return (size_t) (addr ^ (addr >> 12));
+}
+
+static bool
+frame_equal(const void* a, const void* b, void* unused)
+{
+    return a == b;
+}
+
+static void
+frame_free(void* key, void* value, void* unused)
 {
-    return NULL;
+    BacktraceFrame* frame = value;
+
+    free((void*) frame->file_name);
+    free((void*) frame->func_name);
+    free(frame);
 }
+
+BacktraceCache*
+backtrace_cache_new(void* dlhandle)
+{
+    BacktraceCache* cache = xcalloc(1, sizeof(BacktraceCache));
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->dlhandle = dlhandle;
+    cache->frames = hashtable_new(127, frame_hash, frame_equal, frame_free, NULL);
+
+    return cache;
+}
+
+void
+backtrace_cache_free(BacktraceCache* cache)
+{
+    size_t i;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < cache->symbol_count; i++)
+    {
+        free((void*) cache->symbols[i].name);
+    }
+
+    free(cache->symbols);
+    free((void*) cache->path);
+    hashtable_free(cache->frames);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+#ifdef HAVE_ELF_SCAN
+static bool
+symbol_add(symbol* sym, void* data, MuError** _err)
+{
+    BacktraceCache* cache = data;
+    BacktraceSymbol* entry;
+
+    if (!sym->function || !sym->size || !*sym->name)
+        return true;
+
+    if (cache->symbol_count == cache->symbol_capacity)
+    {
+        cache->symbol_capacity = cache->symbol_capacity ? cache->symbol_capacity * 2 : 256;
+        cache->symbols = xrealloc(cache->symbols, cache->symbol_capacity * sizeof(*cache->symbols));
+    }
+
+    entry = &cache->symbols[cache->symbol_count++];
+    entry->addr = (unsigned long) sym->addr;
+    entry->size = sym->size;
+    entry->name = strdup(sym->name);
+
+    return true;
+}
+
+static int
+symbol_compare(const void* _a, const void* _b)
+{
+    const BacktraceSymbol* a = _a;
+    const BacktraceSymbol* b = _b;
+
+    return a->addr < b->addr ? -1 : a->addr > b->addr ? 1 : 0;
+}
+#endif
+
+/* Read the library symbol table on first use */
+static void
+cache_scan(BacktraceCache* cache)
+{
+#ifdef HAVE_ELF_SCAN
+    MuError* err = NULL;
+    Dl_info info;
+
+    /* Frames resolved through the symbol table are in this file */
+    if (elf_library_info(cache->dlhandle, &info))
+    {
+        cache->path = strdup(info.dli_fname);
+    }
+
+    if (!elf_scan_get_scanner()(cache->dlhandle, NULL, false, symbol_add, cache, &err))
+    {
+        /* Symbolization is best effort; fall back on dynamic symbols */
+        mu_error_handle(&err);
+    }
+
+    if (cache->symbol_count)
+    {
+        qsort(cache->symbols, cache->symbol_count, sizeof(*cache->symbols), symbol_compare);
+    }
 #endif
+
+    cache->scanned = true;
+}
+
+static const BacktraceSymbol*
+cache_find_symbol(BacktraceCache* cache, unsigned long addr)
+{
+    size_t low = 0;
+    size_t high = cache->symbol_count;
+
+    /* Find the last symbol starting at or before addr */
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+
+        if (cache->symbols[mid].addr <= addr)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low && addr < cache->symbols[low - 1].addr + cache->symbols[low - 1].size)
+        return &cache->symbols[low - 1];
+    else
+        return NULL;
+}
+
+static const BacktraceFrame*
+cache_find_frame(BacktraceCache* cache, unsigned long addr)
+{
+    BacktraceFrame* frame = hashtable_get(cache->frames, (void*) addr);
+
+    if (!frame)
+    {
+        frame = xcalloc(1, sizeof(BacktraceFrame));
+#ifdef HAVE_DLADDR
+        {
+            Dl_info info;
+
+            if (dladdr((void*) addr, &info))
+            {
+                frame->file_name = safe_strdup(info.dli_fname);
+                frame->func_name = safe_strdup(info.dli_sname);
+                frame->func_addr = (unsigned long) info.dli_saddr;
+            }
+        }
+#endif
+        hashtable_set(cache->frames, (void*) addr, frame);
+    }
+
+    return frame;
+}
+
+/*
+ * Fills in file and function names for the frames of a raw backtrace.
+ * The strings are owned by the cache and remain valid until it is freed.
+ */
+void
+backtrace_symbolize(BacktraceCache* cache, MuBacktrace* trace)
+{
+    pthread_mutex_lock(&cache->lock);
+
+    if (!cache->scanned)
+        cache_scan(cache);
+
+    for (; trace; trace = trace->up)
+    {
+        /* Look up the call instruction rather than the one after it,
+           which may belong to the next function after a noreturn call */
+        unsigned long addr = trace->return_addr ? trace->return_addr - 1 : 0;
+        const BacktraceSymbol* symbol;
+        const BacktraceFrame* frame;
+
+        if (!addr || trace->func_name)
+            continue;
+
+        if ((symbol = cache_find_symbol(cache, addr)))
+        {
+            trace->file_name = cache->path;
+            trace->func_name = symbol->name;
+            trace->func_addr = symbol->addr;
+        }
+        else
+        {
+            frame = cache_find_frame(cache, addr);
+            trace->file_name = frame->file_name;
+            trace->func_name = frame->func_name;
+            trace->func_addr = frame->func_addr;
+        }
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+}
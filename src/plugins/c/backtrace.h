@@ -30,6 +30,20 @@
 
 #include <moonunit/test.h>
 
-MuBacktrace* get_backtrace(int skip);
+typedef struct BacktraceCache BacktraceCache;
+
+/* Most frames recorded for a crash */
+#define BACKTRACE_MAX_FRAMES 64
+
+/* Child side: record the stack in a signal handler without allocating.
+   Call backtrace_prepare outside the handler from the outermost frame
+   that should be unwound, and pass the handler's ucontext to capture */
+void backtrace_prepare(void* anchor);
+int backtrace_capture(void* context, unsigned long* frames, int max);
+
+/* Parent side: per-library address-to-symbol cache */
+BacktraceCache* backtrace_cache_new(void* dlhandle);
+void backtrace_cache_free(BacktraceCache* cache);
+void backtrace_symbolize(BacktraceCache* cache, MuBacktrace* trace);
 
 #endif
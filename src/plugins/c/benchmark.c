@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#    include <config.h>
+#endif
+
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include <moonunit/private/util.h>
+#include <moonunit/interface.h>
+
+#include "benchmark.h"
+
+/* Largest change in the coefficient of variation between two
+   consecutive windows for timings to be considered level */
+#define CV_TOLERANCE 0.01
+
+double
+benchmark_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void
+benchmark_init(Benchmark* bench, unsigned int window, unsigned int max_warmup)
+{
+    if (window < 2)
+        window = 2;
+    if (window > BENCHMARK_MAX_WINDOW)
+        window = BENCHMARK_MAX_WINDOW;
+
+    bench->window = window;
+    bench->max_warmup = max_warmup;
+    bench->warmup = 0;
+    bench->warm = false;
+    bench->steady = false;
+    bench->history_len = 0;
+    bench->history_pos = 0;
+    bench->count = 0;
+    bench->mean = 0;
+    bench->m2 = 0;
+    bench->min = 0;
+    bench->max = 0;
+}
+
+/* Coefficient of variation of count samples of the history
+   ring, starting start samples after the oldest one */
+static double
+window_cv(Benchmark* bench, unsigned int start, unsigned int count)
+{
+    unsigned int size = 2 * bench->window;
+    unsigned int oldest = (bench->history_pos + size - bench->history_len) % size;
+    double sum = 0, sum2 = 0, mean;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        double sample = bench->history[(oldest + start + i) % size];
+
+        sum += sample;
+        sum2 += sample * sample;
+    }
+
+    mean = sum / count;
+
+    if (mean <= 0)
+        return 0;
+
+    return sqrt(fmax(sum2 / count - mean * mean, 0)) / mean;
+}
+
+static void
+warmup_sample(Benchmark* bench, double time)
+{
+    unsigned int size = 2 * bench->window;
+
+    bench->warmup++;
+    bench->history[bench->history_pos] = time;
+    bench->history_pos = (bench->history_pos + 1) % size;
+
+    if (bench->history_len < size)
+        bench->history_len++;
+
+    /* Compare the two most recent non-overlapping windows */
+    if (bench->history_len == size)
+    {
+        double before = window_cv(bench, 0, bench->window);
+        double after = window_cv(bench, bench->window, bench->window);
+
+        bench->steady = fabs(after - before) <= CV_TOLERANCE;
+    }
+}
+
+/*
+ * Accounts for one run of a test which spent time seconds in its
+ * test stage.  warmup is the warmup requested for the test: 0 for
+ * none, a positive count, or MU_WARMUP_AUTO.  Returns true if the
+ * run was part of the warmup and should not count as an iteration.
+ */
+bool
+benchmark_sample(Benchmark* bench, int warmup, double time)
+{
+    double delta;
+
+    if (warmup != 0 && !bench->warm)
+    {
+        warmup_sample(bench, time);
+
+        if (warmup == MU_WARMUP_AUTO)
+        {
+            bench->warm = bench->steady || bench->warmup >= bench->max_warmup;
+        }
+        else
+        {
+            bench->warm = bench->warmup >= (unsigned int) warmup;
+        }
+
+        return true;
+    }
+
+    /* Welford's online algorithm */
+    bench->count++;
+    delta = time - bench->mean;
+    bench->mean += delta / bench->count;
+    bench->m2 += delta * (time - bench->mean);
+
+    if (bench->count == 1 || time < bench->min)
+        bench->min = time;
+    if (bench->count == 1 || time > bench->max)
+        bench->max = time;
+
+    return false;
+}
+
+MuBenchmark*
+benchmark_summary(Benchmark* bench)
+{
+    MuBenchmark* summary = xcalloc(1, sizeof(*summary));
+
+    summary->warmup = bench->warmup;
+    summary->steady = bench->steady;
+    summary->iterations = bench->count;
+    summary->mean = bench->mean;
+    summary->min = bench->min;
+    summary->max = bench->max;
+    summary->stddev = bench->count > 1 ? sqrt(bench->m2 / (bench->count - 1)) : 0;
+
+    return summary;
+}
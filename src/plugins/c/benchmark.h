@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MU_C_BENCHMARK_H__
+#define __MU_C_BENCHMARK_H__
+
+#include <stdbool.h>
+
+#include <moonunit/test.h>
+
+#define BENCHMARK_MAX_WINDOW 64
+
+typedef struct
+{
+    /* Size of the sliding window used to detect steady state */
+    unsigned int window;
+    /* Upper bound on automatic warmup */
+    unsigned int max_warmup;
+    /* Warmup iterations run so far */
+    unsigned int warmup;
+    /* Whether warmup is over */
+    bool warm;
+    /* Whether timings have leveled off */
+    bool steady;
+    /* The last 2 * window warmup samples, in a ring */
+    double history[2 * BENCHMARK_MAX_WINDOW];
+    unsigned int history_len;
+    unsigned int history_pos;
+    /* Running statistics over measured samples */
+    unsigned int count;
+    double mean;
+    double m2;
+    double min;
+    double max;
+} Benchmark;
+
+double benchmark_now(void);
+void benchmark_init(Benchmark* bench, unsigned int window, unsigned int max_warmup);
+bool benchmark_sample(Benchmark* bench, int warmup, double time);
+MuBenchmark* benchmark_summary(Benchmark* bench);
+
+#endif
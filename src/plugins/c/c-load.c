@@ -37,51 +37,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#ifdef HAVE_LIBELF
+#ifdef HAVE_ELF_SCAN
 #include "elfscan.h"
 #endif
 
+#include "backtrace.h"
 #include "c-load.h"
 
 extern MuLoader mu_cloader;
 
-static CTest*
-ctest_new(CLibrary* library, MuEntryInfo* entry)
-{
-    CTest* test = xcalloc(1, sizeof(CTest));
-
-    if (!test)
-        return NULL;
-
-    test->base.loader = (MuLoader*) &mu_cloader;
-    test->base.library = (MuLibrary*) library;
-    test->entry = entry;
-
-    return test;
-}
-
 static bool
 add(MuEntryInfo* entry, CLibrary* library, MuError **_err)
 {
     switch (entry->type)
     {
     case MU_ENTRY_TEST:
-    {
-        CTest* test = ctest_new(library, entry);
-
-        if (!test)
-        {
-            MU_RAISE_RETURN(false, _err, MU_ERROR_MEMORY, "Out of memory");
-        }
-
-        library->tests = (CTest**) array_append((array*) library->tests, test);
-        
-        if (!library->tests)
-        {
-            MU_RAISE_RETURN(false, _err, MU_ERROR_MEMORY, "Out of memory");
-        }
+        library->test_entries = (MuEntryInfo**) array_append((array*) library->test_entries, entry);
         break;
-  	}
     case MU_ENTRY_FIXTURE_SETUP:
         library->fixture_setups = (MuEntryInfo**) array_append((array*) library->fixture_setups, entry);
         break;
@@ -112,13 +84,7 @@ add(MuEntryInfo* entry, CLibrary* library, MuError **_err)
     return true;
 }
 
-#ifdef HAVE_LIBELF
-
-static bool
-entry_filter(const char* sym, void *unused)
-{
-	return !strncmp("__mu_e_", sym, strlen("__mu_e_"));
-}
+#ifdef HAVE_ELF_SCAN
 
 static bool
 entry_add(symbol* sym, void* _library, MuError **_err)
@@ -133,8 +99,17 @@ static bool
 cloader_scan (MuLoader* _self, CLibrary* handle, MuError ** _err)
 {
     MuError* err = NULL;
+    SymbolScanner scan = elf_scan_get_scanner();
     
-	if (!elf_scan_get_scanner()(handle->dlhandle, entry_filter, entry_add, handle, &err))
+    /* Entries are exported, so the dynamic symbol table is enough
+       unless the library was built with hidden visibility */
+	if (!scan(handle->dlhandle, "__mu_e_", true, entry_add, handle, &err))
+    {
+        MU_RERAISE_GOTO(error, _err, err);
+    }
+
+    if (!handle->test_entries &&
+        !scan(handle->dlhandle, "__mu_e_", false, entry_add, handle, &err))
     {
         MU_RERAISE_GOTO(error, _err, err);
     }
@@ -151,6 +126,10 @@ error:
 bool
 cloader_can_open(MuLoader* self, const char* path)
 {
+#ifdef HAVE_ELF_SCAN
+    /* Avoid running the library's constructors just to identify it */
+    return elf_is_library(path) || ends_with(path, DSO_EXT);
+#else
     bool result;
     void* handle = mu_dlopen(path, RTLD_LAZY);
 
@@ -160,22 +139,22 @@ cloader_can_open(MuLoader* self, const char* path)
         dlclose(handle);
 
     return result;
+#endif
 }
 
-MuLibrary*
-cloader_open(MuLoader* _self, const char* path, MuError** _err)
+static CLibrary*
+clibrary_new(const char* path, MuError** _err)
 {
 	CLibrary* library = xmalloc(sizeof (CLibrary));
-    MuError* err = NULL;
-    void (*stub_hook)(MuEntryInfo*** es);
-    char *last_dot;
 
     if (!library)
     {
-        MU_RAISE_GOTO(error, _err, MU_ERROR_MEMORY, "Out of memory");
+        MU_RAISE_RETURN(NULL, _err, MU_ERROR_MEMORY, "Out of memory");
     }
 
-    library->base.loader = _self;
+    library->base.loader = (MuLoader*) &mu_cloader;
+    library->test_entries = NULL;
+    library->records = NULL;
 	library->tests = NULL;
 	library->fixture_setups = NULL;
     library->fixture_teardowns = NULL;
@@ -185,6 +164,166 @@ cloader_open(MuLoader* _self, const char* path, MuError** _err)
     library->library_destruct = NULL;
 	library->path = strdup(path);
     library->name = NULL;
+	library->dlhandle = NULL;
+    library->probed = false;
+    library->backtrace_cache = NULL;
+
+    return library;
+}
+
+/* If an explicit library name was not available, create one */
+static bool
+clibrary_default_name(CLibrary* library, MuError** _err)
+{
+    char *last_dot;
+
+    if (!library->name)
+    {
+        library->name = strdup(basename_pure(library->path));
+        if (!library->name)
+        {
+            MU_RAISE_RETURN(false, _err, MU_ERROR_MEMORY, "Out of memory");
+        }
+        last_dot = strrchr(library->name, '.');
+        if (last_dot)
+        {
+            *last_dot = '\0';
+        }
+    }
+
+    return true;
+}
+
+static int
+suite_compare(const void* _a, const void* _b)
+{
+    return strcmp(*(const char**) _a, *(const char**) _b);
+}
+
+static int
+record_compare(const void* _a, const void* _b)
+{
+    const CTest* a = *(const CTest**) _a;
+    const CTest* b = *(const CTest**) _b;
+
+    if (a->suite_rank != b->suite_rank)
+        return a->suite_rank < b->suite_rank ? -1 : 1;
+    else
+        return strcmp(a->entry->name, b->entry->name);
+}
+
+/*
+ * Lay out one record per test in a single block and index them in
+ * suite and name order.  Suite names are interned and ranked first,
+ * so most comparisons while sorting are between integers.
+ */
+static void
+clibrary_index(CLibrary* library)
+{
+    unsigned int count = array_size((array*) library->test_entries);
+    hashtable* ranks = hashtable_new(count * 2 + 1, string_hashfunc, string_hashequal, NULL, NULL);
+    const char** suites = xmalloc((count + 1) * sizeof(*suites));
+    unsigned int suite_count = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const char* suite = library->test_entries[i]->container;
+
+        if (!hashtable_present(ranks, suite))
+        {
+            hashtable_set(ranks, (void*) suite, NULL);
+            suites[suite_count++] = suite;
+        }
+    }
+
+    qsort(suites, suite_count, sizeof(*suites), suite_compare);
+
+    for (i = 0; i < suite_count; i++)
+    {
+        hashtable_set(ranks, (void*) suites[i], (void*) (unsigned long) i);
+    }
+
+    library->records = xcalloc(count ? count : 1, sizeof(CTest));
+    library->tests = xmalloc((count + 1) * sizeof(CTest*));
+
+    for (i = 0; i < count; i++)
+    {
+        CTest* test = &library->records[i];
+
+        test->base.loader = (MuLoader*) &mu_cloader;
+        test->base.library = (MuLibrary*) library;
+        test->entry = library->test_entries[i];
+        test->suite_rank = (unsigned long) hashtable_get(ranks, test->entry->container);
+        library->tests[i] = test;
+    }
+
+    library->tests[count] = NULL;
+
+    qsort(library->tests, count, sizeof(CTest*), record_compare);
+
+    hashtable_free(ranks);
+    free(suites);
+}
+
+/* Index fixtures by suite, keeping the first one defined for each */
+static hashtable*
+fixture_index(MuEntryInfo** fixtures)
+{
+    hashtable* index = hashtable_new(array_size((array*) fixtures) * 2 + 1,
+                                     string_hashfunc, string_hashequal, NULL, NULL);
+    unsigned int i;
+
+    for (i = 0; i < array_size((array*) fixtures); i++)
+    {
+        if (!hashtable_present(index, fixtures[i]->container))
+            hashtable_set(index, (void*) fixtures[i]->container, fixtures[i]);
+    }
+
+    return index;
+}
+
+/* Work out each test's thunks once so dispatch compares no names */
+static void
+clibrary_resolve(CLibrary* library)
+{
+    hashtable* setups = fixture_index(library->fixture_setups);
+    hashtable* teardowns = fixture_index(library->fixture_teardowns);
+    MuThunk library_setup = library->library_setup ? library->library_setup->run : NULL;
+    MuThunk library_teardown = library->library_teardown ? library->library_teardown->run : NULL;
+    unsigned int i;
+
+    for (i = 0; library->tests[i]; i++)
+    {
+        CTest* test = library->tests[i];
+        MuEntryInfo* setup = hashtable_get(setups, test->entry->container);
+        MuEntryInfo* teardown = hashtable_get(teardowns, test->entry->container);
+
+        test->thunks.library_setup = library_setup;
+        test->thunks.fixture_setup = setup ? setup->run : NULL;
+        test->thunks.run = test->entry->run;
+        test->thunks.fixture_teardown = teardown ? teardown->run : NULL;
+        test->thunks.library_teardown = library_teardown;
+    }
+
+    hashtable_free(setups);
+    hashtable_free(teardowns);
+}
+
+MuLibrary*
+cloader_open(MuLoader* _self, const char* path, MuError** _err)
+{
+	CLibrary* library = NULL;
+    MuError* err = NULL;
+    void (*stub_hook)(MuEntryInfo*** es);
+    MuEntryInfo** start = NULL;
+    MuEntryInfo** end = NULL;
+
+    if (!(library = clibrary_new(path, &err)))
+    {
+        MU_RERAISE_GOTO(error, _err, err);
+    }
+
 	library->dlhandle = mu_dlopen(library->path, RTLD_NOW);
 
     if (!library->dlhandle)
@@ -192,7 +331,28 @@ cloader_open(MuLoader* _self, const char* path, MuError** _err)
         MU_RAISE_GOTO(error, _err, MU_ERROR_LOAD_LIBRARY, "%s", dlerror());
     }
 
-    if ((stub_hook = dlsym(library->dlhandle, "__mu_stub_hook")))
+#ifdef HAVE_ELF_SCAN
+    /* Prefer the entry section, which needs neither a stub nor a scan */
+    if (!elf_find_entries(library->dlhandle, &start, &end, &err))
+    {
+        /* The stub or a scan will report anything that matters */
+        MU_HANDLE(&err);
+    }
+#endif
+
+    if (start != end)
+    {
+        MuEntryInfo** entry;
+
+        for (entry = start; entry < end; entry++)
+        {
+            if (!add(*entry, library, &err))
+            {
+                MU_RERAISE_GOTO(error, _err, err);
+            }
+        }
+    }
+    else if ((stub_hook = dlsym(library->dlhandle, "__mu_stub_hook")))
     {
         int i;
         MuEntryInfo** entries;
@@ -207,7 +367,7 @@ cloader_open(MuLoader* _self, const char* path, MuError** _err)
             }
         }
     }
-#ifdef HAVE_LIBELF
+#ifdef HAVE_ELF_SCAN
     else if (!cloader_scan(_self, library, &err))
     {
         MU_RERAISE_GOTO(error, _err, err);
@@ -221,21 +381,14 @@ cloader_open(MuLoader* _self, const char* path, MuError** _err)
     }
 #endif
 
-    /* If an explicit library name was not available, create one */
-    if (!library->name)
+    if (!clibrary_default_name(library, &err))
     {
-        library->name = strdup(basename_pure(path));
-        if (!library->name)
-        {
-            MU_RAISE_GOTO(error, _err, MU_ERROR_MEMORY, "Out of memory");
-        }
-        last_dot = strrchr(library->name, '.');
-        if (last_dot)
-        {
-            *last_dot = '\0';
-        }
+        MU_RERAISE_GOTO(error, _err, err);
     }
 
+    clibrary_index(library);
+    clibrary_resolve(library);
+
     return (MuLibrary*) library;
 
 error:
@@ -248,93 +401,113 @@ error:
     return NULL;
 }
 
-MuTest**
-cloader_get_tests (MuLoader* _self, MuLibrary* _handle)
-{
-    CLibrary* handle = (CLibrary*) _handle;
+#ifdef HAVE_ELF_SCAN
 
-	return (MuTest**) array_dup((array*) handle->tests);
-}
-    
-void
-cloader_free_tests (MuLoader* _self, MuLibrary* handle, MuTest** tests)
+static void
+entry_free(MuEntryInfo* entry)
 {
-    array_free((array*) tests);
+    if (entry->name)
+        free((void*) entry->name);
+    if (entry->container)
+        free((void*) entry->container);
+    if (entry->file)
+        free((void*) entry->file);
+
+    free(entry);
 }
 
-// Returns the library setup routine for handle
-MuThunk
-cloader_library_setup (MuLoader* _self, MuLibrary* _handle)
+static bool
+probe_add(MuEntryInfo* entry, void* _library, MuError** _err)
 {
-    CLibrary* handle = (CLibrary*) _handle;
+    CLibrary* library = (CLibrary*) _library;
+    MuEntryInfo* copy;
 
-    if (handle->library_setup)
-    	return handle->library_setup->run;
-    else
-        return NULL;
+    switch (entry->type)
+    {
+    case MU_ENTRY_TEST:
+        /* The probed entry only lives as long as the callback */
+        copy = xmalloc(sizeof(*copy));
+        *copy = *entry;
+        copy->name = safe_strdup(entry->name);
+        copy->container = safe_strdup(entry->container);
+        copy->file = safe_strdup(entry->file);
+
+        return add(copy, library, _err);
+    case MU_ENTRY_LIBRARY_INFO:
+        return add(entry, library, _err);
+    default:
+        /* Setup and teardown routines are only needed to run tests */
+        return true;
+    }
 }
 
-MuThunk
-cloader_library_teardown (MuLoader* _self, MuLibrary* _handle)
+MuLibrary*
+cloader_probe(MuLoader* _self, const char* path, MuError** _err)
 {
-    CLibrary* handle = (CLibrary*) _handle;
+	CLibrary* library = NULL;
+    MuError* err = NULL;
 
-    if (handle->library_teardown)
-    	return handle->library_teardown->run;
-    else
-        return NULL;
-}
+    if (!(library = clibrary_new(path, &err)))
+    {
+        MU_RERAISE_GOTO(error, _err, err);
+    }
 
-MuThunk
-cloader_fixture_setup (MuLoader* _self, MuTest* _test)
-{
-	unsigned int i;
-    CTest* test = (CTest*) _test;
-    CLibrary* handle = (CLibrary*) _test->library;
-    const char* name = test->entry->container;
+    library->probed = true;
 
+    if (!elf_probe_entries(library->path, probe_add, library, &err))
+    {
+        MU_RERAISE_GOTO(error, _err, err);
+    }
 
-    if (handle->fixture_setups)
+    if (!clibrary_default_name(library, &err))
     {
-        for (i = 0; handle->fixture_setups[i]; i++)
-        {
-            if (!strcmp(name, handle->fixture_setups[i]->container))
-            {
-                return handle->fixture_setups[i]->run;
-            }
-        }
+        MU_RERAISE_GOTO(error, _err, err);
     }
-    
-	return NULL;
-}
 
-MuThunk
-cloader_fixture_teardown (MuLoader* _self, MuTest* _test)
-{
-	unsigned int i;
-    CTest* test = (CTest*) _test;
-    CLibrary* handle = (CLibrary*) _test->library;
-    const char* name = test->entry->container;	
+    clibrary_index(library);
+
+    return (MuLibrary*) library;
 
-    if (handle->fixture_teardowns)
+error:
+
+    if (library)
     {
-        for (i = 0; handle->fixture_teardowns[i]; i++)
-        {
-            if (!strcmp(name, handle->fixture_teardowns[i]->container))
-            {
-                return handle->fixture_teardowns[i]->run;
-            }
-        }
+        cloader_close(_self, (MuLibrary*) library);
     }
-	
-	return NULL;
+
+    return NULL;
+}
+
+#else
+
+MuLibrary*
+cloader_probe(MuLoader* _self, const char* path, MuError** _err)
+{
+    return cloader_open(_self, path, _err);
+}
+
+#endif
+
+MuTest**
+cloader_get_tests (MuLoader* _self, MuLibrary* _handle)
+{
+    CLibrary* handle = (CLibrary*) _handle;
+
+    /* The sorted index is shared rather than copied */
+	return (MuTest**) handle->tests;
 }
-   
+    
+void
+cloader_free_tests (MuLoader* _self, MuLibrary* handle, MuTest** tests)
+{
+}
+
 void
 cloader_close (MuLoader* _self, MuLibrary* _handle)
 {
     CLibrary* handle = (CLibrary*) _handle;
-    int i;
+
+    backtrace_cache_free(handle->backtrace_cache);
 
     if (handle->dlhandle)
         dlclose(handle->dlhandle);
@@ -343,15 +516,24 @@ cloader_close (MuLoader* _self, MuLibrary* _handle)
     if (handle->name)
         free((void*) handle->name);
 
-    if (handle->tests)
+#ifdef HAVE_ELF_SCAN
+    if (handle->probed)
     {
-        for (i = 0; i < array_size((array*) handle->tests); i++)
+        int i;
+
+        for (i = 0; i < array_size((array*) handle->test_entries); i++)
         {
-            free(handle->tests[i]);
+            entry_free(handle->test_entries[i]);
         }
     }
+#endif
+
+    array_free((array*) handle->test_entries);
 
-    array_free((array*) handle->tests);
+    if (handle->records)
+        free(handle->records);
+    if (handle->tests)
+        free(handle->tests);
     array_free((array*) handle->fixture_setups);
     array_free((array*) handle->fixture_teardowns);
 
@@ -31,10 +31,23 @@
 #include <moonunit/interface.h>
 #include <moonunit/library.h>
 
+/* Everything dispatch calls for a test, in order, resolved at open time */
+typedef struct CTestThunks
+{
+    MuThunk library_setup;
+    MuThunk fixture_setup;
+    MuThunk run;
+    MuThunk fixture_teardown;
+    MuThunk library_teardown;
+} CTestThunks;
+
 typedef struct CTest
 {
     MuTest base;
+    CTestThunks thunks;
     MuEntryInfo* entry;
+    /* Position of the test's suite among the library's suite names */
+    unsigned int suite_rank;
 } CTest;
 
 typedef struct CLibrary
@@ -43,6 +56,12 @@ typedef struct CLibrary
 	const char* path;
     const char* name;
 	void* dlhandle;
+    /* Listed from the file without loading; tests own their entries */
+    bool probed;
+    /* Test entries in discovery order, then one record per test
+       and a NULL-terminated index sorted by suite and name */
+    MuEntryInfo** test_entries;
+    CTest* records;
 	CTest** tests;
     MuEntryInfo* library_construct;
     MuEntryInfo* library_destruct;
@@ -50,19 +69,18 @@ typedef struct CLibrary
     MuEntryInfo* library_teardown;
     MuEntryInfo** fixture_setups;
     MuEntryInfo** fixture_teardowns;
+    /* Symbolizes crash backtraces, created on first use */
+    struct BacktraceCache* backtrace_cache;
 } CLibrary;
 
 bool cloader_can_open(MuLoader* self, const char* path);
 MuLibrary* cloader_open(MuLoader* _self, const char* path, MuError** _err);
+MuLibrary* cloader_probe(MuLoader* _self, const char* path, MuError** _err);
 MuTest** cloader_get_tests (MuLoader* _self, MuLibrary* handle);
 void cloader_free_tests (MuLoader* _self, MuLibrary* handle, MuTest** tests);
 void cloader_close (MuLoader* _self, MuLibrary* handle);
 const char* cloader_library_name (MuLoader* _self, MuLibrary* handle);
 const char* cloader_test_name (struct MuLoader* _loader, struct MuTest* _test);
 const char* cloader_test_suite (struct MuLoader* _loader, struct MuTest* _test);
-MuThunk cloader_library_setup (MuLoader* _self, MuLibrary* handle);
-MuThunk cloader_library_teardown (MuLoader* _self, MuLibrary* handle);
-MuThunk cloader_fixture_setup (MuLoader* _self, MuTest* test);
-MuThunk cloader_fixture_teardown (MuLoader* _self, MuTest* test);
 
 #endif
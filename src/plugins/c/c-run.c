@@ -49,8 +49,11 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "backtrace.h"
+#include "benchmark.h"
 #include "c-token.h"
 #include "c-load.h"
 #include "c-run.h"
@@ -61,8 +64,50 @@
 
 static long default_timeout = 2000;
 static unsigned int default_iterations = 1;
+static int default_warmup = 0;
+static unsigned int warmup_window = 5;
+static unsigned int warmup_max = 100;
 static bool is_debug = false;
+/* Bytes of each long logged string kept in memory */
+static unsigned int log_limit = 1024 * 1024;
+static bool log_spill = false;
+/* Whether to log what tests write to stdout and stderr */
+static bool capture_output = true;
 static MuInterfaceToken* current_token;
+/* Carries messages from each test process, reused across tests */
+static uipc_ring* event_ring = NULL;
+/* Watches the channel and captured output of each test process */
+static uipc_poller* event_poller = NULL;
+
+#define EVENT_RING_SIZE (256 * 1024)
+/* Events are sent in batches of up to this many bytes... */
+#define EVENT_BATCH_SIZE (16 * 1024)
+/* ...or once the oldest one has waited this many seconds */
+#define EVENT_BATCH_AGE (0.01)
+/* Longest line of captured output logged as one event */
+#define OUTPUT_LINE_MAX 4096
+
+/* One of the test process's standard streams, captured through a pipe */
+typedef struct
+{
+    MuLogEventKind kind;
+    int fd;
+    size_t length;
+    char buffer[OUTPUT_LINE_MAX + 1];
+} OutputStream;
+
+/* Sent by the crash handler in place of a result.  It holds no
+   pointers, so it goes out as is without marshaling */
+typedef struct
+{
+    int signal;
+    MuTestStage stage;
+    double time;
+    unsigned long long bytes_processed;
+    unsigned long long items_processed;
+    unsigned int frame_count;
+    unsigned long frames[BACKTRACE_MAX_FRAMES];
+} CrashMsg;
 
 typedef struct
 {
@@ -79,6 +124,12 @@ typedef struct
     unsigned int count;
 } IterationsMsg;
 
+typedef struct
+{
+    int count;
+} WarmupMsg;
+
+
 static uipc_typeinfo backtrace_info =
 {
     .name = "MuBacktrace",
@@ -92,6 +143,16 @@ static uipc_typeinfo backtrace_info =
     }
 };
 
+static uipc_typeinfo benchmark_info =
+{
+    .name = "MuBenchmark",
+    .size = sizeof(MuBenchmark),
+    .members =
+    {
+        UIPC_END
+    }
+};
+
 static uipc_typeinfo testresult_info =
 {
     .name = "MuTestResult",
@@ -101,6 +162,7 @@ static uipc_typeinfo testresult_info =
         UIPC_STRING(MuTestResult, file),
         UIPC_STRING(MuTestResult, reason),
         UIPC_POINTER(MuTestResult, backtrace, &backtrace_info),
+        UIPC_POINTER(MuTestResult, benchmark, &benchmark_info),
         UIPC_END
     }
 };
@@ -144,11 +206,75 @@ static uipc_typeinfo expect_info =
     }
 };
 
+static uipc_typeinfo warmup_info =
+{
+    .size = sizeof(WarmupMsg),
+    .members =
+    {
+        UIPC_END
+    }
+};
+
 #define MSG_TYPE_RESULT 0
 #define MSG_TYPE_EVENT 1
 #define MSG_TYPE_TIMEOUT 2
 #define MSG_TYPE_EXPECT 3
 #define MSG_TYPE_ITERATIONS 4
+#define MSG_TYPE_WARMUP 5
+#define MSG_TYPE_EVENTS 6
+#define MSG_TYPE_CRASH 7
+
+/* Prepared in the test process so the crash handler need not allocate */
+static CrashMsg crash_msg;
+static uipc_message* crash_message = NULL;
+static char crash_stack[64 * 1024];
+
+/*
+ * Results handed out by the loader occupy a single block, as
+ * unmarshaled payloads do, so cloader_free_result needs only one free.
+ */
+
+/* Move a result with individually allocated members into a block */
+static MuTestResult*
+result_flatten(MuTestResult* result)
+{
+    MuTestResult* flat = uipc_copy_object(result, &testresult_info);
+
+    uipc_free_object(result, &testresult_info);
+
+    return flat;
+}
+
+/* Replace a result with a modified shallow copy of it */
+static MuTestResult*
+result_rebuild(MuTestResult* result, const MuTestResult* changed)
+{
+    MuTestResult* rebuilt = uipc_copy_object(changed, &testresult_info);
+
+    free(result);
+
+    return rebuilt;
+}
+
+/* The symbol cache of a library, created on first use */
+static BacktraceCache*
+library_backtrace_cache(CLibrary* library)
+{
+    BacktraceCache* cache = library->backtrace_cache;
+
+    if (!cache)
+    {
+        cache = backtrace_cache_new(library->dlhandle);
+
+        if (!__sync_bool_compare_and_swap(&library->backtrace_cache, NULL, cache))
+        {
+            backtrace_cache_free(cache);
+            cache = library->backtrace_cache;
+        }
+    }
+
+    return cache;
+}
 
 static MuInterfaceToken*
 ctoken_current(void* data)
@@ -156,6 +282,74 @@ ctoken_current(void* data)
     return (MuInterfaceToken*) data;
 }
 
+/* Send any batched events.  Must be called with the token lock held */
+static
+void
+ctoken_flush_fork(CTokenFork* token)
+{
+    if (!token->batch_length)
+        return;
+
+    uipc_msg_set_data(token->batch_message, token->batch, token->batch_length);
+    uipc_send(token->ipc_handle, token->batch_message, NULL);
+
+    token->batch_length = 0;
+}
+
+static
+void
+ctoken_send_event_fork(CTokenFork* token, const MuLogEvent* event)
+{
+    uipc_message* message = uipc_msg_new(MSG_TYPE_EVENT);
+    uipc_msg_set_payload(message, event, &logevent_info);
+    uipc_send(token->ipc_handle, message, NULL);
+    uipc_msg_free(message);
+}
+
+/* Add an event to the batch, flushing it when it fills up or
+   grows old.  Since the age is only checked here, events logged
+   right before a test stalls are sent when its result is */
+static
+void
+ctoken_batch_event_fork(CTokenFork* token, const MuLogEvent* event)
+{
+    unsigned long length;
+    double now;
+
+    if (!token->batch)
+    {
+        token->batch = xmalloc(EVENT_BATCH_SIZE);
+        token->batch_message = uipc_msg_new(MSG_TYPE_EVENTS);
+    }
+
+    length = uipc_marshal_payload(token->batch + token->batch_length,
+                                  EVENT_BATCH_SIZE - token->batch_length,
+                                  event, &logevent_info);
+
+    if (token->batch_length + length > EVENT_BATCH_SIZE)
+    {
+        ctoken_flush_fork(token);
+
+        if (length > EVENT_BATCH_SIZE)
+        {
+            ctoken_send_event_fork(token, event);
+            return;
+        }
+
+        uipc_marshal_payload(token->batch, EVENT_BATCH_SIZE, event, &logevent_info);
+    }
+
+    now = benchmark_now();
+
+    if (token->batch_length == 0)
+        token->batch_start = now;
+
+    token->batch_length += length;
+
+    if (now - token->batch_start >= EVENT_BATCH_AGE)
+        ctoken_flush_fork(token);
+}
+
 static
 void
 ctoken_event_fork(MuInterfaceToken* _token, const MuLogEvent* event)
@@ -172,16 +366,28 @@ ctoken_event_fork(MuInterfaceToken* _token, const MuLogEvent* event)
 
     ((MuLogEvent*) event)->stage = token->current_stage;    
 
-    uipc_message* message = uipc_msg_new(MSG_TYPE_EVENT);
-    uipc_msg_set_payload(message, event, &logevent_info);
-    uipc_send(ipc_handle, message, NULL);
-    uipc_msg_free(message);
+    /* Processes forked by the test might exit without flushing,
+       so only the test process itself batches its events */
+    if (getpid() == token->child)
+        ctoken_batch_event_fork(token, event);
+    else
+        ctoken_send_event_fork(token, event);
 
     pthread_mutex_unlock(&token->lock);
 }
 
 static void ctoken_free_fork(CTokenFork* token);
 
+/* Time spent in the test stage so far, or in total if it is over */
+static double
+stage_time(MuTestStage stage, double start, double total)
+{
+    if (stage == MU_STAGE_TEST)
+        return benchmark_now() - start;
+    else
+        return total;
+}
+
 static
 void
 ctoken_result_fork(MuInterfaceToken* _token, const MuTestResult* summary)
@@ -192,15 +398,25 @@ ctoken_result_fork(MuInterfaceToken* _token, const MuTestResult* summary)
     assert(ipc_handle != NULL);
 
     pthread_mutex_lock(&token->lock);
+
+    /* Events and output must arrive before the result that ends the test */
+    ctoken_flush_fork(token);
+    fflush(stdout);
+    fflush(stderr);
     
     ((MuTestResult*) summary)->stage = token->current_stage;
+    ((MuTestResult*) summary)->time =
+        stage_time(token->current_stage, token->test_start, token->test_time);
+    ((MuTestResult*) summary)->benchmark = NULL;
+    ((MuTestResult*) summary)->bytes_processed = token->bytes_processed;
+    ((MuTestResult*) summary)->items_processed = token->items_processed;
     uipc_message* message = uipc_msg_new(MSG_TYPE_RESULT);
     uipc_msg_set_payload(message, summary, &testresult_info);
     uipc_send(ipc_handle, message, NULL);
     uipc_msg_free(message);
 
-    ctoken_free_fork(token);
-    uipc_close(ipc_handle);
+    /* The token is left for exit to reclaim, since other test
+       threads may still be waiting on its lock */
     exit(0);
 
     pthread_mutex_unlock(&token->lock);
@@ -219,6 +435,9 @@ ctoken_meta_fork(MuInterfaceToken* _token, int type, ...)
     }
 
     pthread_mutex_lock(&token->lock);
+
+    /* Keep meta-data in order with the events around it */
+    ctoken_flush_fork(token);
     
     va_start(ap, type);
 
@@ -266,6 +485,27 @@ ctoken_meta_fork(MuInterfaceToken* _token, int type, ...)
         uipc_msg_free(message);
         break;
     }
+    case MU_META_WARMUP:
+    {
+        uipc_handle* ipc_handle = token->ipc_handle;
+        WarmupMsg msg = { va_arg(ap, int) };
+
+        if (!ipc_handle)
+            return;
+
+        uipc_message* message = uipc_msg_new(MSG_TYPE_WARMUP);
+        uipc_msg_set_payload(message, &msg, &warmup_info);
+        uipc_send(ipc_handle, message, NULL);
+        uipc_msg_free(message);
+        break;
+    }
+    case MU_META_BYTES_PROCESSED:
+        /* Sent to the parent along with the result */
+        token->bytes_processed = va_arg(ap, unsigned long long);
+        break;
+    case MU_META_ITEMS_PROCESSED:
+        token->items_processed = va_arg(ap, unsigned long long);
+        break;
     case MU_META_LOG_LEVEL:
         *va_arg(ap, MuLogLevel*) = token->max_log_level;
         break;
@@ -327,6 +567,8 @@ ctoken_result_inproc(MuInterfaceToken* _token, const MuTestResult* summary)
     token->result->status = summary->status;
     token->result->reason = safe_strdup(summary->reason);
     token->result->file = safe_strdup(summary->file);
+    token->result->time =
+        stage_time(token->result->stage, token->test_start, token->test_time);
 
     ctoken_longjmp_inproc(token);
 }
@@ -350,7 +592,7 @@ static int crash_signals[] =
     SIGABRT,
     SIGFPE,
     SIGSEGV,
-    SIGPIPE
+    SIGPIPE,
     -1
 };
 
@@ -413,6 +655,16 @@ ctoken_meta_inproc(MuInterfaceToken* _token, int type, ...)
     case MU_META_ITERATIONS:
         *token->iterations = va_arg(ap, unsigned int);
         break;
+    case MU_META_WARMUP:
+        if (token->warmup)
+            *token->warmup = va_arg(ap, int);
+        break;
+    case MU_META_BYTES_PROCESSED:
+        token->result->bytes_processed = va_arg(ap, unsigned long long);
+        break;
+    case MU_META_ITEMS_PROCESSED:
+        token->result->items_processed = va_arg(ap, unsigned long long);
+        break;
     case MU_META_LOG_LEVEL:
         *va_arg(ap, MuLogLevel*) = token->max_log_level;
         break;
@@ -433,38 +685,47 @@ signal_description(int sig)
 #endif
 }
 
+/*
+ * Runs on the alternate stack, possibly with the heap corrupt, so it
+ * only fills in the prepared crash message and sends it.  Everything
+ * that needs allocation happens in the parent.
+ */
 static void
-signal_handler(int sig)
+signal_handler(int sig, siginfo_t* info, void* context)
 {
     CTokenFork* token = (CTokenFork*) current_token;
 
-    if (getpid() == token->child)
+    if (getpid() == token->child && pthread_mutex_trylock(&token->lock) == 0)
     {
-        MuTestResult summary;
-    
-        summary.status = MU_STATUS_CRASH;
-        summary.expected = token->expected;
-        summary.stage = token->current_stage;
-        summary.reason = signal_description(sig);
-        summary.file = NULL;
-        summary.line = 0;
-        summary.backtrace = get_backtrace(0);
-
-        current_token->result(current_token, &summary);
+        /* Events must arrive before the result that ends the test */
+        ctoken_flush_fork(token);
+
+        crash_msg.signal = sig;
+        crash_msg.stage = token->current_stage;
+        crash_msg.time = stage_time(token->current_stage, token->test_start, token->test_time);
+        crash_msg.bytes_processed = token->bytes_processed;
+        crash_msg.items_processed = token->items_processed;
+        crash_msg.frame_count = backtrace_capture(context, crash_msg.frames, BACKTRACE_MAX_FRAMES);
+
+        uipc_send(token->ipc_handle, crash_message, NULL);
+
+        _exit(0);
     }
     else
     {
         /* This is not the child process but a
            child of the child that has inherited
-           this signal handler.  Switch back to the
-           default handler and reraise the signal */
+           this signal handler, or the channel is
+           in use by the thread that crashed.  Switch
+           back to the default handler and reraise the
+           signal so the parent sees how it died */
         signal(sig, SIG_DFL);
         raise(sig);
     }
 }
 
 static void
-signal_setup(void)
+signal_setup(void* anchor)
 {
     /* List of signals we care about */
     static int siglist[] =
@@ -480,10 +741,22 @@ signal_setup(void)
     };
 
     struct sigaction act;
+    stack_t stack;
     int i;
+
+    backtrace_prepare(anchor);
+
+    crash_message = uipc_msg_new(MSG_TYPE_CRASH);
+    uipc_msg_set_data(crash_message, &crash_msg, sizeof(crash_msg));
+
+    /* Let the handler run even if the test overflowed its stack */
+    stack.ss_sp = crash_stack;
+    stack.ss_size = sizeof(crash_stack);
+    stack.ss_flags = 0;
+    sigaltstack(&stack, NULL);
     
-    act.sa_flags = 0;
-    act.sa_handler = signal_handler;
+    act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    act.sa_sigaction = signal_handler;
     sigemptyset(&act.sa_mask);
 
     /* Set up a mask that blocks all other handled
@@ -532,6 +805,10 @@ ctoken_new_inproc(MuTest* test)
 static void
 ctoken_free_fork(CTokenFork* token)
 {
+    if (token->batch)
+        free(token->batch);
+    if (token->batch_message)
+        uipc_msg_free(token->batch_message);
     pthread_mutex_destroy(&token->lock);
     free(token);
 }
@@ -552,42 +829,46 @@ ctoken_free_inproc(CTokenInproc* token)
 static void
 cloader_run_child(MuTest* test, CTokenFork* token)
 {
-    MuThunk thunk;
+    CTestThunks* thunks = &((CTest*) test)->thunks;
 
     /* Set up the C/C++ interface to call into our token */
     mu_interface_set_current_token_callback(ctoken_current, token);
         
-    /* Set up handlers to catch asynchronous/fatal signals */
-    signal_setup();
+    /* Set up handlers to catch asynchronous/fatal signals,
+       unwinding crashes up to this frame */
+    signal_setup(__builtin_frame_address(0));
 
     /* Stage: library setup */
     token->current_stage = MU_STAGE_LIBRARY_SETUP;
     
-    if ((thunk = cloader_library_setup(test->loader, test->library)))
-        INVOKE(thunk);
+    if (thunks->library_setup)
+        INVOKE(thunks->library_setup);
     
     /* Stage: fixture setup */
     token->current_stage = MU_STAGE_FIXTURE_SETUP;
     
-    if ((thunk = cloader_fixture_setup(test->loader, test)))
-        INVOKE(thunk);
+    if (thunks->fixture_setup)
+        INVOKE(thunks->fixture_setup);
     
     /* Stage: test */
     token->current_stage = MU_STAGE_TEST;
+    token->test_start = benchmark_now();
     
-    INVOKE(((CTest*) test)->entry->run);
+    INVOKE(thunks->run);
+
+    token->test_time = benchmark_now() - token->test_start;
     
     /* Stage: fixture teardown */
     token->current_stage = MU_STAGE_FIXTURE_TEARDOWN;
     
-    if ((thunk = cloader_fixture_teardown(test->loader, test)))
-        INVOKE(thunk);
+    if (thunks->fixture_teardown)
+        INVOKE(thunks->fixture_teardown);
     
     /* Stage: library teardown */
     token->current_stage = MU_STAGE_LIBRARY_TEARDOWN;
     
-    if ((thunk = cloader_library_teardown(test->loader, test->library)))
-        INVOKE(thunk);
+    if (thunks->library_teardown)
+        INVOKE(thunks->library_teardown);
     
     /* If we got this far without incident, explicitly succeed */
     mu_interface_result(NULL, 0, MU_STATUS_SUCCESS, NULL);
@@ -739,11 +1020,161 @@ done:
 }
 #endif
 
+/* Build the result for a crash reported by the child's signal handler */
+static MuTestResult*
+result_from_crash(const CrashMsg* crash, CLibrary* library)
+{
+    MuBacktrace frames[BACKTRACE_MAX_FRAMES];
+    MuTestResult summary;
+    MuTestResult* result;
+    unsigned int i;
+
+    memset(&summary, 0, sizeof(summary));
+
+    for (i = 0; i < crash->frame_count && i < BACKTRACE_MAX_FRAMES; i++)
+    {
+        memset(&frames[i], 0, sizeof(frames[i]));
+        frames[i].return_addr = crash->frames[i];
+        frames[i].up = i + 1 < crash->frame_count ? &frames[i + 1] : NULL;
+    }
+
+    if (i)
+    {
+        frames[i - 1].up = NULL;
+        /* Names are borrowed from the cache until the copy below */
+        backtrace_symbolize(library_backtrace_cache(library), frames);
+        summary.backtrace = frames;
+    }
+
+    summary.status = MU_STATUS_CRASH;
+    summary.stage = crash->stage;
+    summary.reason = signal_description(crash->signal);
+    summary.time = crash->time;
+    summary.bytes_processed = crash->bytes_processed;
+    summary.items_processed = crash->items_processed;
+
+    result = uipc_copy_object(&summary, &testresult_info);
+    free((void*) summary.reason);
+
+    return result;
+}
+
+/* Pipes for the stdout and stderr of a test process */
+static bool
+output_open(int pipes[2][2])
+{
+    if (pipe(pipes[0]))
+        return false;
+
+    if (pipe(pipes[1]))
+    {
+        close(pipes[0][0]);
+        close(pipes[0][1]);
+        return false;
+    }
+
+    return true;
+}
+
+static void
+output_log(OutputStream* stream, char* line, size_t length, MuLogCallback cb, void* cb_data)
+{
+    MuLogEvent event;
+
+    memset(&event, 0, sizeof(event));
+    line[length] = '\0';
+
+    event.stage = MU_STAGE_UNKNOWN;
+    event.level = MU_LEVEL_INFO;
+    event.kind = stream->kind;
+    event.message = line;
+
+    cb(&event, cb_data);
+}
+
+/* Log the complete lines of a stream, and the rest at the end */
+static void
+output_lines(OutputStream* stream, bool end, MuLogCallback cb, void* cb_data)
+{
+    char* start = stream->buffer;
+    size_t remaining = stream->length;
+    char* newline;
+
+    while ((newline = memchr(start, '\n', remaining)))
+    {
+        size_t length = newline - start;
+
+        output_log(stream, start, length, cb, cb_data);
+        start = newline + 1;
+        remaining -= length + 1;
+    }
+
+    /* Break lines too long to buffer */
+    if (remaining && (end || remaining == OUTPUT_LINE_MAX))
+    {
+        output_log(stream, start, remaining, cb, cb_data);
+        remaining = 0;
+    }
+
+    memmove(stream->buffer, start, remaining);
+    stream->length = remaining;
+}
+
+/* Read from a stream once.  Returns 1 after reading, -1 if nothing
+   was waiting and 0 once the stream is closed */
+static int
+output_read(OutputStream* stream, MuLogCallback cb, void* cb_data)
+{
+    ssize_t ret;
+
+    do
+    {
+        ret = read(stream->fd, stream->buffer + stream->length, OUTPUT_LINE_MAX - stream->length);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret > 0)
+    {
+        stream->length += ret;
+        output_lines(stream, false, cb, cb_data);
+        return 1;
+    }
+    else if (ret < 0 && errno == EAGAIN)
+    {
+        return -1;
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+/* Log what is left on a stream and stop capturing it.  Processes
+   forked by the test may still hold the pipe, so this only takes
+   what has already been written */
+static void
+output_finish(OutputStream* stream, MuLogCallback cb, void* cb_data)
+{
+    if (stream->fd < 0)
+        return;
+
+    uipc_poller_remove_fd(event_poller, stream->fd);
+
+    while (output_read(stream, cb, cb_data) > 0);
+
+    output_lines(stream, true, cb, cb_data);
+    close(stream->fd);
+    stream->fd = -1;
+}
+
 /* Main loop for harvesting messages from the child process */
 static MuTestResult*
-cloader_run_parent(MuTest* test, CTokenFork* token, MuLogCallback cb, void* cb_data, unsigned int* iterations)
+cloader_run_parent(MuTest* test, CTokenFork* token, OutputStream* output,
+                   MuLogCallback cb, void* cb_data, unsigned int* iterations, int* warmup)
 {
     uipc_handle* ipc = token->ipc_handle;
+    uipc_poller* poller = event_poller;
+    uipc_handle* source;
+    void* data;
     MuTestResult *summary = NULL;
     uipc_message* message = NULL;
     int status;
@@ -756,10 +1187,24 @@ cloader_run_parent(MuTest* test, CTokenFork* token, MuLogCallback cb, void* cb_d
 
     uipc_time_current_offset(&deadline, 0, timeout * 1000);
 
+    if (poller && uipc_poller_add(poller, ipc, NULL) != UIPC_SUCCESS)
+        poller = NULL;
+
 process:
     while (!done)
     {    
-        uipc_result = uipc_recv(ipc, &message, &deadline);
+        if (poller)
+            uipc_result = uipc_poller_recv(poller, &source, &data, &message, &deadline);
+        else
+            uipc_result = uipc_recv(ipc, &message, &deadline);
+
+        /* Captured output is ready */
+        if (uipc_result == UIPC_SUCCESS && !message)
+        {
+            if (!output_read(data, cb, cb_data))
+                output_finish(data, cb, cb_data);
+            continue;
+        }
         
         if (uipc_result == UIPC_SUCCESS)
         {
@@ -769,6 +1214,16 @@ process:
                 summary = uipc_msg_get_payload(message, &testresult_info);
                 done = true;
                 break;
+            case MSG_TYPE_CRASH:
+            {
+                unsigned long length;
+                const CrashMsg* crash = uipc_msg_get_data(message, &length);
+
+                if (length == sizeof(*crash))
+                    summary = result_from_crash(crash, (CLibrary*) test->library);
+                done = true;
+                break;
+            }
             case MSG_TYPE_EVENT:
             {
                 MuLogEvent* event = uipc_msg_get_payload(message, &logevent_info);
@@ -778,6 +1233,24 @@ process:
                 message = NULL;
                 break;
             } 
+            case MSG_TYPE_EVENTS:
+            {
+                unsigned long length, offset;
+                const char* batch = uipc_msg_get_data(message, &length);
+
+                for (offset = 0; offset < length;)
+                {
+                    MuLogEvent* event;
+
+                    offset += uipc_unmarshal_payload((void**) &event, batch + offset, &logevent_info);
+                    cb(event, cb_data);
+                    uipc_msg_free_payload(event, &logevent_info);
+                }
+
+                uipc_msg_free(message);
+                message = NULL;
+                break;
+            }
             case MSG_TYPE_EXPECT:
             {
                 ExpectMsg* msg = uipc_msg_get_payload(message, &expect_info);
@@ -806,6 +1279,15 @@ process:
                 message = NULL;
                 break;
             }
+            case MSG_TYPE_WARMUP:
+            {
+                WarmupMsg* msg = uipc_msg_get_payload(message, &warmup_info);
+                *warmup = msg->count;
+                uipc_msg_free_payload(msg, &warmup_info);
+                uipc_msg_free(message);
+                message = NULL;
+                break;
+            }
             }
         }
         else
@@ -829,9 +1311,16 @@ process:
 
     /* Wait for up to 500 ms for the child to finish exiting */
     wait_child(token->child, &status, 500);
+
+    output_finish(&output[0], cb, cb_data);
+    output_finish(&output[1], cb, cb_data);
+
+    if (poller)
+        uipc_poller_remove(poller, ipc);
         
     if (!summary)
     {
+
         summary = xcalloc(1, sizeof(MuTestResult));
         // Timed out waiting for response
         if (uipc_result == UIPC_TIMEOUT)
@@ -862,17 +1351,22 @@ process:
             summary->line = 0;
             summary->reason = strdup("Unexpected termination");
         }
+
+        summary = result_flatten(summary);
     }
     else
     {
         summary->expected = token->expected;
+
         /* If we timed out, change the test result to reflect this */
         if (timedout)
         {
-            summary->status = MU_STATUS_TIMEOUT;
-            if (summary->reason)
-                free((void*) summary->reason);
-            summary->reason = format("Test timed out after %li milliseconds", timeout);
+            MuTestResult changed = *summary;
+            
+            changed.status = MU_STATUS_TIMEOUT;
+            changed.reason = format("Test timed out after %li milliseconds", timeout);
+            summary = result_rebuild(summary, &changed);
+            free((void*) changed.reason);
         }
     }
     
@@ -884,21 +1378,42 @@ process:
 
 static MuTestResult*
 cloader_run_fork(MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_level,
-                 unsigned int* iterations)
+                 unsigned int* iterations, int* warmup)
 {
     int sockets[2];
+    int pipes[2][2];
+    OutputStream output[2];
+    bool capture = false;
     pid_t pid;
+    int i;
     CTokenFork* token = ctoken_new_fork(test);
 
     current_token = &token->base;
     
     socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
-    
-    /* We must force a flush of all open output streams or the child
-     * will end up flushing non-empty buffers on exit, resulting in
-     * bizarre duplicate output
-     */
 
+    if (!event_ring)
+        event_ring = uipc_ring_new(EVENT_RING_SIZE);
+    if (event_ring)
+        uipc_ring_reset(event_ring);
+
+    if (!event_poller)
+        event_poller = uipc_poller_new();
+
+    output[0].kind = MU_EVENT_STDOUT;
+    output[1].kind = MU_EVENT_STDERR;
+
+    for (i = 0; i < 2; i++)
+    {
+        output[i].fd = -1;
+        output[i].length = 0;
+    }
+
+    if (capture_output && event_poller)
+        capture = output_open(pipes);
+
+    /* Flush so the child does not inherit and write out again
+       anything we have buffered, such as logger output */
     fflush(NULL);
     
     if (!(pid = fork()))
@@ -908,8 +1423,24 @@ cloader_run_fork(MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_leve
         uipc_handle* ipc;
                 
         /* Set up ipc handle, close unneeded socket end */
-        ipc = uipc_attach(sockets[1]);
+        if (event_ring)
+            ipc = uipc_attach_ring(sockets[1], event_ring, UIPC_RING_WRITER);
+        else
+            ipc = uipc_attach(sockets[1]);
         close(sockets[0]);
+
+        /* Send stdout and stderr to the parent */
+        if (capture)
+        {
+            dup2(pipes[0][1], STDOUT_FILENO);
+            dup2(pipes[1][1], STDERR_FILENO);
+
+            for (i = 0; i < 2; i++)
+            {
+                close(pipes[i][0]);
+                close(pipes[i][1]);
+            }
+        }
         
         /* Set up token */
         token->ipc_handle = ipc;
@@ -934,15 +1465,33 @@ cloader_run_fork(MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_leve
         MuTestResult* result;
 
         /* Set up ipc handle, close unneeded socket end */
-        ipc = uipc_attach(sockets[0]);
+        if (event_ring)
+            ipc = uipc_attach_ring(sockets[0], event_ring, UIPC_RING_READER);
+        else
+            ipc = uipc_attach(sockets[0]);
         close(sockets[1]);
+
+        if (log_limit)
+            uipc_set_stream_limit(ipc, log_limit, log_spill ? UIPC_OVERFLOW_SPILL : UIPC_OVERFLOW_TRUNCATE);
+
+        if (capture)
+        {
+            for (i = 0; i < 2; i++)
+            {
+                close(pipes[i][1]);
+                output[i].fd = pipes[i][0];
+                fcntl(output[i].fd, F_SETFL, fcntl(output[i].fd, F_GETFL) | O_NONBLOCK);
+                fcntl(output[i].fd, F_SETFD, FD_CLOEXEC);
+                uipc_poller_add_fd(event_poller, output[i].fd, &output[i]);
+            }
+        }
         
         /* Set up token */
         token->ipc_handle = ipc;
         token->child = pid;
 
         /* Harvest events/result from child */
-        result = cloader_run_parent(test, token, cb, data, iterations);
+        result = cloader_run_parent(test, token, output, cb, data, iterations, warmup);
 
         /* Tear down ipc handle and close connection */
         uipc_detach(ipc);
@@ -974,7 +1523,7 @@ cloader_run_thunk_inproc(MuThunk thunk)
 
     ctoken_free_inproc(token);
 
-    return result;
+    return result_flatten(result);
 }
 
 void
@@ -987,7 +1536,7 @@ cloader_free_result(MuLoader* _self, MuTestResult* result)
 static void
 cloader_run_inproc(MuTest* test, CTokenInproc* token)
 {
-    MuThunk thunk;
+    CTestThunks* thunks = &((CTest*) test)->thunks;
 
     /* Set up the C/C++ interface to call into our token */
     mu_interface_set_current_token_callback(ctoken_current, token);
@@ -995,31 +1544,34 @@ cloader_run_inproc(MuTest* test, CTokenInproc* token)
     /* Stage: library setup */
     token->result->stage = MU_STAGE_LIBRARY_SETUP;
 
-    if ((thunk = cloader_library_setup(test->loader, test->library)))
-        INVOKE(thunk);
+    if (thunks->library_setup)
+        INVOKE(thunks->library_setup);
 
     /* Stage: fixture setup */
     token->result->stage = MU_STAGE_FIXTURE_SETUP;
 
-    if ((thunk = cloader_fixture_setup(test->loader, test)))
-        INVOKE(thunk);
+    if (thunks->fixture_setup)
+        INVOKE(thunks->fixture_setup);
 
     /* Stage: test */
     token->result->stage = MU_STAGE_TEST;
+    token->test_start = benchmark_now();
 
-    INVOKE(((CTest*) test)->entry->run);
+    INVOKE(thunks->run);
+
+    token->test_time = benchmark_now() - token->test_start;
 
     /* Stage: fixture teardown */
     token->result->stage = MU_STAGE_FIXTURE_TEARDOWN;
 
-    if ((thunk = cloader_fixture_teardown(test->loader, test)))
-        INVOKE(thunk);
+    if (thunks->fixture_teardown)
+        INVOKE(thunks->fixture_teardown);
 
     /* Stage: library teardown */
     token->result->stage = MU_STAGE_LIBRARY_TEARDOWN;
 
-    if ((thunk = cloader_library_teardown(test->loader, test->library)))
-        INVOKE(thunk);
+    if (thunks->library_teardown)
+        INVOKE(thunks->library_teardown);
 
     /* If we got this far without incident, explicitly succeed */
     mu_interface_result(NULL, 0, MU_STATUS_SUCCESS, NULL);
@@ -1042,7 +1594,7 @@ timeout_signal(int sig)
 
 static MuTestResult*
 cloader_debug(MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_level,
-              unsigned int* iterations)
+              unsigned int* iterations, int* warmup)
 {
     MuTestResult* volatile result = xcalloc(1, sizeof(*result));
     CTokenInproc* token = ctoken_new_inproc(test);
@@ -1055,6 +1607,7 @@ cloader_debug(MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_level,
     token->cb = cb;
     token->data = data;
     token->iterations = iterations;
+    token->warmup = warmup;
     token->max_log_level = max_level;
     token->self = pthread_self();
 
@@ -1076,17 +1629,34 @@ cloader_debug(MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_level,
 
     ctoken_free_inproc(token);
 
-    return result;
+    return result_flatten(result);
+}
+
+/* Convert processed counts to rates using the test stage time */
+static void
+set_throughput(MuTestResult* result)
+{
+    double time = result->benchmark ? result->benchmark->mean : result->time;
+
+    if (time <= 0)
+        return;
+
+    result->bytes_per_second = result->bytes_processed / time;
+    result->items_per_second = result->items_processed / time;
 }
 
 MuTestResult*
 cloader_dispatch(MuLoader* _self, MuTest* test, MuLogCallback cb, void* data, MuLogLevel max_level)
 {
     unsigned int iterations = default_iterations;
+    int warmup = default_warmup;
     unsigned int i;
     MuTestResult* result = NULL;
+    Benchmark bench;
+
+    benchmark_init(&bench, warmup_window, warmup_max);
 
-    for (i = 0; i < iterations; i++)
+    for (i = 0; i < iterations;)
     {
         if (result)
         {
@@ -1095,15 +1665,33 @@ cloader_dispatch(MuLoader* _self, MuTest* test, MuLogCallback cb, void* data, Mu
 
         if (is_debug)
         {
-            result = cloader_debug(test, cb, data, max_level, &iterations);
+            result = cloader_debug(test, cb, data, max_level, &iterations, &warmup);
         }
         else
         {
-            result = cloader_run_fork(test, cb, data, max_level, &iterations);
+            result = cloader_run_fork(test, cb, data, max_level, &iterations, &warmup);
         }
 
         if (result->status == MU_STATUS_SKIPPED || result->status != result->expected)
             break;
+
+        /* Warmup runs do not count as iterations */
+        if (!benchmark_sample(&bench, warmup, result->time))
+            i++;
+    }
+
+    if (result && warmup != 0 && i == iterations && !result->benchmark)
+    {
+        MuTestResult changed = *result;
+
+        changed.benchmark = benchmark_summary(&bench);
+        result = result_rebuild(result, &changed);
+        free(changed.benchmark);
+    }
+
+    if (result)
+    {
+        set_throughput(result);
     }
 
     return result;
@@ -1185,6 +1773,105 @@ iterations_get(MuLoader* self)
     return (int) default_iterations;
 }
 
+static
+void
+warmup_set(MuLoader* self, int count)
+{
+    /* Below MU_WARMUP_AUTO there is no meaningful count */
+    if (count < MU_WARMUP_AUTO)
+        return;
+
+    default_warmup = count;
+}
+
+static
+int
+warmup_get(MuLoader* self)
+{
+    return default_warmup;
+}
+
+static
+void
+warmup_window_set(MuLoader* self, int count)
+{
+    if (count < 1)
+        return;
+
+    warmup_window = count;
+}
+
+static
+int
+warmup_window_get(MuLoader* self)
+{
+    return (int) warmup_window;
+}
+
+static
+void
+warmup_max_set(MuLoader* self, int count)
+{
+    /* A negative maximum would wrap to billions of forked runs */
+    if (count < 0)
+        return;
+
+    warmup_max = count;
+}
+
+static
+int
+warmup_max_get(MuLoader* self)
+{
+    return (int) warmup_max;
+}
+
+static
+void
+log_limit_set(MuLoader* self, int limit)
+{
+    /* A negative limit would wrap to gigabytes and bound nothing */
+    if (limit < 0)
+        return;
+
+    log_limit = limit;
+}
+
+static
+int
+log_limit_get(MuLoader* self)
+{
+    return (int) log_limit;
+}
+
+static
+void
+log_spill_set(MuLoader* self, bool set)
+{
+    log_spill = set;
+}
+
+static
+bool
+log_spill_get(MuLoader* self)
+{
+    return log_spill;
+}
+
+static
+void
+capture_set(MuLoader* self, bool set)
+{
+    capture_output = set;
+}
+
+static
+bool
+capture_get(MuLoader* self)
+{
+    return capture_output;
+}
+
 static
 void
 debug_set(MuLoader* self, bool set)
@@ -1209,6 +1896,30 @@ MuOption cloader_options[] =
     MU_OPTION("iterations", MU_TYPE_INTEGER, iterations_get, iterations_set,
               "The number of times each test is run (unless specified by the test)"),
 
+    MU_OPTION("warmup", MU_TYPE_INTEGER, warmup_get, warmup_set,
+              "The number of unmeasured runs before each test is timed "
+              "(unless specified by the test), or -1 to warm up until "
+              "timings reach a steady state"),
+
+    MU_OPTION("warmup-window", MU_TYPE_INTEGER, warmup_window_get, warmup_window_set,
+              "The number of runs in the sliding window used to detect "
+              "steady state during automatic warmup"),
+
+    MU_OPTION("warmup-max", MU_TYPE_INTEGER, warmup_max_get, warmup_max_set,
+              "The maximum number of runs of automatic warmup"),
+
+    MU_OPTION("log-limit", MU_TYPE_INTEGER, log_limit_get, log_limit_set,
+              "The number of bytes kept of each long string logged by a "
+              "test, or 0 to keep everything"),
+
+    MU_OPTION("log-spill", MU_TYPE_BOOLEAN, log_spill_get, log_spill_set,
+              "Whether to write the rest of strings longer than log-limit "
+              "to a temporary file instead of discarding it"),
+
+    MU_OPTION("capture", MU_TYPE_BOOLEAN, capture_get, capture_set,
+              "Whether to capture what tests write to stdout and stderr "
+              "and log it with their results"),
+
     MU_OPTION("debug", MU_TYPE_BOOLEAN, debug_get, debug_set,
               "Whether to run in debug mode (avoid forking)"),
     MU_OPTION_END
@@ -45,6 +45,15 @@ typedef struct
     MuTest* current_test;
     uipc_handle* ipc_handle;
     pid_t child;
+    double test_start;
+    double test_time;
+    unsigned long long bytes_processed;
+    unsigned long long items_processed;
+    /* Marshaled events waiting to be sent as one batch */
+    char* batch;
+    uipc_message* batch_message;
+    unsigned long batch_length;
+    double batch_start;
     pthread_mutex_t lock;
 } CTokenFork;
 
@@ -55,8 +64,11 @@ typedef struct
     MuLogCallback cb;
     void* data;
     unsigned int* iterations;
+    int* warmup;
     MuLogLevel max_log_level;
     MuTestResult* result;
+    double test_start;
+    double test_time;
     sigjmp_buf jmpbuf;
     pthread_t self;
     pthread_mutex_t lock;
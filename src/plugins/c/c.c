@@ -48,6 +48,7 @@ MuLoader mu_cloader =
     .free_result = cloader_free_result,
     .construct = cloader_construct,
     .destruct = cloader_destruct,
+    .probe = cloader_probe,
     .options = cloader_options
 };
 
@@ -59,7 +60,7 @@ get_cloader()
 
 static MuPlugin plugin =
 {
-    .version = MU_PLUGIN_API_1,
+    .version = MU_PLUGIN_API_2,
     .type = MU_PLUGIN_LOADER,
     .name = "c",
     .author = "Brian Koropoff",
@@ -25,202 +25,740 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
+/*
+ * Reads symbols straight from the mapped library file.  Only the
+ * section headers and the chosen symbol and string tables are
+ * touched, and names are matched in place without copying.
+ */
+
 #define _GNU_SOURCE
 #include <dlfcn.h>
+#include <link.h>
 #include <stdio.h>
 #undef _GNU_SOURCE
+#include <config.h>
+
+#ifdef HAVE_ELF_SCAN
+
 #include "elfscan.h"
+#include <moonunit/private/util.h>
 #include <elf.h>
-#include <libelf.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <config.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
 
-#if SIZEOF_VOIDP == 4
-#define ELF_SYM_T Elf32_Sym
+/* Addresses are handled as unsigned long, so it matches the ELF class */
+#if ULONG_MAX == 0xffffffffUL
+#define ELF_CLASS ELFCLASS32
+#define ELF_EHDR_T Elf32_Ehdr
+#define ELF_PHDR_T Elf32_Phdr
 #define ELF_SHDR_T Elf32_Shdr
-#define ELF_GETSHDR_F elf32_getshdr
-#elif SIZEOF_VOIDP == 8
-#define ELF_SYM_T Elf64_Sym
-#define ELF_SHDR_T Elf64_Shdr
-#define ELF_GETSHDR_F elf64_getshdr
+#define ELF_SYM_T Elf32_Sym
+#define ELF_REL_T Elf32_Rel
+#define ELF_RELA_T Elf32_Rela
+#define ELF_ST_TYPE_F ELF32_ST_TYPE
+#define ELF_R_SYM_F ELF32_R_SYM
 #else
-#error Unhandled pointer width
+#define ELF_CLASS ELFCLASS64
+#define ELF_EHDR_T Elf64_Ehdr
+#define ELF_PHDR_T Elf64_Phdr
+#define ELF_SHDR_T Elf64_Shdr
+#define ELF_SYM_T Elf64_Sym
+#define ELF_REL_T Elf64_Rel
+#define ELF_RELA_T Elf64_Rela
+#define ELF_ST_TYPE_F ELF64_ST_TYPE
+#define ELF_R_SYM_F ELF64_R_SYM
 #endif
 
-typedef enum ElfError
+typedef struct ElfReloc
 {
-    ELF_ERROR_SYMMETH,
-    ELF_ERROR_VERSION,
-    ELF_ERROR_LIBELF
-} ElfError;
+    unsigned long offset;
+    unsigned long value;
+} ElfReloc;
 
-static void*
-library_base_address(void *handle)
+typedef struct ElfImage
 {
-	void* func;
-	Dl_info info;
-	
-	// Grab a function with dynamic linkage which is typically present
-	if (!(func = dlsym(handle, "_init")))
-		return NULL;
-	
-	// Use function pointer to get information on library
-	if (!dladdr(func, &info))
-		return NULL;
+    const char* data;
+    size_t size;
+    const ELF_EHDR_T* ehdr;
+    const ELF_SHDR_T* shdrs;
+    size_t shnum;
+    /* Values stored by relocations at load address zero, sorted by offset */
+    ElfReloc* relocs;
+    size_t nrelocs;
+} ElfImage;
+
+bool
+elf_library_info(void* handle, Dl_info* info)
+{
+	void* addr = NULL;
+#ifdef HAVE_DLINFO
+	struct link_map* map = NULL;
+
+	// The dynamic section lives in every shared object
+	if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == 0 && map)
+		addr = map->l_ld;
+#endif
+
+	// Otherwise grab a function with dynamic linkage which is typically present
+	if (!addr && !(addr = dlsym(handle, "_init")))
+		return false;
 	
-	// Return base address of library
-	return info.dli_fbase;
+	// Use the address to get information on library
+	return dladdr(addr, info) && info->dli_fname && info->dli_fbase;
 }
 
-static const char*
-library_path(void *handle)
+static bool
+image_contains(ElfImage* image, size_t offset, size_t length)
 {
-	void* func;
-	Dl_info info;
-	
-	// Grab a function with dynamic linkage which is typically present
-	if (!(func = dlsym(handle, "_init")))
-		return NULL;
-	
-	// Use function pointer to get information on library
-	if (!dladdr(func, &info))
-		return NULL;
-	
-	// Return path of library
-	return info.dli_fname;
+    return offset <= image->size && length <= image->size - offset;
 }
 
-static inline bool
-libelf_scan_symtab(void* handle, SymbolFilter filter, SymbolCallback callback, void* data,
-				   Elf* elf, Elf_Scn* section, ELF_SHDR_T *shdr, bool dynamic, MuError **_err)
+/* Check the headers of a mapped file and locate its section table */
+static bool
+image_open(ElfImage* image, MuError** _err)
+{
+    const ELF_EHDR_T* ehdr = (const ELF_EHDR_T*) image->data;
+
+    if (image->size < sizeof(*ehdr) ||
+        memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+        ehdr->e_ident[EI_CLASS] != ELF_CLASS ||
+        ehdr->e_shentsize != sizeof(ELF_SHDR_T))
+    {
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Not a valid ELF file");
+    }
+
+    image->ehdr = ehdr;
+    image->shdrs = (const ELF_SHDR_T*) (image->data + ehdr->e_shoff);
+    image->shnum = ehdr->e_shnum;
+
+    if (!image_contains(image, ehdr->e_shoff, sizeof(ELF_SHDR_T)))
+    {
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Truncated ELF section table");
+    }
+
+    /* Large section counts are kept in the first section header */
+    if (image->shnum == 0)
+        image->shnum = image->shdrs[0].sh_size;
+
+    if (!image_contains(image, ehdr->e_shoff, image->shnum * sizeof(ELF_SHDR_T)))
+    {
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Truncated ELF section table");
+    }
+
+    return true;
+}
+
+static bool
+image_map(ElfImage* image, const char* path, MuError** _err)
 {
     MuError* err = NULL;
-	Elf_Data *edata = NULL;
-	ELF_SYM_T* sym = NULL;
-	ELF_SYM_T* last_sym = NULL;
-	void* base_address = dynamic ? NULL : library_base_address(handle);
-	
-    // Nothing we can do about this, but it's not fatal
-	if (!dynamic && !base_address)
-        return true;
-	
-	if (!(edata = elf_getdata(section, edata)))
+    struct stat st;
+    void* map = MAP_FAILED;
+    int fd = open(path, O_RDONLY);
+
+    memset(image, 0, sizeof(*image));
+
+    if (fd < 0 || fstat(fd, &st) < 0 ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
     {
-        if (elf_errno())
-            MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "%s", elf_errmsg(elf_errno()));
-        else
-            return true;
+        MU_RAISE_GOTO(error, _err, MU_ERROR_SYSTEM, "%s: %s", path, strerror(errno));
+    }
+
+    close(fd);
+
+    image->data = map;
+    image->size = st.st_size;
+
+    if (!image_open(image, &err))
+    {
+        munmap(map, st.st_size);
+        image->data = NULL;
+        MU_RERAISE_RETURN(false, _err, err);
     }
-    
-    if (edata->d_size == 0)
-        // Nothing in this section, but that's ok
-        return true;
-    
-	sym = (ELF_SYM_T*) edata->d_buf;
-	last_sym = (ELF_SYM_T*) ((char*) edata->d_buf + edata->d_size);
-	
-	for (; sym < last_sym; sym++)
-	{
-		symbol info;
-		
-		info.name = elf_strptr(elf, shdr->sh_link, (size_t) sym->st_name);
-		
-		if (filter(info.name, data))
-		{
-			if (dynamic)
-			{
-				info.addr = dlsym(handle, info.name);
-			}
-			else
-			{
-				info.addr = base_address + (unsigned long) sym->st_value;	
-			}
-			if (!callback(&info, data, &err))
-            {
-                MU_RERAISE_RETURN(false, _err, err);
-            }
-		}
-	}
 
     return true;
+
+error:
+
+    if (fd >= 0)
+        close(fd);
+
+    return false;
+}
+
+static void
+image_unmap(ElfImage* image)
+{
+    if (image->data)
+        munmap((void*) image->data, image->size);
+    if (image->relocs)
+        free(image->relocs);
+}
+
+/* Offset from addresses in the file to where the library was loaded */
+static unsigned long
+image_load_bias(ElfImage* image, Dl_info* info)
+{
+    const ELF_EHDR_T* ehdr = image->ehdr;
+    const ELF_PHDR_T* phdr = (const ELF_PHDR_T*) (image->data + ehdr->e_phoff);
+    unsigned long pagesize = sysconf(_SC_PAGESIZE);
+    int i;
+
+    if (ehdr->e_phentsize == sizeof(*phdr) &&
+        image_contains(image, ehdr->e_phoff, ehdr->e_phnum * sizeof(*phdr)))
+    {
+        /* dladdr reports where the first segment was mapped */
+        for (i = 0; i < ehdr->e_phnum; i++)
+        {
+            if (phdr[i].p_type == PT_LOAD)
+                return (unsigned long) info->dli_fbase - (phdr[i].p_vaddr & ~(pagesize - 1));
+        }
+    }
+
+    return (unsigned long) info->dli_fbase;
+}
+
+static const ELF_SHDR_T*
+image_find_section(ElfImage* image, unsigned int type)
+{
+    size_t i;
+
+    for (i = 0; i < image->shnum; i++)
+    {
+        if (image->shdrs[i].sh_type == type)
+            return &image->shdrs[i];
+    }
+
+    return NULL;
 }
 
 static bool
-libelf_symbol_scanner(void* handle, SymbolFilter filter, SymbolCallback callback, void* data, MuError **_err)
+image_scan_symtab(ElfImage* image, const ELF_SHDR_T* section, unsigned long bias,
+                  const char* prefix, SymbolCallback callback, void* data, MuError** _err)
 {
     MuError* err = NULL;
-	const char* filename = NULL;
-	int fd = -1;
-	Elf* elf = NULL;
-	Elf_Scn* section = NULL;
-	
-	filename = library_path(handle);
+    const ELF_SHDR_T* strsection;
+    const ELF_SYM_T* sym;
+    const ELF_SYM_T* last_sym;
+    const char* strtab;
+    size_t strsize;
+    size_t prefix_length = prefix ? strlen(prefix) : 0;
 
-    if (!filename)
+    if (section->sh_link >= image->shnum ||
+        section->sh_entsize != sizeof(ELF_SYM_T) ||
+        !image_contains(image, section->sh_offset, section->sh_size))
     {
-        MU_RAISE_GOTO(error, _err, MU_ERROR_LOAD_LIBRARY, "Could not determine path of library file from handle");
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Malformed ELF symbol table");
     }
 
-	fd = open(filename, O_RDONLY);
+    strsection = &image->shdrs[section->sh_link];
 
-    if (fd < 0)
+    if (!image_contains(image, strsection->sh_offset, strsection->sh_size) || !strsection->sh_size)
+    {
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Malformed ELF string table");
+    }
+
+    strtab = image->data + strsection->sh_offset;
+    strsize = strsection->sh_size;
+    sym = (const ELF_SYM_T*) (image->data + section->sh_offset);
+    last_sym = sym + section->sh_size / sizeof(ELF_SYM_T);
+
+    for (; sym < last_sym; sym++)
+    {
+        const char* name;
+        symbol info;
+
+        /* Compare the prefix in place before anything else */
+        if (sym->st_name >= strsize || strsize - sym->st_name <= prefix_length)
+            continue;
+
+        name = strtab + sym->st_name;
+
+        if (prefix_length && memcmp(name, prefix, prefix_length))
+            continue;
+
+        if (sym->st_shndx == SHN_UNDEF || ELF_ST_TYPE_F(sym->st_info) == STT_TLS ||
+            !memchr(name, '\0', strsize - sym->st_name))
+            continue;
+
+        info.name = name;
+        info.addr = (void*) (bias + (unsigned long) sym->st_value);
+        info.size = (unsigned long) sym->st_size;
+        info.function = ELF_ST_TYPE_F(sym->st_info) == STT_FUNC;
+
+        if (!callback(&info, data, &err))
+        {
+            MU_RERAISE_RETURN(false, _err, err);
+        }
+    }
+
+    return true;
+}
+
+static bool
+mmap_symbol_scanner(void* handle, const char* prefix, bool dynamic,
+                    SymbolCallback callback, void* data, MuError** _err)
+{
+    MuError* err = NULL;
+    Dl_info info;
+    ElfImage image;
+    const ELF_SHDR_T* section = NULL;
+    bool result = false;
+
+    if (!elf_library_info(handle, &info))
     {
-        MU_RAISE_GOTO(error, _err, MU_ERROR_SYSTEM, "%s", strerror(errno));
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Could not determine path of library file from handle");
     }
 
-	if (elf_version(EV_CURRENT) == EV_NONE )
+    if (!image_map(&image, info.dli_fname, &err))
     {
-        MU_RAISE_GOTO(error, _err, MU_ERROR_LOAD_LIBRARY, "libelf is too old");
+        MU_RERAISE_RETURN(false, _err, err);
     }
-    
-	if (!(elf = elf_begin(fd, ELF_C_READ, NULL)))
-	{
-        MU_RAISE_GOTO(error, _err, MU_ERROR_LOAD_LIBRARY, "%s", elf_errmsg(elf_errno()));
-	}
-	
-	while ((section = elf_nextscn(elf, section)))
-	{
-		ELF_SHDR_T *shdr = ELF_GETSHDR_F(section);
-		
-        if (!shdr)
+
+    if (!dynamic)
+        section = image_find_section(&image, SHT_SYMTAB);
+    if (!section)
+        section = image_find_section(&image, SHT_DYNSYM);
+
+    if (section &&
+        !image_scan_symtab(&image, section, image_load_bias(&image, &info),
+                           prefix, callback, data, &err))
+    {
+        MU_RERAISE_GOTO(error, _err, err);
+    }
+
+    result = true;
+
+error:
+
+    image_unmap(&image);
+
+    return result;
+}
+
+/* Translate a link-time address to the file bytes backing it */
+static const char*
+image_address(ElfImage* image, unsigned long addr, size_t length)
+{
+    const ELF_EHDR_T* ehdr = image->ehdr;
+    const ELF_PHDR_T* phdr = (const ELF_PHDR_T*) (image->data + ehdr->e_phoff);
+    int i;
+
+    if (ehdr->e_phentsize != sizeof(*phdr) ||
+        !image_contains(image, ehdr->e_phoff, ehdr->e_phnum * sizeof(*phdr)))
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < ehdr->e_phnum; i++)
+    {
+        unsigned long offset = addr - phdr[i].p_vaddr;
+
+        if (phdr[i].p_type == PT_LOAD &&
+            addr >= phdr[i].p_vaddr &&
+            offset < phdr[i].p_filesz &&
+            length <= phdr[i].p_filesz - offset &&
+            image_contains(image, phdr[i].p_offset + offset, length))
         {
-            MU_RAISE_GOTO(error, _err, MU_ERROR_LOAD_LIBRARY, "%s", elf_errmsg(elf_errno()));
+            return image->data + phdr[i].p_offset + offset;
         }
+    }
+
+    return NULL;
+}
+
+static const ELF_SHDR_T*
+image_find_named_section(ElfImage* image, const char* name)
+{
+    const ELF_SHDR_T* strsection;
+    size_t index = image->ehdr->e_shstrndx;
+    size_t i;
+
+    if (index == SHN_XINDEX)
+        index = image->shdrs[0].sh_link;
+
+    if (index >= image->shnum)
+        return NULL;
+
+    strsection = &image->shdrs[index];
+
+    if (!image_contains(image, strsection->sh_offset, strsection->sh_size))
+        return NULL;
 
-        switch (shdr->sh_type)
+    for (i = 0; i < image->shnum; i++)
+    {
+        size_t offset = image->shdrs[i].sh_name;
+
+        if (offset < strsection->sh_size &&
+            !strncmp(image->data + strsection->sh_offset + offset, name,
+                     strsection->sh_size - offset))
         {
-        case SHT_SYMTAB:
-            if (!libelf_scan_symtab(handle, filter, callback, data, elf, section, shdr, false, &err))
+            return &image->shdrs[i];
+        }
+    }
+
+    return NULL;
+}
+
+static int
+reloc_compare(const void* _a, const void* _b)
+{
+    const ElfReloc* a = (const ElfReloc*) _a;
+    const ElfReloc* b = (const ElfReloc*) _b;
+
+    return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+static void
+image_add_reloc(ElfImage* image, size_t* capacity, const ELF_SHDR_T* section,
+                unsigned long offset, unsigned long info, unsigned long addend)
+{
+    unsigned long symindex = ELF_R_SYM_F(info);
+    unsigned long value = addend;
+
+    if (symindex)
+    {
+        const ELF_SHDR_T* symsection = &image->shdrs[section->sh_link];
+        const ELF_SYM_T* sym;
+
+        if (section->sh_link >= image->shnum ||
+            symsection->sh_entsize != sizeof(ELF_SYM_T) ||
+            symindex >= symsection->sh_size / sizeof(ELF_SYM_T) ||
+            !image_contains(image, symsection->sh_offset, symsection->sh_size))
+        {
+            return;
+        }
+
+        sym = (const ELF_SYM_T*) (image->data + symsection->sh_offset) + symindex;
+
+        /* Only symbols defined in the library itself have a known address */
+        if (sym->st_shndx == SHN_UNDEF)
+            return;
+
+        value += sym->st_value;
+    }
+
+    if (image->nrelocs == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        image->relocs = xrealloc(image->relocs, *capacity * sizeof(ElfReloc));
+    }
+
+    image->relocs[image->nrelocs].offset = offset;
+    image->relocs[image->nrelocs].value = value;
+    image->nrelocs++;
+}
+
+/*
+ * Pointers stored in a library's data are filled in by the dynamic
+ * linker, so compute what each relocation would store (symbol plus
+ * addend) for a library loaded at address zero.  REL relocations keep
+ * their addend in place, and RELR ones only ever rebase the value
+ * already in place, so those need no entry.
+ */
+static void
+image_load_relocs(ElfImage* image)
+{
+    size_t i, capacity = 0;
+    unsigned long addend;
+
+    for (i = 0; i < image->shnum; i++)
+    {
+        const ELF_SHDR_T* section = &image->shdrs[i];
+        size_t entsize = section->sh_type == SHT_RELA ? sizeof(ELF_RELA_T) : sizeof(ELF_REL_T);
+        const char* entry;
+        const char* last_entry;
+
+        if ((section->sh_type != SHT_RELA && section->sh_type != SHT_REL) ||
+            section->sh_entsize != entsize ||
+            !image_contains(image, section->sh_offset, section->sh_size))
+        {
+            continue;
+        }
+
+        entry = image->data + section->sh_offset;
+        last_entry = entry + section->sh_size / entsize * entsize;
+
+        for (; entry < last_entry; entry += entsize)
+        {
+            if (section->sh_type == SHT_RELA)
             {
-                MU_RERAISE_GOTO(error, _err, err);
+                const ELF_RELA_T* rela = (const ELF_RELA_T*) entry;
+
+                image_add_reloc(image, &capacity, section, rela->r_offset, rela->r_info, rela->r_addend);
             }
-            continue;
-        case SHT_DYNSYM:
-            if (!libelf_scan_symtab(handle, filter, callback, data, elf, section, shdr, true, &err))
+            else
+            {
+                const ELF_REL_T* rel = (const ELF_REL_T*) entry;
+                const char* bytes = image_address(image, rel->r_offset, sizeof(addend));
+
+                if (bytes)
+                {
+                    memcpy(&addend, bytes, sizeof(addend));
+                    image_add_reloc(image, &capacity, section, rel->r_offset, rel->r_info, addend);
+                }
+            }
+        }
+    }
+
+    if (image->nrelocs)
+        qsort(image->relocs, image->nrelocs, sizeof(ElfReloc), reloc_compare);
+}
+
+/* Read the link-time value of a pointer stored at addr */
+static bool
+image_read_pointer(ElfImage* image, unsigned long addr, unsigned long* value)
+{
+    ElfReloc key = {addr, 0};
+    const ElfReloc* reloc = NULL;
+    const char* bytes;
+
+    if (image->nrelocs)
+        reloc = bsearch(&key, image->relocs, image->nrelocs, sizeof(key), reloc_compare);
+
+    if (reloc)
+    {
+        *value = reloc->value;
+        return true;
+    }
+
+    if (!(bytes = image_address(image, addr, sizeof(*value))))
+        return false;
+
+    memcpy(value, bytes, sizeof(*value));
+
+    return true;
+}
+
+static bool
+image_read_string(ElfImage* image, unsigned long addr, const char** string)
+{
+    unsigned long value;
+    const char* bytes;
+
+    if (!image_read_pointer(image, addr, &value))
+        return false;
+
+    if (!value)
+    {
+        *string = NULL;
+        return true;
+    }
+
+    if (!(bytes = image_address(image, value, 1)) ||
+        !memchr(bytes, '\0', image->data + image->size - bytes))
+    {
+        return false;
+    }
+
+    *string = bytes;
+
+    return true;
+}
+
+static bool
+image_read_entry(ElfImage* image, unsigned long addr, MuEntryInfo* entry)
+{
+    const char* bytes = image_address(image, addr, sizeof(*entry));
+
+    if (!bytes)
+        return false;
+
+    memcpy(entry, bytes, sizeof(*entry));
+    entry->run = NULL;
+
+    return image_read_string(image, addr + offsetof(MuEntryInfo, name), &entry->name) &&
+        image_read_string(image, addr + offsetof(MuEntryInfo, container), &entry->container) &&
+        image_read_string(image, addr + offsetof(MuEntryInfo, file), &entry->file);
+}
+
+typedef struct EntryProbe
+{
+    ElfImage* image;
+    EntryCallback callback;
+    void* data;
+    unsigned int count;
+} EntryProbe;
+
+static bool
+probe_entry(EntryProbe* probe, unsigned long addr, MuError** _err)
+{
+    MuEntryInfo entry;
+
+    if (!image_read_entry(probe->image, addr, &entry))
+    {
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Malformed test entry at %#lx", addr);
+    }
+
+    probe->count++;
+
+    return probe->callback(&entry, probe->data, _err);
+}
+
+static bool
+probe_symbol(symbol* sym, void* data, MuError** _err)
+{
+    return probe_entry((EntryProbe*) data, (unsigned long) sym->addr, _err);
+}
+
+bool
+elf_probe_entries(const char* path, EntryCallback callback, void* data, MuError** _err)
+{
+    MuError* err = NULL;
+    ElfImage image;
+    EntryProbe probe = {&image, callback, data, 0};
+    const ELF_SHDR_T* section;
+    bool result = false;
+
+    if (!image_map(&image, path, &err))
+    {
+        MU_RERAISE_RETURN(false, _err, err);
+    }
+
+    image_load_relocs(&image);
+
+    if ((section = image_find_named_section(&image, MU_ENTRY_SECTION)))
+    {
+        unsigned long addr;
+        unsigned long entry;
+
+        for (addr = section->sh_addr;
+             addr + sizeof(entry) <= section->sh_addr + section->sh_size;
+             addr += sizeof(entry))
+        {
+            if (!image_read_pointer(&image, addr, &entry))
+            {
+                MU_RAISE_GOTO(error, _err, MU_ERROR_LOAD_LIBRARY, "Malformed %s section", MU_ENTRY_SECTION);
+            }
+
+            if (!probe_entry(&probe, entry, &err))
             {
                 MU_RERAISE_GOTO(error, _err, err);
             }
-            continue;
         }
     }
+    else
+    {
+        /* Same order as a scan of a loaded library, at link-time addresses */
+        if ((section = image_find_section(&image, SHT_DYNSYM)) &&
+            !image_scan_symtab(&image, section, 0, "__mu_e_", probe_symbol, &probe, &err))
+        {
+            MU_RERAISE_GOTO(error, _err, err);
+        }
+
+        if (!probe.count && (section = image_find_section(&image, SHT_SYMTAB)) &&
+            !image_scan_symtab(&image, section, 0, "__mu_e_", probe_symbol, &probe, &err))
+        {
+            MU_RERAISE_GOTO(error, _err, err);
+        }
+    }
+
+    result = true;
 
 error:
-    if (elf)
-        elf_end(elf);
-    if (fd >= 0)
-        close(fd);
 
-    return *_err == NULL;
+    image_unmap(&image);
+
+    return result;
+}
+
+bool
+elf_find_entries(void* handle, MuEntryInfo*** start, MuEntryInfo*** end, MuError** _err)
+{
+    MuError* err = NULL;
+    Dl_info info;
+    ElfImage image;
+    const ELF_SHDR_T* section;
+
+    *start = *end = NULL;
+
+    if (!elf_library_info(handle, &info))
+    {
+        MU_RAISE_RETURN(false, _err, MU_ERROR_LOAD_LIBRARY, "Could not determine path of library file from handle");
+    }
+
+    if (!image_map(&image, info.dli_fname, &err))
+    {
+        MU_RERAISE_RETURN(false, _err, err);
+    }
+
+    /* The section is found through the library's own file, so a
+       dependency with entries of its own is never mistaken for it */
+    if ((section = image_find_named_section(&image, MU_ENTRY_SECTION)) &&
+        (section->sh_flags & SHF_ALLOC) && section->sh_type == SHT_PROGBITS)
+    {
+        *start = (MuEntryInfo**) (image_load_bias(&image, &info) + section->sh_addr);
+        *end = *start + section->sh_size / sizeof(**start);
+    }
+
+    image_unmap(&image);
+
+    return true;
+}
+
+static bool
+read_header(const char* path, ELF_EHDR_T* ehdr)
+{
+    int fd = open(path, O_RDONLY);
+    bool result;
+
+    if (fd < 0)
+        return false;
+
+    result = pread(fd, ehdr, sizeof(*ehdr), 0) == sizeof(*ehdr) &&
+        !memcmp(ehdr->e_ident, ELFMAG, SELFMAG) &&
+        ehdr->e_ident[EI_CLASS] == ELF_CLASS;
+
+    close(fd);
+
+    return result;
+}
+
+static int elf_machine = -1;
+static pthread_once_t elf_machine_once = PTHREAD_ONCE_INIT;
+
+/* Libraries are compared against the file this code was loaded from */
+static void
+elf_machine_init(void)
+{
+    ELF_EHDR_T ehdr;
+    Dl_info info;
+
+    if (dladdr((void*) elf_is_library, &info) && info.dli_fname &&
+        read_header(info.dli_fname, &ehdr))
+    {
+        elf_machine = ehdr.e_machine;
+    }
+}
+
+bool
+elf_is_library(const char* path)
+{
+    ELF_EHDR_T ehdr;
+
+    /* Libraries may be probed from several discovery threads */
+    pthread_once(&elf_machine_once, elf_machine_init);
+
+    if (elf_machine < 0)
+        return false;
+
+    return read_header(path, &ehdr) && ehdr.e_type == ET_DYN && ehdr.e_machine == elf_machine;
 }
 
 SymbolScanner 
 elf_scan_get_scanner()
 {
-	return libelf_symbol_scanner;
+	return mmap_symbol_scanner;
 }
+
+#endif
@@ -29,19 +29,46 @@
 #define __MU_INTERNAL_ELF_H__
 
 #include <stdbool.h>
+#include <dlfcn.h>
 
 #include <moonunit/error.h>
+#include <moonunit/interface.h>
 
 typedef struct
 {
 	const char* name;
 	void* addr;
+	unsigned long size;
+	bool function;
 } symbol;
 
 typedef bool (*SymbolCallback)(symbol*, void* data, MuError**);
-typedef bool (*SymbolFilter)(const char*, void* data);
-typedef bool (*SymbolScanner)(void *, SymbolFilter, SymbolCallback, void *, MuError**);
+/* Calls back for each defined symbol of a loaded library whose name
+   starts with prefix.  With dynamic set only the symbols exported to
+   the dynamic linker are scanned, otherwise the full symbol table
+   when the library has not been stripped */
+typedef bool (*SymbolScanner)(void* handle, const char* prefix, bool dynamic,
+                              SymbolCallback, void*, MuError**);
 
 SymbolScanner elf_scan_get_scanner(void);
 
+/* Finds the file and load address of a loaded library, from its link
+   map where dlinfo is available */
+bool elf_library_info(void* handle, Dl_info* info);
+
+/* Checks the file header for a shared library loadable by this process */
+bool elf_is_library(const char* path);
+
+/* Calls back for each test entry of a library file without loading
+   it.  Entries are read at their link-time addresses, so their strings
+   point into a mapping of the file that is only valid during the
+   callback, and run is always NULL */
+typedef bool (*EntryCallback)(MuEntryInfo* entry, void* data, MuError**);
+
+bool elf_probe_entries(const char* path, EntryCallback callback, void* data, MuError** err);
+
+/* Finds the entries a loaded library registered in its entry section.
+   Both bounds are NULL if it has none */
+bool elf_find_entries(void* handle, MuEntryInfo*** start, MuEntryInfo*** end, MuError** err);
+
 #endif
@@ -235,10 +235,21 @@ test_log(MuLogger* _self, MuLogEvent const* event)
     char* level_str = NULL;
     int level_code = 0;
 
-    if (self->loglevel == (MuLogLevel) -1 || event->level > self->loglevel)
+    /* Captured output is shown regardless of the log level,
+       as it would have been had it gone to the terminal */
+    if (event->kind == MU_EVENT_STDOUT)
+    {
+        level_str = "stdout"; level_code = 32;
+    }
+    else if (event->kind == MU_EVENT_STDERR)
+    {
+        level_str = "stderr"; level_code = 31;
+    }
+    else if (self->loglevel == (MuLogLevel) -1 || event->level > self->loglevel)
+    {
         return;
-
-    switch (event->level)
+    }
+    else switch (event->level)
     {
         case MU_LEVEL_WARNING:
             level_str = "warning"; level_code = 31; break;
@@ -300,6 +311,92 @@ test_log(MuLogger* _self, MuLogEvent const* event)
     }
 }
 
+static void
+print_time(FILE* out, double seconds)
+{
+    if (seconds >= 1.0)
+        fprintf(out, "%.3f s", seconds);
+    else if (seconds >= 1e-3)
+        fprintf(out, "%.3f ms", seconds * 1e3);
+    else if (seconds >= 1e-6)
+        fprintf(out, "%.3f us", seconds * 1e6);
+    else
+        fprintf(out, "%.0f ns", seconds * 1e9);
+}
+
+static void
+print_rate(FILE* out, double rate, const char* format)
+{
+    static const char* prefixes[] = { "", "k", "M", "G", "T" };
+    unsigned int i;
+
+    for (i = 0; rate >= 1000.0 && i < sizeof(prefixes) / sizeof(*prefixes) - 1; i++)
+        rate /= 1000.0;
+
+    fprintf(out, format, rate, prefixes[i]);
+}
+
+static void
+print_throughput(ConsoleLogger* self, MuTestResult* summary)
+{
+    FILE* out = self->out;
+
+    if (self->ansi)
+    {
+        fprintf(out, "      (\e[36m\e[1mthroughput\e[22m\e[0m) ");
+    }
+    else
+    {
+        fprintf(out, "      (throughput) ");
+    }
+
+    if (summary->bytes_processed)
+    {
+        print_rate(out, summary->bytes_per_second, "%.3f %sB/s");
+        fprintf(out, " (%llu bytes)", summary->bytes_processed);
+    }
+
+    if (summary->bytes_processed && summary->items_processed)
+    {
+        fprintf(out, ", ");
+    }
+
+    if (summary->items_processed)
+    {
+        print_rate(out, summary->items_per_second, "%.3f%s items/s");
+        fprintf(out, " (%llu items)", summary->items_processed);
+    }
+
+    fprintf(out, "\n");
+}
+
+static void
+print_benchmark(ConsoleLogger* self, MuBenchmark* bench)
+{
+    FILE* out = self->out;
+
+    if (self->ansi)
+    {
+        fprintf(out, "      (\e[36m\e[1mbenchmark\e[22m\e[0m) ");
+    }
+    else
+    {
+        fprintf(out, "      (benchmark) ");
+    }
+
+    fprintf(out, "%u iterations after %u warmup (%s): mean ",
+            bench->iterations, bench->warmup,
+            bench->steady ? "steady" : "not steady");
+    print_time(out, bench->mean);
+    fprintf(out, ", min ");
+    print_time(out, bench->min);
+    fprintf(out, ", max ");
+    print_time(out, bench->max);
+    fprintf(out, ", stddev ");
+    print_time(out, bench->stddev);
+    fprintf(out, "\n");
+}
+
 static void
 test_leave(MuLogger* _self, MuTest* test, MuTestResult* summary)
 {
@@ -443,6 +540,16 @@ test_leave(MuLogger* _self, MuTest* test, MuTestResult* summary)
             }
         }
 	}
+
+    if (summary->benchmark)
+    {
+        print_benchmark(self, summary->benchmark);
+    }
+
+    if (summary->bytes_processed || summary->items_processed)
+    {
+        print_throughput(self, summary);
+    }
 }
 
 static
@@ -668,7 +775,7 @@ create_consolelogger()
 
 static MuPlugin plugin =
 {
-    .version = MU_PLUGIN_API_1,
+    .version = MU_PLUGIN_API_2,
     .type = MU_PLUGIN_LOGGER,
     .name = "console",
     .author = "Brian Koropoff",
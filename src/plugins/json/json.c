@@ -227,6 +227,24 @@ integer(JsonLogger* self, int value)
     print(self, "%d", value);
 }
 
+static void
+count(JsonLogger* self, unsigned long long value)
+{
+    print(self, "%llu", value);
+}
+
+static void
+real(JsonLogger* self, double value)
+{
+    print(self, "%g", value);
+}
+
+static void
+boolean(JsonLogger* self, bool value)
+{
+    output(self, value ? "true" : "false");
+}
+
 static void
 key_string(JsonLogger* self, char const* key, char const* value)
 {
@@ -243,6 +261,30 @@ key_integer(JsonLogger* self, char const* key, int value)
     key_end(self);
 }
 
+static void
+key_count(JsonLogger* self, char const* key, unsigned long long value)
+{
+    key_begin(self, key);
+    count(self, value);
+    key_end(self);
+}
+
+static void
+key_real(JsonLogger* self, char const* key, double value)
+{
+    key_begin(self, key);
+    real(self, value);
+    key_end(self);
+}
+
+static void
+key_boolean(JsonLogger* self, char const* key, bool value)
+{
+    key_begin(self, key);
+    boolean(self, value);
+    key_end(self);
+}
+
 static void
 key_array_begin(JsonLogger* self, char const* key)
 {
@@ -394,7 +436,7 @@ static void test_log(MuLogger* _self, MuLogEvent const* event)
     JsonLogger* self = (JsonLogger*) _self;
     const char* level_str = "unknown";
 
-    if (event->level > self->loglevel)
+    if (event->kind == MU_EVENT_MESSAGE && event->level > self->loglevel)
     {
         return;
     }
@@ -419,6 +461,12 @@ static void test_log(MuLogger* _self, MuLogEvent const* event)
             level_str = "trace"; break;
     }
 
+    /* Captured output is recorded as an event named after its stream */
+    if (event->kind == MU_EVENT_STDOUT)
+        level_str = "stdout";
+    else if (event->kind == MU_EVENT_STDERR)
+        level_str = "stderr";
+
     elem_object_begin(self);
 
     key_string(self, "level", level_str);
@@ -505,6 +553,31 @@ static void test_leave(MuLogger* _self,
         key_array_end(self);
     }
 
+    if (summary->benchmark)
+    {
+        MuBenchmark* bench = summary->benchmark;
+
+        key_object_begin(self, "benchmark");
+        key_integer(self, "iterations", bench->iterations);
+        key_integer(self, "warmup", bench->warmup);
+        key_boolean(self, "steady", bench->steady);
+        key_real(self, "mean", bench->mean);
+        key_real(self, "min", bench->min);
+        key_real(self, "max", bench->max);
+        key_real(self, "stddev", bench->stddev);
+        key_object_end(self);
+    }
+
+    if (summary->bytes_processed || summary->items_processed)
+    {
+        key_object_begin(self, "throughput");
+        key_count(self, "bytes", summary->bytes_processed);
+        key_count(self, "items", summary->items_processed);
+        key_real(self, "bytes_per_second", summary->bytes_per_second);
+        key_real(self, "items_per_second", summary->items_per_second);
+        key_object_end(self);
+    }
+
     elem_object_end(self);
 }
 
@@ -695,7 +768,7 @@ create_jsonlogger()
 
 static MuPlugin plugin =
 {
-    .version = MU_PLUGIN_API_1,
+    .version = MU_PLUGIN_API_2,
     .type = MU_PLUGIN_LOGGER,
     .name = "json",
     .author = "Brian Koropoff",
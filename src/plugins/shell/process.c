@@ -36,6 +36,8 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 
 #include "process.h"
 
@@ -71,6 +73,8 @@ int process_open(Process* handle, char * const argv[],
                 goto error;
             }
             handle->channels[i].fd = pipes[i][0];
+            /* Reading a partial line must not wait for the rest */
+            fcntl(pipes[i][0], F_SETFL, O_NONBLOCK);
             break;
         case PROCESS_CHANNEL_OUT:
             if (pipe(pipes[i]))
@@ -144,10 +148,12 @@ int process_open(Process* handle, char * const argv[],
             switch (handle->channels[i].direction)
             {
             case PROCESS_CHANNEL_IN:
+            case PROCESS_CHANNEL_NULL_IN:
                 if (pipes[i][1] >= 0)
                     close(pipes[i][1]);
                 break;
             case PROCESS_CHANNEL_OUT:
+            case PROCESS_CHANNEL_NULL_OUT:
                 if (pipes[i][0] >= 0)
                     close(pipes[i][0]);
                 break;
@@ -165,61 +171,94 @@ error:
     return status;
 }
 
+/*
+ * Returns the length of the next line read from a channel, 0 at the end
+ * of input, or PROCESS_NO_LINE if no complete line has arrived yet; the
+ * channel is then not ready until it has been selected again.  The line is handed out in place, with its newline
+ * replaced by a terminator, and is only valid until the next read from
+ * the channel.  Unread input is kept at buffer[start, start + filled),
+ * and the first scanned bytes of it are known to hold no newline, so
+ * each byte is searched once however it arrives.  Space is reclaimed by
+ * moving the unread input down only when the end of the buffer is
+ * reached, and the buffer grows instead when that input fills over half
+ * of it.
+ */
 int
 process_channel_read_line(Process* handle, unsigned int cnum, char** out)
 {
-    int res = 0;
     ProcessChannel* channel = &handle->channels[cnum];
-    unsigned int filled;
+    char* line;
     char* newline;
+    ssize_t res;
+    int len;
 
     if (!channel->buffer)
     {
         channel->bufferlen = 1024;
         channel->buffer = xmalloc(channel->bufferlen);
-        channel->buffer[0] = '\0';
     }
 
-    newline = strchr(channel->buffer, '\n');
+    if (!channel->filled)
+        channel->start = channel->scanned = 0;
 
-    while (!newline)
+    while (!(newline = memchr(channel->buffer + channel->start + channel->scanned, '\n',
+                              channel->filled - channel->scanned)))
     {
-        filled = strlen(channel->buffer);
-    
-        if (filled + 1 == channel->bufferlen)
+        channel->scanned = channel->filled;
+
+        if (channel->start + channel->filled == channel->bufferlen)
         {
-            channel->bufferlen *= 2;
-            channel->buffer = xrealloc(channel->buffer, channel->bufferlen);
+            if (channel->filled > channel->bufferlen / 2)
+            {
+                channel->bufferlen *= 2;
+                channel->buffer = xrealloc(channel->buffer, channel->bufferlen);
+            }
+            else
+            {
+                memmove(channel->buffer, channel->buffer + channel->start, channel->filled);
+                channel->start = 0;
+            }
         }
 
-        res = read(channel->fd, channel->buffer + filled, channel->bufferlen - filled - 1);
+        res = read(channel->fd, channel->buffer + channel->start + channel->filled,
+                   channel->bufferlen - channel->start - channel->filled);
 
-        if (res <= 0)
+        if (res < 0 && errno == EINTR)
+            continue;
+
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
         {
-            newline = NULL;
-            break;
+            channel->ready = 0;
+            return PROCESS_NO_LINE;
         }
-        else
+
+        if (res <= 0)
         {
-            channel->buffer[res] = '\0';
-            newline = strchr(channel->buffer, '\n');
+            channel->ready = 0;
+            return 0;
         }
+
+        channel->filled += res;
     }
 
-    if (newline)
-    {
-        res = newline - channel->buffer + 1;
-        *out = xmalloc(res + 1);
-        memcpy(*out, channel->buffer, res);
-        (*out)[res] = '\0';
+    line = channel->buffer + channel->start;
+    len = newline - line + 1;
+    *newline = '\0';
+    *out = line;
+
+    channel->start += len;
+    channel->filled -= len;
+    channel->scanned = 0;
 
-        memmove(channel->buffer, channel->buffer + res, channel->bufferlen - res);
-        newline = strchr(channel->buffer, '\n');
+    if (memchr(channel->buffer + channel->start, '\n', channel->filled))
+        channel->ready = 1;
+    else
+    {
+        channel->ready = 0;
+        channel->scanned = channel->filled;
     }
-    
-    channel->ready = (newline != NULL);
 
-    return res;
+    return len;
 }
 
 int
@@ -230,41 +269,56 @@ process_channel_write(Process* handle, unsigned int cnum, const void* data, size
     return write(channel->fd, data, len);
 }
 
-static
-void
-timeval_diff(struct timeval* from, struct timeval* to, struct timeval* diff)
+/* Milliseconds until a deadline, rounded up, for poll */
+static int
+process_poll_timeout(ProcessTimeout* abs)
 {
-    diff->tv_sec = to->tv_sec - from->tv_sec;
-    diff->tv_usec = to->tv_usec - from->tv_usec;
+    struct timeval now;
+    long ms;
 
-    while (diff->tv_usec < 0)
-    {
-        diff->tv_usec += 1000000;
-        diff->tv_sec -= 1;
-    }
+    if (!abs)
+        return -1;
+
+    gettimeofday(&now, NULL);
+
+    ms = (abs->seconds - now.tv_sec) * 1000 +
+         (abs->microseconds - now.tv_usec + 999) / 1000;
+
+    return ms > 0 ? ms : 0;
+}
 
-    while (diff->tv_usec > 1000000)
+static short
+process_poll_events(ProcessChannel* channel)
+{
+    switch (channel->direction)
     {
-        diff->tv_sec += 1;
-        diff->tv_usec -= 1000000;
+    case PROCESS_CHANNEL_IN:
+        return POLLIN;
+    case PROCESS_CHANNEL_OUT:
+        return POLLOUT;
+    default:
+        return 0;
     }
 }
 
+/* A hung up or failed channel is ready too, so that reading or
+   writing it reports the problem instead of blocking */
+static bool
+process_poll_ready(struct pollfd* pfd)
+{
+    return pfd->revents & (pfd->events | POLLHUP | POLLERR | POLLNVAL);
+}
+
 int
 process_select(Process* handle, ProcessTimeout* abs, unsigned int cnum, ...)
 {
-    int maxfd = 0;
-    fd_set readfds;
-    fd_set writefds;
+    struct pollfd* pfds = xmalloc(cnum * sizeof(*pfds));
+    unsigned int* indices = xmalloc(cnum * sizeof(*indices));
     int i;
     int res;
     int already_ready = 0;
-    struct timeval timeout, now, target;
     va_list ap;
 
-    FD_ZERO(&readfds);
-    FD_ZERO(&writefds);
-
     va_start(ap, cnum);
 
     for (i = 0; i < cnum; i++)
@@ -275,64 +329,105 @@ process_select(Process* handle, ProcessTimeout* abs, unsigned int cnum, ...)
         if (channel->ready)
             already_ready++;
 
-        if (channel->fd > maxfd)
-            maxfd = channel->fd;
-        
-        switch (channel->direction)
+        indices[i] = cindex;
+        pfds[i].fd = channel->fd;
+        pfds[i].events = process_poll_events(channel);
+        pfds[i].revents = 0;
+    }
+
+    va_end(ap);
+
+    if (already_ready)
+    {
+        res = already_ready;
+        goto done;
+    }
+
+    res = poll(pfds, cnum, process_poll_timeout(abs));
+    
+    if (res >= 1)
+    {
+        for (i = 0; i < cnum; i++)
         {
-        case PROCESS_CHANNEL_IN:
-            FD_SET(channel->fd, &readfds);
-            break;
-        case PROCESS_CHANNEL_OUT:
-            FD_SET(channel->fd, &writefds);
-            break;
-        default:
-            break;
+            if (process_poll_ready(&pfds[i]))
+                handle->channels[indices[i]].ready = 1;
         }
     }
 
-    va_end(ap);
+done:
+
+    free(indices);
+    free(pfds);
+
+    return res;
+}
+
+int
+process_select_any(Process** handles, ProcessTimeout** deadlines,
+                   unsigned int count, unsigned int cnum)
+{
+    struct pollfd* pfds = NULL;
+    unsigned int i;
+    int res;
+    int already_ready = 0;
+    ProcessTimeout* earliest = NULL;
+
+    for (i = 0; i < count; i++)
+    {
+        if (handles[i]->channels[cnum].ready)
+            already_ready++;
+
+        if (deadlines[i] &&
+            (!earliest ||
+             deadlines[i]->seconds < earliest->seconds ||
+             (deadlines[i]->seconds == earliest->seconds &&
+              deadlines[i]->microseconds < earliest->microseconds)))
+        {
+            earliest = deadlines[i];
+        }
+    }
 
     if (already_ready)
         return already_ready;
 
-    if (abs)
+    pfds = xmalloc(count * sizeof(*pfds));
+
+    for (i = 0; i < count; i++)
     {
-        target.tv_sec = abs->seconds;
-        target.tv_usec = abs->microseconds;
-        
-        gettimeofday(&now, NULL);
-        
-        timeval_diff(&now, &target, &timeout);
+        ProcessChannel* channel = &handles[i]->channels[cnum];
+
+        pfds[i].fd = channel->fd;
+        pfds[i].events = process_poll_events(channel);
+        pfds[i].revents = 0;
     }
 
-    res = select(maxfd + 1, &readfds, &writefds, NULL, abs ? &timeout : NULL);
-    
+    res = poll(pfds, count, process_poll_timeout(earliest));
+
     if (res >= 1)
     {
-        for (i = 0; i < handle->num_channels; i++)
+        for (i = 0; i < count; i++)
         {
-            ProcessChannel* channel = &handle->channels[i];
-
-            switch (channel->direction)
-            {
-            case PROCESS_CHANNEL_IN:
-                if (FD_ISSET(channel->fd, &readfds))
-                    channel->ready = 1;
-                break;
-            case PROCESS_CHANNEL_OUT:
-                if (FD_ISSET(channel->fd, &writefds))
-                    channel->ready = 1;
-                break;
-            default:
-                break;
-            }
+            if (process_poll_ready(&pfds[i]))
+                handles[i]->channels[cnum].ready = 1;
         }
     }
 
+    free(pfds);
+
     return res;
 }
 
+int
+process_time_passed(ProcessTimeout* abs)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return (now.tv_sec > abs->seconds ||
+            (now.tv_sec == abs->seconds && now.tv_usec >= abs->microseconds));
+}
+
 int
 process_finished(Process* handle, int* status)
 {
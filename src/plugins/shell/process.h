@@ -49,6 +49,9 @@ typedef struct
     int ready;
     char* buffer;
     size_t bufferlen;
+    size_t start;
+    size_t filled;
+    size_t scanned;
 } ProcessChannel;
 
 typedef struct
@@ -66,9 +69,15 @@ typedef struct
 
 int process_open(Process* handle, char * const argv[],
                  unsigned long num_channels, ...);
+/* Returned by process_channel_read_line while a line is incomplete */
+#define PROCESS_NO_LINE (-1)
+
 int process_channel_read_line(Process* handle, unsigned int channel, char** out);
 int process_channel_write(Process* handle, unsigned int channel, const void* data, size_t len);
 int process_select(Process* handle, ProcessTimeout* abs, unsigned int cnum, ...);
+int process_select_any(Process** handles, ProcessTimeout** deadlines,
+                       unsigned int count, unsigned int cnum);
+int process_time_passed(ProcessTimeout* abs);
 int process_channel_ready(Process* handle, int cnum);
 int process_finished(Process* handle, int* status);
 void process_close(Process* handle);
@@ -29,11 +29,14 @@
 #include "sh-exec.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <signal.h>
 
 #include <moonunit/resource.h>
 
 char* mu_sh_helper_path = LIBEXEC_PATH "/mu.sh";
 int mu_sh_timeout = 10000;
+bool mu_sh_persistent = true;
 
 void mu_sh_exec(Process* handle, const char* script, const char* command)
 {
@@ -64,6 +67,231 @@ void mu_sh_exec(Process* handle, const char* script, const char* command)
                  PROCESS_CHANNEL_IN); /* Input process command channel */
 }
 
+/*
+ * Persistent servers
+ *
+ * Starting bash and sourcing the helper and the test script dominates
+ * the cost of short shell tests.  In persistent mode each library keeps
+ * bash processes running mu_serve, which reads commands from the command
+ * input channel and runs each one in a forked subshell that leads its
+ * own process group.  The subshell announces itself with PID before
+ * anything else, and the server sends DONE once it has exited, so the
+ * harness can kill a command that halted after its result, or timed
+ * out, and then wait for the server to be ready again.  A server runs
+ * one command at a time; more are started when tests run concurrently.
+ * A server that cannot be reached is replaced, and commands fall back
+ * to a bash of their own if no server can be started.
+ */
+
+static bool
+mu_sh_server_send(ShServer* server, const char* command)
+{
+    struct sigaction ignore, original;
+    size_t len = strlen(command);
+    bool result;
+
+    /* A dead server must not take the harness down with it */
+    ignore.sa_handler = SIG_IGN;
+    ignore.sa_flags = 0;
+    sigemptyset(&ignore.sa_mask);
+
+    sigaction(SIGPIPE, &ignore, &original);
+    result = process_channel_write(&server->process, MU_SH_CMD_IN, command, len) == (int) len &&
+             process_channel_write(&server->process, MU_SH_CMD_IN, "\n", 1) == 1;
+    sigaction(SIGPIPE, &original, NULL);
+
+    return result;
+}
+
+static void
+mu_sh_server_close(ShServer* server)
+{
+    if (server->serving)
+    {
+        process_close(&server->process);
+        server->serving = false;
+    }
+}
+
+void
+mu_sh_server_stop(ShLibrary* library)
+{
+    unsigned int i;
+
+    for (i = 0; i < array_size((array*) library->servers); i++)
+    {
+        mu_sh_server_close(library->servers[i]);
+        free(library->servers[i]);
+    }
+
+    array_free((array*) library->servers);
+    library->servers = NULL;
+}
+
+/* Find an idle server, starting one if there is none */
+static ShServer*
+mu_sh_server_acquire(ShLibrary* library)
+{
+    ShServer* server = NULL;
+    unsigned int i;
+    int status;
+
+    for (i = 0; i < array_size((array*) library->servers); i++)
+    {
+        if (!library->servers[i]->busy)
+        {
+            server = library->servers[i];
+            break;
+        }
+    }
+
+    if (!server)
+    {
+        server = xcalloc(1, sizeof(*server));
+        library->servers = (ShServer**) array_append((array*) library->servers, server);
+    }
+
+    if (server->serving && process_finished(&server->process, &status))
+    {
+        mu_sh_server_close(server);
+    }
+
+    if (!server->serving)
+    {
+        mu_sh_exec(&server->process, library->path, "mu_serve");
+        server->serving = server->process.pid > 0;
+    }
+
+    return server->serving ? server : NULL;
+}
+
+void
+mu_sh_run_begin(ShRun* run, ShLibrary* library, const char* command)
+{
+    ShServer* server;
+
+    memset(run, 0, sizeof(*run));
+
+    run->library = library;
+
+    if (mu_sh_persistent && (server = mu_sh_server_acquire(library)))
+    {
+        if (mu_sh_server_send(server, command))
+        {
+            server->busy = true;
+            run->server = server;
+            run->process = &server->process;
+            return;
+        }
+
+        mu_sh_server_close(server);
+    }
+
+    mu_sh_exec(&run->own, library->path, command);
+    run->process = &run->own;
+}
+
+/* Takes a line from a run whose command channel is ready.  Returns 1
+   with a line for the caller, 0 once the command has finished, or -1
+   if there is none for the caller yet: the line was only meant for the
+   harness, or has not been completed.  The caller then goes back to
+   waiting, so deadlines are still checked.  The line points into the
+   channel buffer and is only valid until the next read */
+static int
+mu_sh_run_take(ShRun* run, char** line)
+{
+    int status;
+    int len;
+
+    if (run->watch_exit && !run->server &&
+        process_finished(run->process, &status))
+    {
+        run->finished = true;
+        return 0;
+    }
+
+    if (!process_channel_ready(run->process, MU_SH_CMD_OUT))
+        return -1;
+
+    if ((len = process_channel_read_line(run->process, MU_SH_CMD_OUT, line)) == PROCESS_NO_LINE)
+        return -1;
+
+    if (!len)
+    {
+        run->finished = true;
+        return 0;
+    }
+
+    if (run->server)
+    {
+        /* The server ends what a stopped command left unfinished
+           with an empty line */
+        if (!**line)
+            return -1;
+
+        if (!strncmp(*line, "PID\f", 4))
+        {
+            run->pid = atoi(*line + 4);
+            return -1;
+        }
+        else if (!strcmp(*line, "DONE"))
+        {
+            run->finished = true;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Returns 1 with the next line of the command channel, valid until
+   the next read, 0 once the command has finished, or -1 if it timed out */
+int
+mu_sh_run_read(ShRun* run, ProcessTimeout* timeout, char** line)
+{
+    int res;
+
+    while (!run->finished)
+    {
+        if (process_select(run->process, timeout, 1, MU_SH_CMD_OUT) <= 0)
+            return -1;
+
+        if ((res = mu_sh_run_take(run, line)) >= 0)
+            return res;
+    }
+
+    return 0;
+}
+
+void
+mu_sh_run_end(ShRun* run)
+{
+    ProcessTimeout timeout;
+    char* line;
+    int res;
+
+    if (!run->server)
+    {
+        process_close(&run->own);
+        return;
+    }
+
+    /* Stop the command and anything it started, then wait for the
+       server to report it gone so its output is not mistaken for
+       that of the next command */
+    if (run->pid > 0)
+        kill(-run->pid, SIGTERM);
+
+    process_get_time(&timeout, mu_sh_timeout);
+
+    while ((res = mu_sh_run_read(run, &timeout, &line)) > 0);
+
+    if (res < 0 || run->pid <= 0)
+        mu_sh_server_close(run->server);
+
+    run->server->busy = false;
+}
+
 static char*
 mu_sh_get_token(char** ptokens)
 {
@@ -194,6 +422,7 @@ mu_sh_process_event(MuLogCallback lcb, void* data, char** ptokens)
     char* line = mu_sh_get_token(ptokens);
     char* message = mu_sh_get_token(ptokens);
 
+    event.kind = MU_EVENT_MESSAGE;
     event.level = mu_sh_string_to_log_level(level);
     event.stage = mu_sh_string_to_test_stage(stage);
     event.file = file;
@@ -330,60 +559,236 @@ mu_sh_process_result_command(Process* process, MuTestResult* result, char* cmd)
     }
 }
 
+/* Fill in the result of a test from how its run ended: 1 if the test
+   reported a result, 0 if it finished without one, -1 if it timed out */
+static void
+mu_sh_conclude(MuTestResult* result, int res)
+{
+    if (res < 0)
+    {
+        result->status = MU_STATUS_TIMEOUT;
+        result->stage = MU_STAGE_UNKNOWN;
+        result->reason = format("Test timed out");
+    }
+    else if (res == 0)
+    {
+        /* Finishing without a result counts as success */
+        result->status = MU_STATUS_SUCCESS;
+    }
+}
+
+static char*
+mu_sh_test_command(ShTest* test)
+{
+    return format("mu_run_test '%s' '%s' '%s'", test->suite, test->name, test->function);
+}
+
 struct MuTestResult*
 mu_sh_dispatch (ShTest* test, MuLogCallback lcb, void* data)
 {
-    Process handle;
+    ShRun run;
     ProcessTimeout timeout;
     MuTestResult* result = xcalloc(1, sizeof(*result));
     int res;
     char* command;
+    char* line;
 
     process_get_time(&timeout, mu_sh_timeout);
 
-    command = format("mu_run_test '%s' '%s' '%s'", test->suite, test->name, test->function);
+    command = mu_sh_test_command(test);
 
-    mu_sh_exec(&handle, ((ShLibrary*)test->base.library)->path, command);
+    mu_sh_run_begin(&run, (ShLibrary*) test->base.library, command);
 
     free(command);
 
-    while ((res = process_select(&handle, &timeout, 1, MU_SH_CMD_OUT)) > 0)
+    while ((res = mu_sh_run_read(&run, &timeout, &line)) > 0)
+    {
+        if (mu_sh_process_command(run.process, result, &timeout, line, test, lcb, data))
+            break;
+    }
+    
+    mu_sh_conclude(result, res > 0 ? 1 : res);
+
+    mu_sh_run_end(&run);
+
+    return result;
+}
+
+/*
+ * Concurrent tests
+ *
+ * Tests started with mu_sh_start each run in a server of their own (or
+ * a bash of their own), so several can make progress at once.  While
+ * waiting for one test, mu_sh_finish services the command channels of
+ * every running test of the library, answering resource requests and
+ * noting results as they arrive.  Log events are held back and passed
+ * on when the test is finished, so the events of each test reach the
+ * logger together and in the order they were sent.  Each test is timed
+ * from its own start, and a test is stopped as soon as it has reported
+ * its result to free its server for the next one.
+ */
+
+struct ShPending
+{
+    ShRun run;
+    ShTest* test;
+    MuTestResult* result;
+    ProcessTimeout timeout;
+    /* LOG lines not yet passed on */
+    char** events;
+    /* How the run ended, as for mu_sh_conclude */
+    int res;
+    bool done;
+};
+
+int mu_sh_jobs = 1;
+
+static unsigned int
+mu_sh_running(ShLibrary* library)
+{
+    unsigned int i;
+    unsigned int count = 0;
+
+    for (i = 0; i < array_size((array*) library->pending); i++)
     {
-        if (process_channel_ready(&handle, 4))
+        if (!library->pending[i]->done)
+            count++;
+    }
+
+    return count;
+}
+
+ShPending*
+mu_sh_start(ShTest* test)
+{
+    ShLibrary* library = (ShLibrary*) test->base.library;
+    ShPending* pending = NULL;
+    char* command;
+
+    /* One job at a time is left to mu_sh_dispatch,
+       which passes on events as they happen */
+    if (mu_sh_jobs <= 1 || mu_sh_running(library) >= (unsigned int) mu_sh_jobs)
+        return NULL;
+
+    pending = xcalloc(1, sizeof(*pending));
+    pending->test = test;
+    pending->result = xcalloc(1, sizeof(*pending->result));
+
+    process_get_time(&pending->timeout, mu_sh_timeout);
+
+    command = mu_sh_test_command(test);
+    mu_sh_run_begin(&pending->run, library, command);
+    free(command);
+
+    library->pending = (ShPending**) array_append((array*) library->pending, pending);
+
+    return pending;
+}
+
+static void
+mu_sh_pending_done(ShPending* pending, int res)
+{
+    pending->res = res;
+    pending->done = true;
+    mu_sh_run_end(&pending->run);
+}
+
+/* Handle a line from a test whose command channel is ready */
+static void
+mu_sh_pending_service(ShPending* pending)
+{
+    char* line = NULL;
+    int res = mu_sh_run_take(&pending->run, &line);
+
+    if (res == 0)
+    {
+        mu_sh_pending_done(pending, 0);
+    }
+    else if (res > 0)
+    {
+        if (!strncmp(line, "LOG\f", 4))
         {
-            char* line;
-            unsigned int len;
-
-            if ((len = process_channel_read_line(&handle, MU_SH_CMD_OUT, &line)))
-            {
-                line[len - 1] = '\0';
-                if (mu_sh_process_command(&handle, result, &timeout, line, test, lcb, data))
-                {
-                    free(line);
-                    break;
-                }
-                free(line);
-            }
-            else if (len == 0)
-            {
-                break;
-            }
+            /* The line is only valid until the next read */
+            pending->events = (char**) array_append((array*) pending->events, strdup(line));
+        }
+        else if (mu_sh_process_command(pending->run.process, pending->result, &pending->timeout,
+                                       line, pending->test, NULL, NULL))
+        {
+            mu_sh_pending_done(pending, 1);
         }
     }
-    
-    if (res <= 0)
+}
+
+/* Wait until any running test of a library has made progress */
+static void
+mu_sh_pending_poll(ShLibrary* library)
+{
+    unsigned int size = array_size((array*) library->pending);
+    Process** handles = xmalloc(size * sizeof(*handles));
+    ProcessTimeout** deadlines = xmalloc(size * sizeof(*deadlines));
+    ShPending** waiting = xmalloc(size * sizeof(*waiting));
+    unsigned int count = 0;
+    unsigned int i;
+
+    for (i = 0; i < size; i++)
     {
-        result->status = MU_STATUS_TIMEOUT;
-        result->stage = MU_STAGE_UNKNOWN;
-        result->reason = format("Test timed out");
+        ShPending* pending = library->pending[i];
+
+        if (!pending->done)
+        {
+            waiting[count] = pending;
+            handles[count] = pending->run.process;
+            deadlines[count] = &pending->timeout;
+            count++;
+        }
     }
-    else
+
+    if (count)
+        process_select_any(handles, deadlines, count, MU_SH_CMD_OUT);
+
+    for (i = 0; i < count; i++)
     {
-        result->status = MU_STATUS_SUCCESS;
-        result->expected = MU_STATUS_SUCCESS;
+        ShPending* pending = waiting[i];
+
+        if (process_channel_ready(pending->run.process, MU_SH_CMD_OUT))
+            mu_sh_pending_service(pending);
+        else if (process_time_passed(&pending->timeout))
+            mu_sh_pending_done(pending, -1);
     }
 
-    process_close(&handle);
+    free(waiting);
+    free(deadlines);
+    free(handles);
+}
+
+struct MuTestResult*
+mu_sh_finish(ShPending* pending, MuLogCallback lcb, void* data)
+{
+    ShLibrary* library = (ShLibrary*) pending->test->base.library;
+    MuTestResult* result = pending->result;
+    unsigned int i;
+
+    while (!pending->done)
+    {
+        mu_sh_pending_poll(library);
+    }
+
+    for (i = 0; i < array_size((array*) pending->events); i++)
+    {
+        char* tokens = pending->events[i];
+
+        mu_sh_get_token(&tokens);
+        mu_sh_process_event(lcb, data, &tokens);
+        free(pending->events[i]);
+    }
+
+    array_free((array*) pending->events);
+
+    mu_sh_conclude(result, pending->res);
+
+    library->pending = (ShPending**) array_remove((array*) library->pending, pending);
+
+    free(pending);
 
     return result;
 }
@@ -391,46 +796,22 @@ mu_sh_dispatch (ShTest* test, MuLogCallback lcb, void* data)
 static MuTestResult*
 mu_sh_run_limited(ShLibrary* library, const char* command)
 {
-    Process handle;
+    ShRun run;
     ProcessTimeout timeout;
     MuTestResult* result = xcalloc(1, sizeof(*result));
-    int res;
+    char* line;
     
     process_get_time(&timeout, mu_sh_timeout);
-    mu_sh_exec(&handle, library->path, command);
+    mu_sh_run_begin(&run, library, command);
+    run.watch_exit = true;
     
-    while ((res = process_select(&handle, &timeout, 1, MU_SH_CMD_OUT)) > 0)
+    while (mu_sh_run_read(&run, &timeout, &line) > 0)
     {
-        int status;
-
-        if (process_finished(&handle, &status))
-        {
+        if (mu_sh_process_result_command(run.process, result, line))
             break;
-        }
-
-        if (process_channel_ready(&handle, 4))
-        {
-            char* line;
-            unsigned int len;
-            
-            if ((len = process_channel_read_line(&handle, MU_SH_CMD_OUT, &line)))
-            {
-                line[len - 1] = '\0';
-                if (mu_sh_process_result_command(&handle, result, line))
-                {
-                    free(line);
-                    break;
-                }
-                free(line);
-            }
-            else if (len == 0)
-            {
-                break;
-            }
-        }
     }
 
-    process_close(&handle);
+    mu_sh_run_end(&run);
 
     return result;
 }
@@ -41,10 +41,36 @@
 
 extern char* mu_sh_helper_path;
 extern int mu_sh_timeout;
+extern bool mu_sh_persistent;
+extern int mu_sh_jobs;
+
+typedef struct ShPending ShPending;
+
+/* A command running in the library's server, or in a bash of its own */
+typedef struct ShRun
+{
+    ShLibrary* library;
+    ShServer* server;
+    Process* process;
+    Process own;
+    /* Process group of the command in the server */
+    pid_t pid;
+    bool finished;
+    /* Stop reading once a one-off bash exits, even if its
+       command channel is still held open by its children */
+    bool watch_exit;
+} ShRun;
 
 void mu_sh_exec(Process* handle, const char* script, const char* command);
+void mu_sh_run_begin(ShRun* run, ShLibrary* library, const char* command);
+int mu_sh_run_read(ShRun* run, ProcessTimeout* timeout, char** line);
+void mu_sh_run_end(ShRun* run);
+void mu_sh_server_stop(ShLibrary* library);
 struct MuTestResult*
 mu_sh_dispatch (ShTest* test, MuLogCallback lcb, void* data);
+ShPending* mu_sh_start(ShTest* test);
+struct MuTestResult*
+mu_sh_finish(ShPending* pending, MuLogCallback lcb, void* data);
 void mu_sh_construct (ShLibrary* library, MuError** error);
 void mu_sh_destruct (ShLibrary* library, MuError** error);
 #endif
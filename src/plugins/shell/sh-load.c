@@ -52,11 +52,10 @@ static struct MuLibrary*
 sh_open (struct MuLoader* self, const char* path, MuError** err)
 {
     ShLibrary* library = NULL;
-    Process handle;
+    ShRun run;
     array* tests = NULL;
     char* line = NULL;
     char* dot = NULL;
-    unsigned int len;
     struct stat statbuf;
     
     /* As a sanity check, make sure the file is actually valid */
@@ -84,16 +83,15 @@ sh_open (struct MuLoader* self, const char* path, MuError** err)
         *dot = '\0';
     }
 
-    mu_sh_exec(&handle, path, "mu_enum_test_functions >& ${MU_CMD_OUT}");
+    mu_sh_run_begin(&run, library, "mu_enum_test_functions >& ${MU_CMD_OUT}");
 
-    while ((len = process_channel_read_line(&handle, 4, &line)))
+    while (mu_sh_run_read(&run, NULL, &line) > 0)
     {
         ShTest* test = xcalloc(1, sizeof(ShTest));
         char* div1, *div2;
 
-        line[len-1] = '\0';
         div1 = strchr(line, '_');
-        div2 = strchr(div1+1, '_');
+        div2 = div1 ? strchr(div1+1, '_') : NULL;
 
         if (div1 && div2)
         {
@@ -108,11 +106,13 @@ sh_open (struct MuLoader* self, const char* path, MuError** err)
 
             tests = array_append(tests, test);
         }
-
-        free(line);
+        else
+        {
+            free(test);
+        }
     }
 
-    process_close(&handle);
+    mu_sh_run_end(&run);
 
     library->tests = (ShTest**) tests;
 
@@ -157,6 +157,9 @@ sh_close (struct MuLoader* self, struct MuLibrary* handle)
         array_free((array*) library->tests);
     }
 
+    array_free((array*) library->pending);
+    mu_sh_server_stop(library);
+
     free((char*) library->path);
     free(library->name);
     free(library);
@@ -213,6 +216,20 @@ sh_dispatch (struct MuLoader* self, struct MuTest* handle, MuLogCallback lcb, vo
     return mu_sh_dispatch (test, lcb, data);
 }
 
+static void*
+sh_start (struct MuLoader* self, struct MuTest* handle, MuLogLevel max_level)
+{
+    ShTest* test = (ShTest*) handle;
+
+    return mu_sh_start (test);
+}
+
+static struct MuTestResult*
+sh_finish (struct MuLoader* self, void* run, MuLogCallback lcb, void* data)
+{
+    return mu_sh_finish ((ShPending*) run, lcb, data);
+}
+
 static void
 sh_free_result (struct MuLoader* self, struct MuTestResult* result)
 {
@@ -260,12 +277,41 @@ timeout_get(MuLoader* self)
     return mu_sh_timeout;
 }
 
+static void
+persistent_set(MuLoader* self, bool persistent)
+{
+    mu_sh_persistent = persistent;
+}
+
+static bool
+persistent_get(MuLoader* self)
+{
+    return mu_sh_persistent;
+}
+
+static void
+jobs_set(MuLoader* self, int jobs)
+{
+    mu_sh_jobs = jobs;
+}
+
+static int
+jobs_get(MuLoader* self)
+{
+    return mu_sh_jobs;
+}
+
 static MuOption cloader_options[] =
 {
     MU_OPTION("helper", MU_TYPE_STRING, helper_get, helper_set,
               "Path to the helper function script"),
     MU_OPTION("timeout", MU_TYPE_INTEGER, timeout_get, timeout_set,
               "Default time in milliseconds before tests time out"),
+    MU_OPTION("persistent", MU_TYPE_BOOLEAN, persistent_get, persistent_set,
+              "Whether to keep one bash per library running and fork each "
+              "test from it, rather than start bash for every test"),
+    MU_OPTION("jobs", MU_TYPE_INTEGER, jobs_get, jobs_set,
+              "Number of tests from a library to run at once"),
     MU_OPTION_END
 };
 
@@ -281,6 +327,8 @@ static MuLoader shloader =
 	.test_name = sh_test_name,
 	.test_suite = sh_test_suite,
     .dispatch = sh_dispatch,
+    .start = sh_start,
+    .finish = sh_finish,
     .free_result = sh_free_result,
     .construct = sh_construct,
     .destruct = sh_destruct,
@@ -295,7 +343,7 @@ get_shloader()
 
 static MuPlugin plugin =
 {
-    .version = MU_PLUGIN_API_1,
+    .version = MU_PLUGIN_API_2,
     .type = MU_PLUGIN_LOADER,
     .name = "sh",
     .author = "Brian Koropoff",
@@ -30,6 +30,9 @@
 
 #include <moonunit/test.h>
 #include <moonunit/library.h>
+#include <stdbool.h>
+
+#include "process.h"
 
 typedef struct ShTest
 {
@@ -39,12 +42,23 @@ typedef struct ShTest
     const char* name;
 } ShTest;
 
+/* Long-lived bash which has already sourced a library */
+typedef struct ShServer
+{
+    Process process;
+    bool serving;
+    bool busy;
+} ShServer;
+
 typedef struct ShLibrary
 {
     MuLibrary base;
     char* path;
     char* name;
     ShTest** tests;
+    ShServer** servers;
+    /* Tests started but not yet finished, in the order started */
+    struct ShPending** pending;
 } ShLibrary;
 
 #endif
@@ -190,7 +190,7 @@ static void test_log(MuLogger* _self, MuLogEvent const* event)
     XmlLogger* self = (XmlLogger*) _self;
     const char* level_str = "unknown";
 
-    if (event->level > self->loglevel)
+    if (event->kind == MU_EVENT_MESSAGE && event->level > self->loglevel)
     {
         return;
     }
@@ -208,6 +208,12 @@ static void test_log(MuLogger* _self, MuLogEvent const* event)
         case MU_LEVEL_TRACE:
             level_str = "trace"; break;
     }
+
+    /* Captured output is recorded as an event named after its stream */
+    if (event->kind == MU_EVENT_STDOUT)
+        level_str = "stdout";
+    else if (event->kind == MU_EVENT_STDERR)
+        level_str = "stderr";
     fprintf(self->out, INDENT_TEST INDENT "<event level=\"%s\"", level_str);
 
     fprintf(self->out, " stage=\"%s\"", mu_test_stage_to_string(event->stage));
@@ -326,6 +332,24 @@ static void test_leave(MuLogger* _self,
         output(out, INDENT_TEST " 　</backtrace>\n");
     }
 
+    if (summary->benchmark)
+    {
+        MuBenchmark* bench = summary->benchmark;
+
+        fprintf(out, INDENT_TEST INDENT "<benchmark iterations=\"%u\" warmup=\"%u\" steady=\"%s\"",
+                bench->iterations, bench->warmup, bench->steady ? "true" : "false");
+        fprintf(out, " mean=\"%g\" min=\"%g\" max=\"%g\" stddev=\"%g\"/>\n",
+                bench->mean, bench->min, bench->max, bench->stddev);
+    }
+
+    if (summary->bytes_processed || summary->items_processed)
+    {
+        fprintf(out, INDENT_TEST INDENT "<throughput bytes=\"%llu\" items=\"%llu\"",
+                summary->bytes_processed, summary->items_processed);
+        fprintf(out, " bytes-per-second=\"%g\" items-per-second=\"%g\"/>\n",
+                summary->bytes_per_second, summary->items_per_second);
+    }
+
     output(out, INDENT_TEST "</test>\n");
 }
 
@@ -520,7 +544,7 @@ create_xmllogger()
 
 static MuPlugin plugin =
 {
-    .version = MU_PLUGIN_API_1,
+    .version = MU_PLUGIN_API_2,
     .type = MU_PLUGIN_LOGGER,
     .name = "xml",
     .author = "Brian Koropoff",
@@ -0,0 +1,160 @@
+#!/bin/sh
+#
+# Copyright (c) 2008 Brian Koropoff
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#     * Redistributions of source code must retain the above copyright
+#       notice, this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright
+#       notice, this list of conditions and the following disclaimer in the
+#       documentation and/or other materials provided with the distribution.
+#     * Neither the name of the Moonunit project nor the
+#       names of its contributors may be used to endorse or promote products
+#       derived from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+# EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+# DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+# (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+# ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#
+# Generates synthetic test libraries for the harness benchmark.
+#
+# Usage: bench-gen.sh <kind> <count> <output>
+#
+#   kind    empty   -- tests which do nothing
+#           log     -- tests which log LOG_COUNT messages each
+#           payload -- tests which log and fail with PAYLOAD_SIZE bytes
+#   count   number of tests to generate
+#   output  file to write; a .c suffix produces a C library
+#           and a .sh suffix produces a shell library
+#
+# Tests are grouped into suites of SUITE_SIZE tests.
+#
+
+SUITE_SIZE=100
+LOG_COUNT=100
+PAYLOAD_SIZE=65536
+
+die()
+{
+    echo "$@" >&2
+    exit 1
+}
+
+[ "$#" -eq 3 ] || die "Usage: $0 <kind> <count> <output>"
+
+KIND="$1"
+COUNT="$2"
+OUTPUT="$3"
+
+case "$KIND" in
+    empty|log|payload)
+        ;;
+    *)
+        die "Unknown benchmark kind: $KIND"
+        ;;
+esac
+
+gen_c()
+{
+    cat << __EOF__
+/* Automatically generated by bench-gen.sh */
+
+#include <moonunit/interface.h>
+#include <string.h>
+
+static void
+bench_$KIND(void)
+{
+__EOF__
+
+    case "$KIND" in
+        log)
+            cat << __EOF__
+    int i;
+
+    for (i = 0; i < $LOG_COUNT; i++)
+        MU_INFO("Logging message %i of %i", i + 1, $LOG_COUNT);
+__EOF__
+            ;;
+        payload)
+            cat << __EOF__
+    static char payload[$PAYLOAD_SIZE];
+
+    memset(payload, 'x', sizeof(payload) - 1);
+    MU_INFO("%s", payload);
+    MU_EXPECT(MU_STATUS_FAILURE);
+    MU_FAILURE("%s", payload);
+__EOF__
+            ;;
+    esac
+
+    cat << __EOF__
+}
+
+__EOF__
+
+    awk -v count="$COUNT" -v size="$SUITE_SIZE" -v kind="$KIND" 'BEGIN {
+        for (i = 0; i < count; i++)
+            printf("MU_TEST(Bench%u, %s%u) { bench_%s(); }\n",
+                   i / size, kind, i, kind);
+    }'
+}
+
+gen_sh()
+{
+    cat << __EOF__
+# Automatically generated by bench-gen.sh
+
+bench_empty()
+{
+    :
+}
+
+bench_log()
+{
+    i=1
+    while [ \$i -le $LOG_COUNT ]
+    do
+        mu_info "Logging message \$i of $LOG_COUNT"
+        i=\$((i + 1))
+    done
+}
+
+bench_payload()
+{
+    payload=\$(head -c $((PAYLOAD_SIZE - 1)) /dev/zero | tr '\\0' x)
+    mu_info "\$payload"
+    mu_expect failure
+    mu_failure "\$payload"
+}
+
+__EOF__
+
+    awk -v count="$COUNT" -v size="$SUITE_SIZE" -v kind="$KIND" 'BEGIN {
+        for (i = 0; i < count; i++)
+            printf("test_Bench%u_%s%u()\n{\n    bench_%s\n}\n\n",
+                   i / size, kind, i, kind);
+    }'
+}
+
+case "$OUTPUT" in
+    *.c)
+        gen_c > "$OUTPUT" || die "Could not write $OUTPUT"
+        ;;
+    *.sh)
+        gen_sh > "$OUTPUT" || die "Could not write $OUTPUT"
+        ;;
+    *)
+        die "Unknown output type: $OUTPUT"
+        ;;
+esac
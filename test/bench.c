@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2008, Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/**
+ * @file bench.c
+ * @brief MoonUnit harness overhead benchmark
+ *
+ * Runs every test in each library once per logger and reports what
+ * the harness itself costs per test: total wall time, time spent in
+ * dispatch (fork to result), dispatch time not accounted for by the
+ * test itself, IPC bytes received from the test process, and the
+ * rate at which the logger consumes records.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <moonunit/logger.h>
+#include <moonunit/loader.h>
+#include <moonunit/library.h>
+#include <moonunit/plugin.h>
+#include <moonunit/private/util.h>
+#include <uipc/ipc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define die(fmt, ...)                               \
+    do {                                            \
+        fprintf(stderr, fmt "\n", ## __VA_ARGS__);  \
+        exit(255);                                  \
+    } while (0);                                    \
+
+typedef struct BenchStats
+{
+    unsigned int tests;
+    unsigned long events;
+    double wall;
+    double dispatch;
+    double dispatch_min;
+    double dispatch_max;
+    double overhead;
+    double logger;
+    unsigned long long ipc_bytes;
+} BenchStats;
+
+typedef struct BenchProxy
+{
+    MuLogger* logger;
+    BenchStats* stats;
+} BenchProxy;
+
+static double
+now(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+    }
+#endif
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Logger which discards everything, used as a baseline
+   for the cost of loading and dispatching alone */
+
+static void null_logger(MuLogger* self) {}
+static void null_path(MuLogger* self, const char* path, MuLibrary* library) {}
+static void null_string(MuLogger* self, const char* string) {}
+static void null_test(MuLogger* self, MuTest* test) {}
+static void null_event(MuLogger* self, MuLogEvent const* event) {}
+static void null_result(MuLogger* self, MuTest* test, MuTestResult* result) {}
+
+static MuLogLevel
+null_max_log_level(MuLogger* self)
+{
+    return MU_LEVEL_TRACE;
+}
+
+static MuLogger nulllogger =
+{
+    .enter = null_logger,
+    .leave = null_logger,
+    .library_enter = null_path,
+    .library_fail = null_string,
+    .library_leave = null_logger,
+    .suite_enter = null_string,
+    .suite_leave = null_logger,
+    .test_enter = null_test,
+    .test_log = null_event,
+    .test_leave = null_result,
+    .max_log_level = null_max_log_level,
+    .destroy = null_logger,
+    .options = NULL
+};
+
+static MuLogger*
+create_logger(const char* name)
+{
+    MuLogger* logger;
+
+    if (!strcmp(name, "null"))
+        return &nulllogger;
+
+    logger = mu_plugin_create_logger(name);
+
+    if (!logger)
+        die("Error: Could not create logger '%s'", name);
+
+    /* Keep the terminal out of the measurement and
+       make sure every logged event is formatted */
+    if (mu_logger_option_type(logger, "file") == MU_TYPE_STRING)
+        mu_logger_set_option_string(logger, "file", "/dev/null");
+    if (mu_logger_option_type(logger, "loglevel") == MU_TYPE_STRING)
+        mu_logger_set_option_string(logger, "loglevel", "trace");
+
+    return logger;
+}
+
+static void
+destroy_logger(MuLogger* logger)
+{
+    if (logger != &nulllogger)
+        mu_logger_destroy(logger);
+}
+
+static void
+set_loader_option(char* spec)
+{
+    char* key = strchr(spec, ':');
+    char* value;
+    MuLoader* loader;
+
+    if (!key)
+        die("Error: Malformed loader option '%s'", spec);
+
+    *(key++) = '\0';
+
+    if ((value = strchr(key, '=')))
+        *(value++) = '\0';
+
+    loader = mu_plugin_get_loader_with_name(spec);
+
+    if (!loader)
+        die("Error: Could not find loader '%s'", spec);
+
+    if (value)
+        mu_loader_set_option_string(loader, key, value);
+    else if (mu_loader_option_type(loader, key) == MU_TYPE_BOOLEAN)
+        mu_loader_set_option(loader, key, true);
+}
+
+static void
+event_proxy_cb(MuLogEvent const* event, void* data)
+{
+    BenchProxy* proxy = (BenchProxy*) data;
+    double start = now();
+
+    mu_logger_test_log(proxy->logger, event);
+
+    proxy->stats->logger += now() - start;
+    proxy->stats->events++;
+}
+
+static void
+bench_library(MuLoader* loader, MuLogger* logger, const char* path, BenchStats* stats)
+{
+    MuError* err = NULL;
+    MuLibrary* library = NULL;
+    MuTest** tests = NULL;
+    BenchProxy proxy = { .logger = logger, .stats = stats };
+    const char* current_suite = NULL;
+    uipc_statistics ipc_start, ipc_end;
+    double start, mark;
+    unsigned int index;
+
+    memset(stats, 0, sizeof(*stats));
+
+    uipc_get_statistics(&ipc_start);
+    start = now();
+
+    mu_logger_enter(logger);
+
+    library = mu_loader_open(loader, path, &err);
+
+    MU_CATCH_ALL(err)
+    {
+        die("Error: Could not load %s: %s", path, err->message);
+    }
+
+    mu_logger_library_enter(logger, path, library);
+
+    mu_library_construct(library, &err);
+
+    MU_CATCH_ALL(err)
+    {
+        die("Error: Could not construct %s: %s", path, err->message);
+    }
+
+    tests = mu_library_get_tests(library);
+
+    for (index = 0; tests && tests[index]; index++)
+    {
+        MuTest* test = tests[index];
+        MuTestResult* result;
+        double elapsed;
+
+        mark = now();
+
+        if (current_suite == NULL || strcmp(current_suite, mu_test_suite(test)))
+        {
+            if (current_suite)
+                mu_logger_suite_leave(logger);
+            current_suite = mu_test_suite(test);
+            mu_logger_suite_enter(logger, current_suite);
+        }
+
+        mu_logger_test_enter(logger, test);
+        stats->logger += now() - mark;
+
+        mark = now();
+        result = loader->dispatch(loader, test, event_proxy_cb, &proxy,
+                                  mu_logger_max_log_level(logger));
+        elapsed = now() - mark;
+
+        mark = now();
+        mu_logger_test_leave(logger, test, result);
+        stats->logger += now() - mark;
+
+        stats->dispatch += elapsed;
+        stats->overhead += elapsed - result->time;
+
+        if (stats->tests == 0 || elapsed < stats->dispatch_min)
+            stats->dispatch_min = elapsed;
+        if (elapsed > stats->dispatch_max)
+            stats->dispatch_max = elapsed;
+
+        stats->tests++;
+
+        loader->free_result(loader, result);
+    }
+
+    if (current_suite)
+        mu_logger_suite_leave(logger);
+
+    mu_library_destruct(library, &err);
+
+    MU_CATCH_ALL(err)
+    {
+        die("Error: Could not destruct %s: %s", path, err->message);
+    }
+
+    mu_logger_library_leave(logger);
+
+    if (tests)
+        mu_library_free_tests(library, tests);
+
+    mu_library_close(library);
+
+    mu_logger_leave(logger);
+
+    stats->wall = now() - start;
+    uipc_get_statistics(&ipc_end);
+    stats->ipc_bytes = ipc_end.bytes_received - ipc_start.bytes_received;
+}
+
+static void
+print_header(void)
+{
+    printf("%-24s %-6s %-8s %7s %10s %10s %10s %10s %10s %10s %12s\n",
+           "library", "loader", "logger", "tests",
+           "wall", "dispatch", "min", "max", "overhead", "ipc",
+           "logger");
+    printf("%-24s %-6s %-8s %7s %10s %10s %10s %10s %10s %10s %12s\n",
+           "", "", "", "",
+           "us/test", "us/test", "us", "us", "us/test", "B/test",
+           "records/s");
+}
+
+static void
+print_stats(const char* path, MuLoader* loader, const char* logger, BenchStats* stats)
+{
+    double tests = stats->tests ? stats->tests : 1;
+    /* Each test produces an enter, a leave and its events */
+    double records = 2 * stats->tests + stats->events;
+
+    printf("%-24s %-6s %-8s %7u %10.1f %10.1f %10.1f %10.1f %10.1f %10.0f %12.0f\n",
+           basename_pure(path),
+           loader->plugin ? loader->plugin->name : "?",
+           logger,
+           stats->tests,
+           stats->wall / tests * 1e6,
+           stats->dispatch / tests * 1e6,
+           stats->dispatch_min * 1e6,
+           stats->dispatch_max * 1e6,
+           stats->overhead / tests * 1e6,
+           stats->ipc_bytes / tests,
+           stats->logger > 0 ? records / stats->logger : 0.0);
+    fflush(stdout);
+}
+
+static void
+usage(const char* program)
+{
+    fprintf(stderr,
+            "Usage: %s [options] library...\n"
+            "  -l <logger>                  Benchmark with logger (repeatable, default:\n"
+            "                               null console xml json)\n"
+            "  --loader-option <l>:<k>=<v>  Set option <k> of loader <l> to <v>\n",
+            program);
+}
+
+int
+main(int argc, char** argv)
+{
+    static const char* default_loggers[] = { "null", "console", "xml", "json" };
+    const char** loggers = NULL;
+    unsigned int num_loggers = 0;
+    int i;
+    unsigned int j;
+
+    loggers = xmalloc(sizeof(*loggers) * argc);
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+        if (!strcmp(argv[i], "-l") && i + 1 < argc)
+        {
+            loggers[num_loggers++] = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--loader-option") && i + 1 < argc)
+        {
+            set_loader_option(argv[++i]);
+        }
+        else
+        {
+            usage(argv[0]);
+            return 255;
+        }
+    }
+
+    if (i == argc)
+    {
+        usage(argv[0]);
+        return 255;
+    }
+
+    if (num_loggers == 0)
+    {
+        free(loggers);
+        loggers = default_loggers;
+        num_loggers = sizeof(default_loggers) / sizeof(*default_loggers);
+    }
+
+    print_header();
+
+    for (; i < argc; i++)
+    {
+        const char* path = argv[i];
+        MuLoader* loader = mu_plugin_get_loader_for_file(path);
+
+        if (!loader)
+            die("Error: Could not find loader for file %s", basename_pure(path));
+
+        for (j = 0; j < num_loggers; j++)
+        {
+            MuLogger* logger = create_logger(loggers[j]);
+            BenchStats stats;
+
+            bench_library(loader, logger, path, &stats);
+            print_stats(path, loader, loggers[j], &stats);
+
+            destroy_logger(logger);
+        }
+    }
+
+    if (loggers != default_loggers)
+        free(loggers);
+
+    mu_plugin_shutdown();
+
+    return 0;
+}
@@ -34,6 +34,7 @@
 
 #include <moonunit/interface.h>
 
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -208,6 +209,44 @@ MU_TEST(Log, trace)
     MU_TRACE("This is trace output");
 }
 
+/*
+ * Logs more than the child can buffer at once, including
+ * one message which is larger than the whole buffer
+ */
+MU_TEST(Log, volume)
+{
+    static char large[512 * 1024];
+    int i;
+
+    memset(large, 'x', sizeof(large) - 1);
+
+    for (i = 0; i < 10000; i++)
+        MU_TRACE("Event %i", i);
+
+    MU_TRACE("%s", large);
+    MU_TRACE("Done");
+}
+
+/* Strings this long are streamed to the harness in chunks
+   and truncated to the loader's log-limit */
+MU_TEST(Log, stream)
+{
+    static char blob[8 * 1024 * 1024];
+
+    memset(blob, 'x', sizeof(blob) - 1);
+
+    MU_TRACE("%s", blob);
+}
+
+/*
+ * Output is captured and logged along with the test's events
+ */
+MU_TEST(Log, output)
+{
+    printf("This went to stdout\n");
+    fprintf(stderr, "This went to stderr\n");
+}
+
 MU_TEST(Log, resource)
 {
     MU_INFO("%s", MU_RESOURCE("info message"));
@@ -320,4 +359,47 @@ MU_TEST(Thread, race)
     MU_ASSERT_NOT_REACHED();
 }
 
+/*
+ * This test demonstrates benchmarking.  Runs are discarded as
+ * warmup until their timings level off, and the following 20 runs
+ * are measured and summarized in the results.
+ */
+MU_TEST(Benchmark, warmup)
+{
+    static char buffer[1 << 16];
+    unsigned int i;
+
+    MU_WARMUP(MU_WARMUP_AUTO);
+    MU_ITERATE(20);
+
+    for (i = 0; i < sizeof(buffer); i++)
+        buffer[i] = (char) (i * 31);
+
+    MU_ASSERT(buffer[1] == 31);
+}
+
+/*
+ * This test reports how much data it processes, which the
+ * logger converts to a throughput using the test stage time.
+ */
+MU_TEST(Benchmark, throughput)
+{
+    static char buffer[1 << 16];
+    unsigned int i, lines = 0;
+
+    memset(buffer, 'x', sizeof(buffer));
+
+    for (i = 0; i < sizeof(buffer); i += 64)
+        buffer[i] = '\n';
+
+    for (i = 0; i < sizeof(buffer); i++)
+        if (buffer[i] == '\n')
+            lines++;
+
+    MU_ASSERT_EQUAL(MU_TYPE_INTEGER, (int) lines, (int) (sizeof(buffer) / 64));
+
+    MU_SET_BYTES_PROCESSED(sizeof(buffer));
+    MU_SET_ITEMS_PROCESSED(lines);
+}
+
 /** \endcond */
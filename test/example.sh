@@ -50,6 +50,13 @@ test_Shell_fixture_setup()
     mu_assert [ "${HELLO_WORLD}" = "hello world" ]
 }
 
+# Takes down the shell running it.  In persistent mode that is the
+# server, which has to be replaced for the tests that follow
+test_Shell_kill_shell()
+{
+    kill -KILL $$
+}
+
 test_Shell_log()
 {
     mu_warning "This is a warning"
@@ -94,4 +101,10 @@ test_Shell_resource_bogus()
 test_Shell_construct()
 {
     mu_assert [ -f "${TMPFILE}" ]
-}
\ No newline at end of file
+}
+# Fails without expecting to, so that a run of this suite alone must
+# report one failure; the default test run leaves it out
+test_ShellFailure_unexpected()
+{
+    mu_failure "This failure must be reported"
+}
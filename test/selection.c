@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) Brian Koropoff
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Moonunit project nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BRIAN KOROPOFF ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL BRIAN KOROPOFF BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Tests for the --test pattern matcher of the moonunit program, which
+ * is built into this library from its source.  Its globs must agree
+ * with fnmatch using FNM_PATHNAME, which it replaced.
+ */
+
+/* First, so that its configuration applies to the system headers */
+#include "../src/moonunit/selection.c"
+
+#include <moonunit/interface.h>
+
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* patterns[] =
+{
+    "lib/Suite/name",
+    "*/*/*",
+    "lib/*/*",
+    "*/Suite/n*e",
+    "*/*/n?me",
+    "*/*/*_[0-9]",
+    "*/*/*_[!0-9]",
+    "*/*/[[:upper:]]*",
+    "*/S[a-u]ite/*",
+    "*/*/[]x]*",
+    "*/*/a\\*b",
+    "*/*/a\\[b",
+    "*/*/a[b",
+    "*/*/*\\",
+    "lib/*",
+    "lib/*/*/*",
+    "*/**/na**me",
+    "*/Suite/",
+    NULL
+};
+
+static const char* names[] =
+{
+    "lib/Suite/name",
+    "lib/Suite/nme",
+    "lib/Suite/name_1",
+    "lib/Suite/name_x",
+    "lib/Suite/Name",
+    "lib/Suate/name",
+    "lib/Sxite/name",
+    "lib/Suite/]name",
+    "lib/Suite/xname",
+    "lib/Suite/a*b",
+    "lib/Suite/acb",
+    "lib/Suite/a[b",
+    "lib/Suite/a\\",
+    "other/Suite/name",
+    "other/Suite/",
+    "lib/Sub/Suite/name",
+    "lib/Suite/na/me",
+    NULL
+};
+
+/* Split a path at its first two slashes, as a test would be named */
+static void
+split_path(char* path, char** library, char** suite, char** name)
+{
+    *library = path;
+    *suite = strchr(path, '/');
+    *(*suite)++ = '\0';
+    *name = strchr(*suite, '/');
+    *(*name)++ = '\0';
+}
+
+static bool
+selected(Selection* selection, const char* path)
+{
+    char* copy = strdup(path);
+    char* library, *suite, *name;
+    bool result;
+
+    split_path(copy, &library, &suite, &name);
+    result = selection_match(selection, library, suite, name);
+    free(copy);
+
+    return result;
+}
+
+MU_TEST(Selection, fnmatch)
+{
+    unsigned int p, n;
+
+    for (p = 0; patterns[p]; p++)
+    {
+        Selection* selection = selection_new(1, (char**) &patterns[p]);
+
+        for (n = 0; names[n]; n++)
+        {
+            bool expected = fnmatch(patterns[p], names[n], FNM_PATHNAME) == 0;
+
+            if (selected(selection, names[n]) != expected)
+            {
+                MU_FAILURE("Pattern '%s' %s '%s', unlike fnmatch",
+                           patterns[p], expected ? "does not match" : "matches",
+                           names[n]);
+            }
+        }
+
+        selection_free(selection);
+    }
+}
+
+MU_TEST(Selection, negative)
+{
+    char* exclude[] = {"!*/S1*/*"};
+    char* mixed[] = {"*/S1*/*", "!*/*/slow*", "lib/S2/fast"};
+    Selection* selection = selection_new(1, exclude);
+
+    /* Negative patterns alone exclude from everything */
+    MU_ASSERT(selected(selection, "lib/S2/test"));
+    MU_ASSERT(!selected(selection, "lib/S1/test"));
+    MU_ASSERT(!selected(selection, "lib/S10/test"));
+
+    selection_free(selection);
+    selection = selection_new(3, mixed);
+
+    MU_ASSERT(selected(selection, "lib/S1/fast"));
+    MU_ASSERT(!selected(selection, "lib/S1/slow"));
+    MU_ASSERT(selected(selection, "lib/S2/fast"));
+    MU_ASSERT(!selected(selection, "lib/S2/other"));
+    MU_ASSERT(!selected(selection, "lib/S3/fast"));
+
+    selection_free(selection);
+}
+
+MU_TEST(Selection, groups)
+{
+    char* include[] = {"a/S/x*", "b/*/y", "*/T/z"};
+    Selection* selection = selection_new(3, include);
+
+    /* Patterns worked out for one group must not leak into the next */
+    MU_ASSERT(selected(selection, "a/S/x1"));
+    MU_ASSERT(!selected(selection, "a/S/y"));
+    MU_ASSERT(selected(selection, "b/S/y"));
+    MU_ASSERT(!selected(selection, "b/S/x1"));
+    MU_ASSERT(selected(selection, "b/T/z"));
+    MU_ASSERT(!selected(selection, "a/S/z"));
+    MU_ASSERT(selected(selection, "a/T/z"));
+    MU_ASSERT(!selected(selection, "a/T/x1"));
+    MU_ASSERT(selected(selection, "a/S/x2"));
+
+    selection_free(selection);
+}